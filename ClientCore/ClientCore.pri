@@ -0,0 +1,16 @@
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/netcompat.hpp \
+    $$PWD/framing.hpp \
+    $$PWD/message.hpp \
+    $$PWD/backoff.hpp \
+    $$PWD/connector.hpp \
+    $$PWD/messagecache.hpp \
+    $$PWD/chatclient.hpp \
+    $$PWD/clientpool.hpp
+
+win32 {
+    LIBS += -lws2_32
+    DEFINES += _WINSOCK_DEPRECATED_NO_WARNINGS WIN32_LEAN_AND_MEAN NOMINMAX
+}
@@ -0,0 +1,48 @@
+#ifndef BACKOFF_HPP
+#define BACKOFF_HPP
+
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+// Exponential backoff with full jitter: the n-th delay is drawn uniformly
+// from [0, min(maxDelay, initialDelay * 2^n)], so a crowd of clients that
+// lost the server at the same moment spreads its reconnects out instead
+// of hammering the accept loop in lockstep.
+class Backoff {
+private:
+    std::chrono::milliseconds initialDelay;
+    std::chrono::milliseconds maxDelay;
+    unsigned attempt;
+    std::mt19937 rng;
+
+public:
+    explicit Backoff(std::chrono::milliseconds initial = std::chrono::milliseconds(250),
+                     std::chrono::milliseconds maximum = std::chrono::seconds(30))
+        : initialDelay(initial), maxDelay(maximum), attempt(0), rng(std::random_device{}()) {}
+
+    void configure(std::chrono::milliseconds initial, std::chrono::milliseconds maximum) {
+        initialDelay = initial;
+        maxDelay = maximum;
+        attempt = 0;
+    }
+
+    std::chrono::milliseconds nextDelay() {
+        long long ceiling = initialDelay.count() << std::min(attempt, 20u);
+        ceiling = std::min<long long>(ceiling, maxDelay.count());
+        ++attempt;
+
+        std::uniform_int_distribution<long long> jitter(0, ceiling);
+        return std::chrono::milliseconds(jitter(rng));
+    }
+
+    void reset() {
+        attempt = 0;
+    }
+
+    unsigned attempts() const {
+        return attempt;
+    }
+};
+
+#endif
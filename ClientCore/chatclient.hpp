@@ -0,0 +1,796 @@
+#ifndef CHATCLIENT_HPP
+#define CHATCLIENT_HPP
+
+#include "netcompat.hpp"
+#include "framing.hpp"
+#include "message.hpp"
+#include "backoff.hpp"
+#include "connector.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+
+// Qt-free chat client. All handlers are invoked on the network thread
+// (the client's own receive thread, or the ClientPool thread driving it),
+// so GUI code has to marshal them to its own thread.
+//
+// When the connection drops the client reconnects with jittered backoff,
+// resumes its session with the token issued at login (falling back to the
+// saved credentials) and asks the server for the messages it missed.
+//
+// Nothing is written from the calling thread: frames are queued and the
+// network thread coalesces them into as few non-blocking writes as the
+// socket allows. Chat messages stay queued across reconnects until they
+// have been written on a logged-in connection.
+class ChatClient {
+public:
+    using MessageHandler = std::function<void(const Message&)>;
+    using UsersHandler = std::function<void(const std::vector<std::string>&)>;
+    using ResultHandler = std::function<void(bool success, const std::string& info)>;
+    using TextHandler = std::function<void(const std::string& text)>;
+    using EventHandler = std::function<void()>;
+    using HistoryHandler = std::function<void(const std::vector<Message>& newestFirst, bool hasMore)>;
+    using ConnectHandler = std::function<void(bool connected)>;
+    using ChannelsHandler = std::function<void(const std::vector<std::string>& channels)>;
+    using ReadHandler = std::function<void(long long messageId)>;
+
+private:
+    friend class ClientPool;
+
+    static const size_t kRecentIdsLimit = 4096;
+    static const size_t kMaxBatchBytes = 64 * 1024;
+    static const size_t kMaxQueuedMessages = 10000;
+
+    SocketRuntime runtime;
+    SOCKET clientSocket;
+    std::vector<Endpoint> endpoints;
+    std::chrono::milliseconds connectTimeout;
+    std::chrono::milliseconds connectStagger;
+    std::string currentUser;
+    std::atomic<bool> connected;
+    std::atomic<bool> stopping;
+    std::thread receiveThread;
+    std::vector<std::string> onlineUsers;
+    std::vector<std::string> channels;
+    mutable std::mutex stateMutex;
+
+    // Receive state, only touched by the thread reading the socket; reset
+    // when the next connection is adopted, not when one is closed.
+    FrameReader reader;
+    std::vector<Message> historyBatch;
+
+    // Outbound state, guarded by sendMutex. Control frames belong to the
+    // current connection; messageQueue entries leave only once written.
+    std::mutex sendMutex;
+    std::deque<std::string> controlQueue;
+    std::deque<std::string> messageQueue;
+    std::string writeBuffer;
+    size_t writeOffset;
+    std::deque<size_t> batchMessageEnds;
+    std::atomic<bool> sessionReady;
+    SocketWaker ownWaker;
+    std::atomic<SocketWaker*> poolWaker;
+    // Reconnect in flight on the ClientPool thread, also under sendMutex.
+    ConnectRace reconnectRace;
+
+    // Session resumption state, guarded by stateMutex.
+    std::string pendingUser;
+    std::string pendingPassword;
+    std::string savedPassword;
+    std::string sessionToken;
+    long long lastMessageId;
+    std::unordered_set<long long> recentIds;
+    std::deque<long long> recentOrder;
+
+    bool autoReconnect;
+    std::atomic<bool> resuming;
+    Backoff backoff;
+    std::chrono::steady_clock::time_point nextReconnectAt;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+
+    MessageHandler messageHandler;
+    UsersHandler usersHandler;
+    ResultHandler loginHandler;
+    ResultHandler registerHandler;
+    TextHandler bannedHandler;
+    EventHandler disconnectedHandler;
+    EventHandler reconnectedHandler;
+    HistoryHandler historyHandler;
+    ChannelsHandler channelsHandler;
+    TextHandler channelErrorHandler;
+    ReadHandler readHandler;
+    TextHandler rateLimitedHandler;
+    TextHandler messageFailedHandler;
+    MessageHandler sentHandler;
+
+public:
+    ChatClient()
+        : clientSocket(INVALID_SOCKET), connectTimeout(std::chrono::seconds(5)),
+          connectStagger(std::chrono::milliseconds(250)), connected(false), stopping(false),
+          writeOffset(0), sessionReady(false), poolWaker(nullptr),
+          lastMessageId(0), autoReconnect(true), resuming(false) {}
+
+    ~ChatClient() {
+        disconnect();
+    }
+
+    ChatClient(const ChatClient&) = delete;
+    ChatClient& operator=(const ChatClient&) = delete;
+
+    void setMessageHandler(MessageHandler handler) { messageHandler = std::move(handler); }
+    void setUsersHandler(UsersHandler handler) { usersHandler = std::move(handler); }
+    void setLoginHandler(ResultHandler handler) { loginHandler = std::move(handler); }
+    void setRegisterHandler(ResultHandler handler) { registerHandler = std::move(handler); }
+    void setBannedHandler(TextHandler handler) { bannedHandler = std::move(handler); }
+    void setDisconnectedHandler(EventHandler handler) { disconnectedHandler = std::move(handler); }
+    void setReconnectedHandler(EventHandler handler) { reconnectedHandler = std::move(handler); }
+    void setHistoryHandler(HistoryHandler handler) { historyHandler = std::move(handler); }
+    void setChannelsHandler(ChannelsHandler handler) { channelsHandler = std::move(handler); }
+    void setChannelErrorHandler(TextHandler handler) { channelErrorHandler = std::move(handler); }
+    void setReadHandler(ReadHandler handler) { readHandler = std::move(handler); }
+    // The server dropped messages for sending too fast; the text says
+    // whether the user or the address hit the limit. Sent once per burst.
+    void setRateLimitedHandler(TextHandler handler) { rateLimitedHandler = std::move(handler); }
+    // The server refused a message for another reason (not logged in,
+    // sender mismatch); the text is the server's explanation.
+    void setMessageFailedHandler(TextHandler handler) { messageFailedHandler = std::move(handler); }
+    // The server stored one of this client's messages; `msg` carries its id.
+    void setSentHandler(MessageHandler handler) { sentHandler = std::move(handler); }
+
+    void setAutoReconnect(bool enabled,
+                          std::chrono::milliseconds initialDelay = std::chrono::milliseconds(250),
+                          std::chrono::milliseconds maxDelay = std::chrono::seconds(30)) {
+        autoReconnect = enabled;
+        backoff.configure(initialDelay, maxDelay);
+    }
+
+    // Bounds every connect (initial and reconnects); staggerDelay is how long
+    // one endpoint gets before the next candidate is raced against it.
+    void setConnectTimeout(std::chrono::milliseconds timeout,
+                           std::chrono::milliseconds staggerDelay = std::chrono::milliseconds(250)) {
+        connectTimeout = timeout;
+        connectStagger = staggerDelay;
+    }
+
+    // Connects and starts a dedicated receive thread. Blocks the caller
+    // for at most the connect timeout.
+    bool connectToServer(const std::string& ip, unsigned short port) {
+        disconnect();
+        stopping = false;
+        endpoints = {Endpoint{ip, port}};
+        if (!openSocket()) {
+            return false;
+        }
+        receiveThread = std::thread(&ChatClient::receiveMessages, this);
+        return true;
+    }
+
+    // Returns immediately; the candidates are raced on the network thread
+    // and onResult reports the first outcome. If it failed and auto
+    // reconnect is on, the client keeps retrying with backoff.
+    void connectAsync(const std::vector<Endpoint>& candidates, ConnectHandler onResult) {
+        disconnect();
+        stopping = false;
+        endpoints = candidates;
+        receiveThread = std::thread([this, onResult]() {
+            bool ok = openSocket();
+            if (onResult) onResult(ok);
+            if (!ok) {
+                if (!autoReconnect) return;
+                nextReconnectAt = std::chrono::steady_clock::now() + backoff.nextDelay();
+                waitAndReconnect();
+            }
+            receiveMessages();
+        });
+    }
+
+    // Connects without a receive thread; the caller must add the client
+    // to a ClientPool which reads (and reconnects) for it.
+    bool connectDetached(const std::string& ip, unsigned short port) {
+        disconnect();
+        stopping = false;
+        endpoints = {Endpoint{ip, port}};
+        return openSocket();
+    }
+
+    void disconnect() {
+        {
+            std::lock_guard<std::mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_all();
+        connected = false;
+        wakeNetworkThread();
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (clientSocket != INVALID_SOCKET) {
+                shutdown(clientSocket, 2);
+            }
+            reconnectRace.cancel();
+        }
+        if (receiveThread.joinable() && receiveThread.get_id() != std::this_thread::get_id()) {
+            receiveThread.join();
+        }
+        closeSocket();
+    }
+
+    bool login(const std::string& username, const std::string& password) {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            pendingUser = username;
+            pendingPassword = password;
+        }
+        return sendFrame("LOGIN:" + username + ":" + password);
+    }
+
+    bool registerUser(const std::string& username, const std::string& password, const std::string& name) {
+        return sendFrame("REGISTER:" + username + ":" + password + ":" + name);
+    }
+
+    // Also accepted while the connection is down; the message goes out once
+    // the session is back. Fails only when the queue is full or the client
+    // has been disconnected.
+    bool sendMessage(const Message& msg) {
+        if (stopping) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (messageQueue.size() >= kMaxQueuedMessages) {
+                return false;
+            }
+            messageQueue.push_back(makeFrame("MESSAGE:" + msg.getData()));
+        }
+        wakeNetworkThread();
+        return true;
+    }
+
+    size_t queuedMessageCount() {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        return messageQueue.size();
+    }
+
+    bool requestUserList() {
+        return sendFrame("GET_USERS");
+    }
+
+    // Requests every message newer than sinceId, e.g. the newest id already
+    // held in a local cache; later resyncs continue from there.
+    bool syncSince(long long sinceId) {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            lastMessageId = sinceId;
+        }
+        return sendFrame("SYNC:" + std::to_string(sinceId));
+    }
+
+    // Asks for up to count messages older than beforeId (0 = the newest);
+    // the page arrives through the history handler.
+    bool requestHistory(long long beforeId, int count) {
+        return sendFrame("HISTORY:" + std::to_string(beforeId) + ":" + std::to_string(count));
+    }
+
+    // Membership is kept by the server across sessions; the updated list
+    // arrives through the channels handler. Messages to a channel are sent
+    // with its name ("#name") as the getter.
+    bool joinChannel(const std::string& channel) {
+        return sendFrame("JOIN:" + channel);
+    }
+
+    bool leaveChannel(const std::string& channel) {
+        return sendFrame("LEAVE:" + channel);
+    }
+
+    // Like requestHistory, for one channel the user belongs to.
+    bool requestChannelHistory(const std::string& channel, long long beforeId, int count) {
+        return sendFrame("CHANNEL_HISTORY:" + channel + ":" + std::to_string(beforeId) + ":" + std::to_string(count));
+    }
+
+    // Reports everything up to messageId as read on this device. The
+    // user's other sessions hear about it through their read handler.
+    bool markRead(long long messageId) {
+        return sendFrame("READ:" + std::to_string(messageId));
+    }
+
+    void setCurrentUser(const std::string& username) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        currentUser = username;
+    }
+
+    std::string getCurrentUser() const {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return currentUser;
+    }
+
+    std::vector<std::string> getOnlineUsers() const {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return onlineUsers;
+    }
+
+    std::vector<std::string> getChannels() const {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return channels;
+    }
+
+    long long getLastMessageId() const {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return lastMessageId;
+    }
+
+    bool isConnected() const {
+        return connected;
+    }
+
+    SOCKET nativeSocket() const {
+        return clientSocket;
+    }
+
+private:
+    bool openSocket() {
+        SOCKET s = connectFirstAvailable(endpoints, connectTimeout, connectStagger, &stopping);
+        if (s == INVALID_SOCKET) {
+            return false;
+        }
+        adoptSocket(s);
+        return true;
+    }
+
+    void adoptSocket(SOCKET s) {
+        socketSetNoDelay(s);
+        socketSetNonBlocking(s, true);
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            clientSocket = s;
+        }
+        reader.reset();
+        historyBatch.clear();
+        connected = true;
+    }
+
+    void closeSocket() {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (clientSocket != INVALID_SOCKET) {
+            closesocket(clientSocket);
+            clientSocket = INVALID_SOCKET;
+        }
+        // A half-written batch is resent whole on the next connection.
+        controlQueue.clear();
+        writeBuffer.clear();
+        writeOffset = 0;
+        batchMessageEnds.clear();
+        sessionReady = false;
+    }
+
+    bool sendFrame(const std::string& payload) {
+        if (!connected) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (clientSocket == INVALID_SOCKET) {
+                return false;
+            }
+            controlQueue.push_back(makeFrame(payload));
+        }
+        wakeNetworkThread();
+        return true;
+    }
+
+    void wakeNetworkThread() {
+        SocketWaker* waker = poolWaker.load();
+        (waker ? waker : &ownWaker)->wake();
+    }
+
+    void setSessionReady() {
+        sessionReady = true;
+        wakeNetworkThread();
+    }
+
+    bool hasPendingOutput() {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        return writeOffset < writeBuffer.size() || !controlQueue.empty() ||
+               (sessionReady && !messageQueue.empty());
+    }
+
+    // Writes as much queued output as the socket takes without blocking.
+    // Returns false once the connection is broken.
+    bool flushOutbound() {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (clientSocket == INVALID_SOCKET) {
+            return true;
+        }
+
+        while (writeOffset < writeBuffer.size() || fillWriteBuffer()) {
+            int sent = send(clientSocket, writeBuffer.data() + writeOffset,
+                            (int)(writeBuffer.size() - writeOffset), NET_SEND_FLAGS);
+            if (sent == SOCKET_ERROR) {
+                return socketWouldBlock(socketLastError());
+            }
+
+            writeOffset += sent;
+            while (!batchMessageEnds.empty() && batchMessageEnds.front() <= writeOffset) {
+                batchMessageEnds.pop_front();
+                messageQueue.pop_front();
+            }
+        }
+        return true;
+    }
+
+    // Packs queued frames into one write; chat messages wait for a session.
+    bool fillWriteBuffer() {
+        writeBuffer.clear();
+        writeOffset = 0;
+
+        while (!controlQueue.empty() &&
+               (writeBuffer.empty() || writeBuffer.size() + controlQueue.front().size() <= kMaxBatchBytes)) {
+            writeBuffer += controlQueue.front();
+            controlQueue.pop_front();
+        }
+
+        if (sessionReady) {
+            for (const std::string& frame : messageQueue) {
+                if (!writeBuffer.empty() && writeBuffer.size() + frame.size() > kMaxBatchBytes) {
+                    break;
+                }
+                writeBuffer += frame;
+                batchMessageEnds.push_back(writeBuffer.size());
+            }
+        }
+        return !writeBuffer.empty();
+    }
+
+    // One poll round of the dedicated network thread.
+    bool pumpOnce() {
+        if (!flushOutbound()) {
+            return false;
+        }
+
+        pollfd fds[2] = {};
+        fds[0].fd = clientSocket;
+        fds[0].events = POLLIN | (hasPendingOutput() ? POLLOUT : 0);
+        fds[1].fd = ownWaker.handle();
+        fds[1].events = POLLIN;
+
+        if (socketPoll(fds, 2, -1) < 0) {
+            return socketInterrupted(socketLastError());
+        }
+        if (fds[1].revents) {
+            ownWaker.drain();
+        }
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            return readAvailable();
+        }
+        return true;
+    }
+
+    void receiveMessages() {
+        while (!stopping) {
+            while (connected && pumpOnce()) {
+            }
+            if (stopping) {
+                break;
+            }
+
+            handleConnectionLost();
+            if (!autoReconnect) {
+                break;
+            }
+            waitAndReconnect();
+        }
+    }
+
+    // Returns once reconnected or stopped.
+    void waitAndReconnect() {
+        while (!stopping) {
+            {
+                std::unique_lock<std::mutex> lock(stopMutex);
+                if (stopCondition.wait_until(lock, nextReconnectAt, [this]() { return stopping.load(); })) {
+                    return;
+                }
+            }
+            if (attemptReconnect()) {
+                return;
+            }
+        }
+    }
+
+    // Reads what is pending on the socket and dispatches every complete frame.
+    // Returns false once the connection is closed or broken.
+    bool readAvailable() {
+        char buffer[4096];
+        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+        if (bytesReceived == SOCKET_ERROR && socketWouldBlock(socketLastError())) {
+            return true;
+        }
+        if (bytesReceived <= 0) {
+            return false;
+        }
+
+        return reader.feed(buffer, bytesReceived, [this](const std::string& frame) {
+            processServerMessage(frame);
+        });
+    }
+
+    void handleConnectionLost() {
+        if (!connected.exchange(false)) {
+            return;
+        }
+        closeSocket();
+        resuming = false;
+        nextReconnectAt = std::chrono::steady_clock::now() + backoff.nextDelay();
+        if (disconnectedHandler) disconnectedHandler();
+    }
+
+    // Used by ClientPool, which cannot block on the backoff delay itself.
+    bool reconnectDue(std::chrono::steady_clock::time_point now) const {
+        return autoReconnect && !stopping && !connected && !endpoints.empty() && now >= nextReconnectAt;
+    }
+
+    bool attemptReconnect() {
+        if (!openSocket()) {
+            nextReconnectAt = std::chrono::steady_clock::now() + backoff.nextDelay();
+            return false;
+        }
+        resumeSession();
+        return true;
+    }
+
+    // ClientPool's form of attemptReconnect(): starts a connect race or
+    // moves the running one on without blocking. Attempts still in flight
+    // are appended to `watch` so the pool's poll wakes when one completes.
+    void continueReconnect(std::vector<pollfd>& watch) {
+        SOCKET s;
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (!reconnectRace.inProgress()) {
+                reconnectRace.start(endpoints, connectTimeout, connectStagger);
+            }
+            if (!reconnectRace.advance(0)) {
+                const std::vector<pollfd>& pending = reconnectRace.pendingSockets();
+                watch.insert(watch.end(), pending.begin(), pending.end());
+                return;
+            }
+            s = reconnectRace.takeSocket();
+        }
+        if (s == INVALID_SOCKET) {
+            nextReconnectAt = std::chrono::steady_clock::now() + backoff.nextDelay();
+            return;
+        }
+        adoptSocket(s);
+        resumeSession();
+    }
+
+    void resumeSession() {
+        std::string user, token, password;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            user = currentUser;
+            token = sessionToken;
+            password = savedPassword;
+        }
+
+        if (user.empty()) {
+            backoff.reset();
+            if (reconnectedHandler) reconnectedHandler();
+            return;
+        }
+
+        resuming = true;
+        if (!token.empty()) {
+            sendFrame("RESUME:" + user + ":" + token);
+        } else {
+            sendFrame("LOGIN:" + user + ":" + password);
+        }
+    }
+
+    void sessionRestored() {
+        resuming = false;
+        backoff.reset();
+        setSessionReady();
+        sendFrame("SYNC:" + std::to_string(getLastMessageId()));
+        if (reconnectedHandler) reconnectedHandler();
+    }
+
+    // Applies `change` to the joined channel list and reports the result.
+    template <typename Change>
+    void updateChannels(Change change) {
+        std::vector<std::string> current;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            change(channels);
+            current = channels;
+        }
+        if (channelsHandler) channelsHandler(current);
+    }
+
+    // Returns false for a message already delivered (live copy vs. resync copy).
+    bool rememberMessageId(long long id) {
+        if (id <= 0) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!recentIds.insert(id).second) {
+            return false;
+        }
+        recentOrder.push_back(id);
+        if (recentOrder.size() > kRecentIdsLimit) {
+            recentIds.erase(recentOrder.front());
+            recentOrder.pop_front();
+        }
+        if (id > lastMessageId) {
+            lastMessageId = id;
+        }
+        return true;
+    }
+
+    void processServerMessage(const std::string& message) {
+        if (message.find("LOGIN_SUCCESS:") == 0) {
+            std::string username = message.substr(14);
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (username != currentUser) {
+                    sessionToken.clear();
+                    lastMessageId = 0;
+                    recentIds.clear();
+                    recentOrder.clear();
+                    if (!currentUser.empty()) {
+                        std::lock_guard<std::mutex> sendLock(sendMutex);
+                        messageQueue.erase(messageQueue.begin() + batchMessageEnds.size(), messageQueue.end());
+                    }
+                }
+                currentUser = username;
+                if (username == pendingUser) {
+                    savedPassword = pendingPassword;
+                }
+                pendingPassword.clear();
+            }
+
+            if (resuming) {
+                sessionRestored();
+            } else {
+                setSessionReady();
+                if (loginHandler) loginHandler(true, username);
+            }
+        }
+        else if (message.find("LOGIN_FAILED:") == 0) {
+            resuming = false;
+            if (loginHandler) loginHandler(false, message.substr(13));
+        }
+        else if (message.find("SESSION:") == 0) {
+            std::string data = message.substr(8);
+            size_t pos = data.find(':');
+            std::lock_guard<std::mutex> lock(stateMutex);
+            sessionToken = data.substr(0, pos);
+            if (pos != std::string::npos && lastMessageId == 0) {
+                lastMessageId = std::strtoll(data.c_str() + pos + 1, nullptr, 10);
+            }
+        }
+        else if (message.find("RESUME_SUCCESS:") == 0) {
+            sessionRestored();
+        }
+        else if (message.find("RESUME_FAILED:") == 0) {
+            std::string user, password;
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                sessionToken.clear();
+                user = currentUser;
+                password = savedPassword;
+            }
+
+            if (!password.empty()) {
+                sendFrame("LOGIN:" + user + ":" + password);
+            } else {
+                resuming = false;
+                if (loginHandler) loginHandler(false, message.substr(14));
+            }
+        }
+        else if (message.find("SYNC_DONE:") == 0) {
+            std::string data = message.substr(10);
+            size_t pos = data.find(':');
+            if (pos != std::string::npos && data.substr(pos + 1) == "1") {
+                sendFrame("SYNC:" + data.substr(0, pos));
+            }
+        }
+        else if (message.find("HISTORY:") == 0) {
+            Message msg = Message::getMessage(message.substr(8));
+            if (msg.isValid()) {
+                historyBatch.push_back(msg);
+            }
+        }
+        else if (message.find("HISTORY_DONE:") == 0) {
+            std::vector<Message> page;
+            page.swap(historyBatch);
+            if (historyHandler) historyHandler(page, message.substr(13) == "1");
+        }
+        else if (message.find("BANNED:") == 0) {
+            resuming = false;
+            if (bannedHandler) bannedHandler(message.substr(7));
+        }
+        else if (message == "REGISTER_SUCCESS") {
+            if (registerHandler) registerHandler(true, std::string());
+        }
+        else if (message.find("REGISTER_FAILED:") == 0) {
+            if (registerHandler) registerHandler(false, message.substr(16));
+        }
+        else if (message.find("MESSAGE:") == 0) {
+            Message msg = Message::getMessage(message.substr(8));
+
+            if (msg.isValid() && msg.Sender != getCurrentUser() && rememberMessageId(msg.Id) && messageHandler) {
+                messageHandler(msg);
+            }
+        }
+        else if (message.find("CHANNELS:") == 0) {
+            std::vector<std::string> list;
+            std::istringstream ss(message.substr(9));
+            std::string channel;
+            while (std::getline(ss, channel, ',')) {
+                if (!channel.empty()) {
+                    list.push_back(channel);
+                }
+            }
+            updateChannels([&list](std::vector<std::string>& current) { current.swap(list); });
+        }
+        else if (message.find("JOINED:") == 0) {
+            std::string channel = message.substr(7);
+            updateChannels([&channel](std::vector<std::string>& current) {
+                if (std::find(current.begin(), current.end(), channel) == current.end()) {
+                    current.push_back(channel);
+                }
+            });
+        }
+        else if (message.find("LEFT:") == 0) {
+            std::string channel = message.substr(5);
+            updateChannels([&channel](std::vector<std::string>& current) {
+                current.erase(std::remove(current.begin(), current.end(), channel), current.end());
+            });
+        }
+        else if (message.find("SENT:") == 0) {
+            Message msg = Message::getMessage(message.substr(5));
+            if (msg.isValid() && sentHandler) sentHandler(msg);
+        }
+        else if (message.find("RATE_LIMITED:") == 0) {
+            if (rateLimitedHandler) rateLimitedHandler(message.substr(13));
+        }
+        else if (message.find("MESSAGE_FAILED:") == 0) {
+            if (messageFailedHandler) messageFailedHandler(message.substr(15));
+        }
+        else if (message.find("READ:") == 0) {
+            if (readHandler) readHandler(std::strtoll(message.c_str() + 5, nullptr, 10));
+        }
+        else if (message.find("CHANNEL_FAILED:") == 0) {
+            if (channelErrorHandler) channelErrorHandler(message.substr(15));
+        }
+        else if (message.find("USERS_LIST:") == 0) {
+            std::vector<std::string> users;
+            std::istringstream ss(message.substr(11));
+            std::string user;
+            while (std::getline(ss, user, ',')) {
+                if (!user.empty()) {
+                    users.push_back(user);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                onlineUsers = users;
+            }
+            if (usersHandler) usersHandler(users);
+        }
+    }
+};
+
+#endif
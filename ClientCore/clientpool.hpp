@@ -0,0 +1,152 @@
+#ifndef CLIENTPOOL_HPP
+#define CLIENTPOOL_HPP
+
+#include "chatclient.hpp"
+
+#include <unordered_set>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// Drives many detached ChatClients from a single poll() thread, so bots and
+// load tools can simulate thousands of users without a thread per client.
+// Dropped clients are reconnected here once their backoff delay expires,
+// with the connect attempts polled alongside everyone's traffic so a
+// server that is down stalls nobody, and queued output is written from
+// here as well.
+class ClientPool {
+private:
+    std::unordered_set<ChatClient*> clients;
+    mutable std::mutex clientsMutex;
+    // Held by the pool thread while it calls into clients (and so into
+    // their handlers), but never across poll(); clientsMutex is only held
+    // to copy or check membership, so handlers may add, remove and send.
+    std::mutex passMutex;
+    std::thread worker;
+    std::atomic<bool> running;
+    SocketWaker waker;
+
+public:
+    ClientPool() : running(false) {}
+
+    ~ClientPool() {
+        stop();
+    }
+
+    ClientPool(const ClientPool&) = delete;
+    ClientPool& operator=(const ClientPool&) = delete;
+
+    void add(ChatClient* client) {
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.insert(client);
+        }
+        client->poolWaker = &waker;
+        waker.wake();
+    }
+
+    // Once remove() returns the pool no longer touches the client. From
+    // another thread it waits for the pass in progress to finish, so do not
+    // call it while holding a lock the client's handlers take.
+    void remove(ChatClient* client) {
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.erase(client);
+            client->poolWaker = nullptr;
+        }
+        if (std::this_thread::get_id() != worker.get_id()) {
+            std::lock_guard<std::mutex> wait(passMutex);
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        return clients.size();
+    }
+
+    void start() {
+        if (running.exchange(true)) {
+            return;
+        }
+        worker = std::thread(&ClientPool::run, this);
+    }
+
+    void stop() {
+        running = false;
+        waker.wake();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+private:
+    bool contains(ChatClient* client) const {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        return clients.count(client) != 0;
+    }
+
+    void run() {
+        std::vector<pollfd> fds;
+        std::vector<ChatClient*> owners;
+        std::vector<ChatClient*> snapshot;
+
+        while (running) {
+            fds.clear();
+            owners.clear();
+
+            pollfd wakeEntry = {};
+            wakeEntry.fd = waker.handle();
+            wakeEntry.events = POLLIN;
+            fds.push_back(wakeEntry);
+            owners.push_back(nullptr);
+            {
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                snapshot.assign(clients.begin(), clients.end());
+            }
+            {
+                std::lock_guard<std::mutex> pass(passMutex);
+                auto now = std::chrono::steady_clock::now();
+                for (ChatClient* client : snapshot) {
+                    // A handler earlier in this pass may have removed it.
+                    if (!contains(client)) continue;
+                    if (client->reconnectDue(now)) {
+                        client->continueReconnect(fds);
+                        owners.resize(fds.size(), nullptr);
+                    }
+                    if (!client->isConnected()) continue;
+                    if (!client->flushOutbound()) {
+                        client->handleConnectionLost();
+                        continue;
+                    }
+                    pollfd entry = {};
+                    entry.fd = client->nativeSocket();
+                    entry.events = POLLIN | (client->hasPendingOutput() ? POLLOUT : 0);
+                    fds.push_back(entry);
+                    owners.push_back(client);
+                }
+            }
+
+            // With nobody connected or connecting only reconnect deadlines matter.
+            int timeoutMs = fds.size() == 1 ? 10 : 100;
+            if (socketPoll(fds.data(), (unsigned long)fds.size(), timeoutMs) <= 0) {
+                continue;
+            }
+            if (fds[0].revents) {
+                waker.drain();
+            }
+
+            std::lock_guard<std::mutex> pass(passMutex);
+            for (size_t i = 1; i < fds.size(); ++i) {
+                if ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) == 0 || !owners[i] || !contains(owners[i])) continue;
+
+                if (!owners[i]->readAvailable()) {
+                    owners[i]->handleConnectionLost();
+                }
+            }
+        }
+    }
+};
+
+#endif
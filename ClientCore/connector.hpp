@@ -0,0 +1,244 @@
+#ifndef CONNECTOR_HPP
+#define CONNECTOR_HPP
+
+#include "netcompat.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+struct Endpoint {
+    std::string host;
+    unsigned short port;
+};
+
+// Parses "host:port,host:port"; entries without a valid port are skipped.
+inline std::vector<Endpoint> parseEndpoints(const std::string& list) {
+    std::vector<Endpoint> endpoints;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+
+        std::string item = list.substr(start, end - start);
+        size_t colon = item.rfind(':');
+        if (colon != std::string::npos && colon > 0) {
+            long port = std::strtol(item.c_str() + colon + 1, nullptr, 10);
+            if (port > 0 && port < 65536) {
+                endpoints.push_back(Endpoint{item.substr(0, colon), (unsigned short)port});
+            }
+        }
+        start = end + 1;
+    }
+    return endpoints;
+}
+
+// Happy-eyeballs style connect without blocking: every address of every
+// endpoint is tried with a non-blocking connect, a new attempt is started
+// each staggerDelay (or as soon as one fails) while earlier ones stay in
+// flight, and the first one to complete wins. Callers with their own poll
+// loop watch pendingSockets() for POLLOUT and call advance(0) each round;
+// only name resolution in start() blocks, which is immediate for IP
+// literals. Everything still open is closed on cancel() or destruction.
+class ConnectRace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ConnectRace() : next(0), winner(INVALID_SOCKET), done(true), stagger(0) {}
+
+    ~ConnectRace() {
+        cancel();
+    }
+
+    ConnectRace(const ConnectRace&) = delete;
+    ConnectRace& operator=(const ConnectRace&) = delete;
+
+    void start(const std::vector<Endpoint>& endpoints,
+               std::chrono::milliseconds timeout,
+               std::chrono::milliseconds staggerDelay) {
+        cancel();
+        candidates.clear();
+        for (const Endpoint& endpoint : endpoints) {
+            addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_protocol = IPPROTO_TCP;
+
+            addrinfo* results = nullptr;
+            std::string port = std::to_string(endpoint.port);
+            if (getaddrinfo(endpoint.host.c_str(), port.c_str(), &hints, &results) != 0) {
+                continue;
+            }
+            for (addrinfo* ai = results; ai; ai = ai->ai_next) {
+                Candidate candidate;
+                std::memcpy(&candidate.addr, ai->ai_addr, ai->ai_addrlen);
+                candidate.length = (socklen_t)ai->ai_addrlen;
+                candidate.family = ai->ai_family;
+                candidates.push_back(candidate);
+            }
+            freeaddrinfo(results);
+        }
+
+        stagger = staggerDelay;
+        deadline = Clock::now() + timeout;
+        nextStart = Clock::now();
+        next = 0;
+        done = false;
+    }
+
+    // Starts attempts that are due and collects finished ones, waiting at
+    // most waitMs for one to complete. Returns true once the race is over;
+    // takeSocket() then has the result.
+    bool advance(int waitMs) {
+        if (done) {
+            return true;
+        }
+        auto now = Clock::now();
+        if (now >= deadline) {
+            return finish(INVALID_SOCKET);
+        }
+
+        while (next < candidates.size() && (now >= nextStart || pending.empty())) {
+            const Candidate& candidate = candidates[next++];
+            nextStart = now + stagger;
+
+            SOCKET s = socket(candidate.family, SOCK_STREAM, IPPROTO_TCP);
+            if (s == INVALID_SOCKET) {
+                continue;
+            }
+            socketSetNonBlocking(s, true);
+
+            if (::connect(s, (const sockaddr*)&candidate.addr, candidate.length) == 0) {
+                return finish(s);
+            }
+            if (!socketWouldBlock(socketLastError())) {
+                closesocket(s);
+                continue;
+            }
+
+            pollfd entry = {};
+            entry.fd = s;
+            entry.events = POLLOUT;
+            pending.push_back(entry);
+        }
+
+        if (pending.empty()) {
+            return finish(INVALID_SOCKET);
+        }
+
+        // Never sleep past the next stagger slot or the deadline.
+        auto wakeAt = std::min(deadline, next < candidates.size() ? nextStart : deadline);
+        long long untilWake = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now).count();
+        waitMs = (int)std::max(0LL, std::min((long long)waitMs, untilWake));
+
+        if (socketPoll(pending.data(), (unsigned long)pending.size(), waitMs) <= 0) {
+            return false;
+        }
+
+        for (size_t i = 0; i < pending.size(); ) {
+            if (pending[i].revents == 0) {
+                ++i;
+                continue;
+            }
+
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+
+            SOCKET s = pending[i].fd;
+            pending.erase(pending.begin() + i);
+            if (error == 0) {
+                return finish(s);
+            }
+            closesocket(s);
+        }
+        if (pending.empty() && next >= candidates.size()) {
+            return finish(INVALID_SOCKET);
+        }
+        return false;
+    }
+
+    bool inProgress() const {
+        return !done;
+    }
+
+    // Attempts still in flight, to be polled for POLLOUT.
+    const std::vector<pollfd>& pendingSockets() const {
+        return pending;
+    }
+
+    // The connected socket (non-blocking), or INVALID_SOCKET when every
+    // attempt failed or timed out. The caller owns it.
+    SOCKET takeSocket() {
+        SOCKET s = winner;
+        winner = INVALID_SOCKET;
+        return s;
+    }
+
+    void cancel() {
+        closePending();
+        if (winner != INVALID_SOCKET) {
+            closesocket(winner);
+            winner = INVALID_SOCKET;
+        }
+        done = true;
+    }
+
+private:
+    struct Candidate {
+        sockaddr_storage addr;
+        socklen_t length;
+        int family;
+    };
+
+    bool finish(SOCKET s) {
+        closePending();
+        winner = s;
+        done = true;
+        return true;
+    }
+
+    void closePending() {
+        for (const pollfd& entry : pending) {
+            closesocket(entry.fd);
+        }
+        pending.clear();
+    }
+
+    std::vector<Candidate> candidates;
+    std::vector<pollfd> pending;
+    size_t next;
+    SOCKET winner;
+    bool done;
+    std::chrono::milliseconds stagger;
+    Clock::time_point deadline;
+    Clock::time_point nextStart;
+};
+
+// Blocking form of ConnectRace. Returns INVALID_SOCKET on timeout, when
+// all attempts fail, or when cancel becomes true. The returned socket is
+// switched back to blocking mode.
+inline SOCKET connectFirstAvailable(const std::vector<Endpoint>& endpoints,
+                                   std::chrono::milliseconds timeout,
+                                   std::chrono::milliseconds staggerDelay,
+                                   const std::atomic<bool>* cancel = nullptr) {
+    ConnectRace race;
+    race.start(endpoints, timeout, staggerDelay);
+    // Short waits so a cancel is noticed promptly.
+    while (!(cancel && cancel->load())) {
+        if (race.advance(50)) {
+            SOCKET winner = race.takeSocket();
+            if (winner != INVALID_SOCKET) {
+                socketSetNonBlocking(winner, false);
+            }
+            return winner;
+        }
+    }
+    return INVALID_SOCKET;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef FRAMING_HPP
+#define FRAMING_HPP
+
+#include <string>
+#include <cstddef>
+
+// Every command and reply on the wire is a single line terminated by '\n'.
+// TCP may split or coalesce writes, so readers must reassemble frames.
+static const std::size_t kMaxFrameSize = 64 * 1024;
+
+inline std::string makeFrame(const std::string& payload) {
+    std::string frame;
+    frame.reserve(payload.size() + 1);
+    frame += payload;
+    frame.push_back('\n');
+    return frame;
+}
+
+class FrameReader {
+private:
+    std::string pending;
+
+public:
+    // Appends received bytes and calls onFrame for every complete frame.
+    // Returns false if the peer sent an oversized frame.
+    template <typename Handler>
+    bool feed(const char* data, std::size_t length, Handler&& onFrame) {
+        pending.append(data, length);
+
+        std::size_t start = 0;
+        std::size_t pos;
+        while ((pos = pending.find('\n', start)) != std::string::npos) {
+            onFrame(pending.substr(start, pos - start));
+            start = pos + 1;
+        }
+        pending.erase(0, start);
+
+        return pending.size() <= kMaxFrameSize;
+    }
+
+    void reset() {
+        pending.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <string>
+#include <sstream>
+#include <cstdlib>
+
+class Message {
+public:
+    std::string Getter;
+    std::string Sender;
+    std::string Text;
+    std::string Tag;
+    long long Id = 0;
+
+    Message() = default;
+    Message(const std::string& g, const std::string& s, const std::string& t, const std::string& tg)
+        : Getter(g), Sender(s), Text(t), Tag(tg) {}
+
+    // The server-assigned storage id travels as an optional fifth field.
+    std::string getData() const {
+        std::string data = Sender + ";" + Getter + ";" + Text + ";" + Tag;
+        if (Id > 0) {
+            data += ";" + std::to_string(Id);
+        }
+        return data;
+    }
+
+    static Message getMessage(const std::string& data) {
+        std::istringstream ss(data);
+        std::string parts[5];
+        for (int i = 0; i < 5 && std::getline(ss, parts[i], ';'); ++i);
+        if (!parts[0].empty() && !parts[1].empty() && !parts[2].empty() && !parts[3].empty()) {
+            Message msg(parts[1], parts[0], parts[2], parts[3]);
+            msg.Id = std::strtoll(parts[4].c_str(), nullptr, 10);
+            return msg;
+        }
+        return Message();
+    }
+
+    bool isValid() const {
+        return !Sender.empty() && !Getter.empty();
+    }
+};
+
+#endif
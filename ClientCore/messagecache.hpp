@@ -0,0 +1,206 @@
+#ifndef MESSAGECACHE_HPP
+#define MESSAGECACHE_HPP
+
+#include "message.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Append-only on-disk history for one account: one Message::getData()
+// record per line, oldest first. Nothing is loaded up front; pages are
+// read backwards from the end of the file as the user scrolls, and the
+// newest cached id tells the server where to resume (SYNC:<id>). Outgoing
+// messages are cached once the server has assigned their id.
+class MessageCache {
+private:
+    static const long long kBlockSize = 64 * 1024;
+    static const long long kCompactThreshold = 8 * 1024 * 1024;
+    static const size_t kCompactKeepRecords = 20000;
+
+    std::string path;
+    std::ofstream out;
+    long long cursor;
+    long long newestId;
+
+public:
+    MessageCache() : cursor(0), newestId(0) {}
+
+    bool open(const std::string& filePath) {
+        close();
+        path = filePath;
+
+        long long size = fileSize();
+        if (size > kCompactThreshold) {
+            compact();
+            size = fileSize();
+        }
+
+        out.open(path, std::ios::binary | std::ios::app);
+        if (!out) {
+            return false;
+        }
+
+        // A record torn by a crash must not swallow the next append.
+        if (size > 0 && lastByte() != '\n') {
+            out.put('\n');
+            out.flush();
+            size = fileSize();
+        }
+
+        cursor = size;
+        newestId = scanNewestId();
+        return true;
+    }
+
+    void close() {
+        if (out.is_open()) {
+            out.close();
+        }
+        cursor = 0;
+        newestId = 0;
+    }
+
+    bool isOpen() const {
+        return out.is_open();
+    }
+
+    void append(const Message& msg) {
+        if (!out.is_open()) return;
+        out << msg.getData() << '\n';
+        if (msg.Id > newestId) {
+            newestId = msg.Id;
+        }
+    }
+
+    // Makes appended records durable; call once per batch, not per message.
+    void flush() {
+        if (out.is_open()) out.flush();
+    }
+
+    long long lastId() const {
+        return newestId;
+    }
+
+    // Pages from the newest record again.
+    void rewind() {
+        if (!out.is_open()) return;
+        out.flush();
+        cursor = fileSize();
+    }
+
+    bool hasOlder() const {
+        return cursor > 0;
+    }
+
+    // Returns up to count records older than everything returned so far,
+    // newest first.
+    std::vector<Message> readOlder(size_t count) {
+        std::vector<Message> page;
+        if (cursor <= 0 || count == 0) return page;
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return page;
+
+        std::string tail;
+        long long scanPos = cursor;
+
+        while (page.size() < count && cursor > 0) {
+            size_t end = tail.size();
+            size_t prev = end >= 2 ? tail.rfind('\n', end - 2) : std::string::npos;
+
+            if (prev == std::string::npos && scanPos > 0) {
+                long long blockStart = std::max(0LL, scanPos - kBlockSize);
+                std::string block((size_t)(scanPos - blockStart), '\0');
+                in.seekg(blockStart);
+                in.read(&block[0], (std::streamsize)block.size());
+                tail.insert(0, block);
+                scanPos = blockStart;
+                continue;
+            }
+
+            size_t recordStart = (prev == std::string::npos) ? 0 : prev + 1;
+            std::string record = tail.substr(recordStart, end - recordStart - 1);
+            tail.resize(recordStart);
+            cursor -= (long long)record.size() + 1;
+
+            Message msg = Message::getMessage(record);
+            if (msg.isValid()) {
+                page.push_back(msg);
+            }
+        }
+
+        return page;
+    }
+
+private:
+    long long fileSize() const {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        return in ? (long long)in.tellg() : 0;
+    }
+
+    char lastByte() const {
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(-1, std::ios::end);
+        char c = '\n';
+        in.get(c);
+        return c;
+    }
+
+    // Older files have outgoing messages without an id, so this looks back
+    // as far as it takes to find one.
+    long long scanNewestId() {
+        long long savedCursor = cursor;
+        long long best = 0;
+        for (size_t page = 64; best == 0 && cursor > 0; page *= 2) {
+            for (const Message& msg : readOlder(page)) {
+                best = std::max(best, msg.Id);
+            }
+        }
+        cursor = savedCursor;
+        return best;
+    }
+
+    // Rewrites the file keeping only the newest records.
+    void compact() {
+        cursor = fileSize();
+        std::vector<Message> keep = readOlder(kCompactKeepRecords);
+        cursor = 0;
+
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream tmp(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!tmp) return;
+            for (auto it = keep.rbegin(); it != keep.rend(); ++it) {
+                tmp << it->getData() << '\n';
+            }
+            tmp.close();
+            if (!tmp) {
+                std::remove(tmpPath.c_str());
+                return;
+            }
+        }
+
+        // The old file stays in place unless the new one fully replaced it.
+        if (!replaceFile(tmpPath, path)) {
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    // Atomic on both platforms: readers see the old file or the new one.
+    static bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef NETCOMPAT_HPP
+#define NETCOMPAT_HPP
+
+#ifdef _WIN32
+
+#ifndef _WINSOCK_DEPRECATED_NO_WARNINGS
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#define NET_SEND_FLAGS 0
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+
+inline int closesocket(SOCKET s) {
+    return ::close(s);
+}
+
+#endif
+
+#include <atomic>
+
+// Keeps the platform socket runtime alive (WSAStartup/WSACleanup on Windows).
+// Any number of instances may exist; the runtime is torn down with the last one.
+class SocketRuntime {
+public:
+    SocketRuntime() {
+#ifdef _WIN32
+        if (refCount()++ == 0) {
+            WSADATA wsaData;
+            WSAStartup(MAKEWORD(2, 2), &wsaData);
+        }
+#endif
+    }
+
+    ~SocketRuntime() {
+#ifdef _WIN32
+        if (--refCount() == 0) {
+            WSACleanup();
+        }
+#endif
+    }
+
+    SocketRuntime(const SocketRuntime&) = delete;
+    SocketRuntime& operator=(const SocketRuntime&) = delete;
+
+private:
+    static std::atomic<int>& refCount() {
+        static std::atomic<int> count(0);
+        return count;
+    }
+};
+
+inline bool socketSetNonBlocking(SOCKET s, bool enabled) {
+#ifdef _WIN32
+    u_long mode = enabled ? 1 : 0;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    if (flags < 0) return false;
+    flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(s, F_SETFL, flags) == 0;
+#endif
+}
+
+inline void socketSetNoDelay(SOCKET s) {
+    int flag = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+}
+
+inline int socketPoll(pollfd* fds, unsigned long count, int timeoutMs) {
+#ifdef _WIN32
+    return WSAPoll(fds, count, timeoutMs);
+#else
+    return ::poll(fds, count, timeoutMs);
+#endif
+}
+
+inline int socketLastError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+inline bool socketWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+    return error == EWOULDBLOCK || error == EAGAIN || error == EINPROGRESS;
+#endif
+}
+
+inline bool socketInterrupted(int error) {
+#ifdef _WIN32
+    return error == WSAEINTR;
+#else
+    return error == EINTR;
+#endif
+}
+
+// Wakes a thread blocked in socketPoll(): poll handle() for POLLIN and call
+// drain() when it fires. A loopback UDP socket connected to itself works
+// with WSAPoll too, unlike a pipe.
+class SocketWaker {
+public:
+    SocketWaker() : sock(INVALID_SOCKET), signalled(false) {
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == INVALID_SOCKET) {
+            return;
+        }
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t length = sizeof(addr);
+
+        if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            getsockname(s, (sockaddr*)&addr, &length) == SOCKET_ERROR ||
+            ::connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            closesocket(s);
+            return;
+        }
+        socketSetNonBlocking(s, true);
+        sock = s;
+    }
+
+    ~SocketWaker() {
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
+        }
+    }
+
+    SocketWaker(const SocketWaker&) = delete;
+    SocketWaker& operator=(const SocketWaker&) = delete;
+
+    SOCKET handle() const {
+        return sock;
+    }
+
+    // Cheap when already signalled: at most one datagram per drain().
+    void wake() {
+        if (!signalled.exchange(true)) {
+            char byte = 0;
+            send(sock, &byte, 1, 0);
+        }
+    }
+
+    // Call before looking at the state the wake-ups announce. The flag is
+    // cleared after reading: cleared first, a wake() in between would send
+    // a byte that is read here and leave the flag set with nothing pending,
+    // silencing every later wake().
+    void drain() {
+        char buffer[64];
+        while (recv(sock, buffer, sizeof(buffer), 0) > 0) {
+        }
+        signalled = false;
+    }
+
+private:
+    SocketRuntime runtime;
+    SOCKET sock;
+    std::atomic<bool> signalled;
+};
+
+#endif
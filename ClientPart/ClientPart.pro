@@ -4,20 +4,20 @@ CONFIG += c++17
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+include(../ClientCore/ClientCore.pri)
+
 SOURCES += \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    messagelistmodel.cpp \
+    messagedelegate.cpp
 
 HEADERS += \
     mainwindow.h \
-    client.hpp
+    messagelistmodel.h \
+    messagedelegate.h
 
 FORMS += \
     mainwindow.ui
 
-win32 {
-    LIBS += -lws2_32
-    DEFINES += _WINSOCK_DEPRECATED_NO_WARNINGS WIN32_LEAN_AND_MEAN
-}
-
 QMAKE_CXXFLAGS += -Wno-unknown-pragmas
@@ -1,13 +1,31 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "messagelistmodel.h"
+#include "messagedelegate.h"
 #include <QMessageBox>
+#include <QScrollBar>
+#include <QEvent>
 #include <QTimer>
+#include <QThread>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
 #include <QDateTime>
+#include <QtGlobal>
+
+static const int kHistoryPageSize = 50;
+static const int kFrameIntervalMs = 16;
+static const int kDefaultConnectTimeoutMs = 5000;
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , messagesModel(new MessageListModel(this))
     , isLoggedIn(false)
+    , historyPending(false)
+    , cacheLoader(nullptr)
+    , cacheReady(false)
+    , flushScheduled(false)
 {
     ui->setupUi(this);
 
@@ -15,20 +33,106 @@ MainWindow::MainWindow(QWidget *parent)
 
     ui->RadioMed->setChecked(true);
 
-    if (!client.connectToServer("127.0.0.1", 8888)) {
-        QMessageBox::critical(this, "Ошибка", "Не удалось подключиться к серверу!");
-    }
+    ui->MessageHistory->setModel(messagesModel);
+    ui->MessageHistory->setItemDelegate(new MessageDelegate(this));
+    ui->MessageHistory->setVerticalScrollMode(QAbstractItemView::ScrollPerItem);
+    // Rows differ in height; the model caches each one per viewport width,
+    // and batched layout keeps a relayout of a full window off the frame.
+    ui->MessageHistory->setLayoutMode(QListView::Batched);
+    ui->MessageHistory->setResizeMode(QListView::Adjust);
+    ui->MessageHistory->viewport()->installEventFilter(this);
+    messagesModel->setRowLayout(ui->MessageHistory->font(), ui->MessageHistory->viewport()->width());
+    connect(ui->MessageHistory->verticalScrollBar(), &QScrollBar::valueChanged, this, [this](int value) {
+        QScrollBar *bar = ui->MessageHistory->verticalScrollBar();
+        if (value == bar->minimum()) {
+            fetchOlderHistory();
+        } else if (value == bar->maximum() && messagesModel->missingNewest()) {
+            reloadNewest();
+        }
+    });
+
+    // Incoming messages are queued by the network thread and rendered in one
+    // batch per display frame, so a burst costs a few relayouts, not one each.
+    pendingMessages.reserve(1024);
+    drainBuffer.reserve(1024);
+    frameTimer = new QTimer(this);
+    frameTimer->setSingleShot(true);
+    frameTimer->setInterval(kFrameIntervalMs);
+    connect(frameTimer, &QTimer::timeout, this, &MainWindow::flushPendingMessages);
+
+    // ChatClient calls back on its network thread; hop to the GUI thread.
+    client.setMessageHandler([this](const Message &msg) {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pendingMessages.push_back(msg);
+        }
+        if (!flushScheduled.exchange(true)) {
+            QMetaObject::invokeMethod(frameTimer, [this]() { frameTimer->start(); }, Qt::QueuedConnection);
+        }
+    });
+    client.setLoginHandler([this](bool success, const std::string &username) {
+        QString name = QString::fromStdString(username);
+        QMetaObject::invokeMethod(this, [this, success, name]() { handleLoginResult(success, name); }, Qt::QueuedConnection);
+    });
+    client.setRegisterHandler([this](bool success, const std::string &) {
+        QMetaObject::invokeMethod(this, [this, success]() { handleRegisterResult(success); }, Qt::QueuedConnection);
+    });
+    client.setBannedHandler([this](const std::string &) {
+        QMetaObject::invokeMethod(this, [this]() { handleBanned(); }, Qt::QueuedConnection);
+    });
+    client.setDisconnectedHandler([this]() {
+        QMetaObject::invokeMethod(this, [this]() { handleDisconnected(); }, Qt::QueuedConnection);
+    });
+    client.setReconnectedHandler([this]() {
+        QMetaObject::invokeMethod(this, [this]() { handleReconnected(); }, Qt::QueuedConnection);
+    });
+    client.setHistoryHandler([this](const std::vector<Message> &page, bool hasMore) {
+        QMetaObject::invokeMethod(this, [this, page, hasMore]() { handleHistory(page, hasMore); }, Qt::QueuedConnection);
+    });
+    client.setSentHandler([this](const Message &msg) {
+        QMetaObject::invokeMethod(this, [this, msg]() { handleSent(msg); }, Qt::QueuedConnection);
+    });
+    client.setRateLimitedHandler([this](const std::string &) {
+        QMetaObject::invokeMethod(this, [this]() {
+            handleMessageRefused("Слишком много сообщений, часть не доставлена. Подождите немного.");
+        }, Qt::QueuedConnection);
+    });
+    client.setMessageFailedHandler([this](const std::string &reason) {
+        QString text = "Сообщение не доставлено: " + QString::fromStdString(reason);
+        QMetaObject::invokeMethod(this, [this, text]() { handleMessageRefused(text); }, Qt::QueuedConnection);
+    });
 
-    messageTimer = new QTimer(this);
-    connect(messageTimer, &QTimer::timeout, this, &MainWindow::checkForNewMessages);
-    messageTimer->start(1000);
+    // CHAT_SERVERS is a comma-separated "host:port" list; the first server
+    // to accept wins. The window stays responsive while it connects.
+    std::vector<Endpoint> servers = parseEndpoints(
+        qEnvironmentVariable("CHAT_SERVERS", "127.0.0.1:8888").toStdString());
+    bool timeoutOk = false;
+    int timeoutMs = qEnvironmentVariableIntValue("CHAT_CONNECT_TIMEOUT_MS", &timeoutOk);
+    client.setConnectTimeout(std::chrono::milliseconds(timeoutOk && timeoutMs > 0 ? timeoutMs : kDefaultConnectTimeoutMs));
+
+    statusBar()->showMessage("Подключение к серверу...");
+    client.connectAsync(servers, [this](bool success) {
+        QMetaObject::invokeMethod(this, [this, success]() { handleConnectResult(success); }, Qt::QueuedConnection);
+    });
 }
 
 MainWindow::~MainWindow()
 {
+    client.disconnect();
+    waitForCacheLoader();
+    ui->MessageHistory->viewport()->removeEventFilter(this);
     delete ui;
 }
 
+bool MainWindow::eventFilter(QObject *watched, QEvent *event)
+{
+    // Runs before the view relayouts, so new heights are measured at the new width.
+    if (watched == ui->MessageHistory->viewport() && event->type() == QEvent::Resize) {
+        messagesModel->setRowLayout(ui->MessageHistory->font(), ui->MessageHistory->viewport()->width());
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
 void MainWindow::on_SendButton_clicked()
 {
     if (!isLoggedIn) {
@@ -59,14 +163,17 @@ void MainWindow::on_SendButton_clicked()
                 messageText.toStdString(),
                 priority.toStdString());
 
-    client.sendMessage(msg);
-
-    QString myMessage = QString("<b>[You → %1]</b> (%2): %3<br>---<br>")
-                            .arg(getter)
-                            .arg(priority)
-                            .arg(messageText);
-
-    ui->MessageHistory->append(myMessage);
+    if (!client.sendMessage(msg)) {
+        QMessageBox::warning(this, "Ошибка", "Очередь отправки переполнена, попробуйте позже!");
+        return;
+    }
+    // Cached once the server reports its id (handleSent), so lastId() can
+    // resume from it.
+    if (messagesModel->missingNewest()) {
+        reloadNewest();
+    }
+    messagesModel->appendMessage(msg, true);
+    ui->MessageHistory->scrollToBottom();
 
     ui->MessageText->clear();
 }
@@ -82,13 +189,8 @@ void MainWindow::on_RegButton_clicked()
         return;
     }
 
-    if (client.registerUser(login.toStdString(), password.toStdString(), name.toStdString())) {
-        QTimer::singleShot(1000, [this]() {
-            QMessageBox::information(this, "Успех", "Регистрация завершена!");
-            ui->LoginText->clear();
-            ui->PasswordText->clear();
-            ui->NameText->clear();
-        });
+    if (!client.registerUser(login.toStdString(), password.toStdString(), name.toStdString())) {
+        QMessageBox::warning(this, "Ошибка", "Нет соединения с сервером!");
     }
 }
 
@@ -102,34 +204,238 @@ void MainWindow::on_LogButton_clicked()
         return;
     }
 
-    if (client.login(login.toStdString(), password.toStdString())) {
-        QTimer::singleShot(1000, [this, login]() {
-            if (client.getCurrentUser() == login.toStdString()) {
-                isLoggedIn = true;
-                setWindowTitle("Chat Client - " + login);
-                QMessageBox::information(this, "Успех", "Вход выполнен!");
-
-                ui->LoginText->clear();
-                ui->PasswordText->clear();
-                ui->NameText->clear();
-            } else {
-                QMessageBox::warning(this, "Ошибка", "Неверные данные для входа!");
-            }
-        });
+    if (!client.login(login.toStdString(), password.toStdString())) {
+        QMessageBox::warning(this, "Ошибка", "Нет соединения с сервером!");
     }
 }
 
-void MainWindow::checkForNewMessages()
+void MainWindow::flushPendingMessages()
 {
-    if (isLoggedIn && client.hasNewMessages()) {
-        auto messages = client.getReceivedMessages();
-        for (const auto& msg : messages) {
-            ui->MessageHistory->append(msg.toQString());
+    flushScheduled = false;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        drainBuffer.swap(pendingMessages);
+    }
+
+    if (isLoggedIn && !drainBuffer.empty()) {
+        for (const Message &msg : drainBuffer) {
+            cacheMessage(msg);
         }
-        client.clearMessages();
+        cache.flush();
 
-        if (ui->MessageHistory->toPlainText().contains("No message recived")) {
-            ui->MessageHistory->clear();
+        QScrollBar *bar = ui->MessageHistory->verticalScrollBar();
+        bool atBottom = bar->value() == bar->maximum();
+
+        int trimmed = messagesModel->appendMessages(drainBuffer);
+
+        // Keep the rows the user was looking at in place.
+        if (atBottom) {
+            ui->MessageHistory->scrollToBottom();
+        } else if (trimmed > 0) {
+            bar->setValue(bar->value() - trimmed);
         }
+
+        // Lets the server tell this user's other devices what was seen here.
+        if (isActiveWindow()) {
+            long long newestId = 0;
+            for (const Message &msg : drainBuffer) {
+                newestId = qMax(newestId, msg.Id);
+            }
+            if (newestId > 0) {
+                client.markRead(newestId);
+            }
+        }
+    }
+
+    drainBuffer.clear();
+}
+
+void MainWindow::handleSent(const Message &msg)
+{
+    if (!isLoggedIn) {
+        return;
+    }
+    cacheMessage(msg);
+    cache.flush();
+    messagesModel->stampOutgoing(msg);
+}
+
+// Replies come in send order, so the refused message is the oldest one
+// still waiting for its SENT echo.
+void MainWindow::handleMessageRefused(const QString &status)
+{
+    messagesModel->markOutgoingFailed();
+    statusBar()->showMessage(status, 5000);
+}
+
+void MainWindow::cacheMessage(const Message &msg)
+{
+    if (cacheReady) {
+        cache.append(msg);
+    } else {
+        uncachedMessages.push_back(msg);
+    }
+}
+
+void MainWindow::fetchOlderHistory()
+{
+    if (!isLoggedIn || !cacheReady || historyPending || !messagesModel->canFetchOlder()) {
+        return;
+    }
+
+    // Page through the local cache first; only go to the server past its start.
+    if (cache.hasOlder()) {
+        handleHistory(cache.readOlder(kHistoryPageSize), true, true);
+        return;
+    }
+
+    historyPending = client.requestHistory(messagesModel->oldestId(), kHistoryPageSize);
+}
+
+// Paging back through a full window dropped the newest rows; start over
+// from the end of the cache, which has everything that arrived meanwhile.
+void MainWindow::reloadNewest()
+{
+    if (!cacheReady) {
+        return;
     }
+    messagesModel->clear();
+    cache.rewind();
+    fetchOlderHistory();
+}
+
+void MainWindow::openCache(const QString &username)
+{
+    QString safeName;
+    for (QChar c : username) {
+        safeName += (c.isLetterOrNumber() || c == '-' || c == '_') ? c : QChar('_');
+    }
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/cache";
+    std::string path = QFile::encodeName(QDir(dir).filePath(safeName + ".log")).toStdString();
+
+    waitForCacheLoader();
+    cache.close();
+    cacheReady = false;
+    uncachedMessages.clear();
+
+    // Opening may compact the file and scans back for the newest id, so
+    // it runs on its own thread and hands the cache over when done.
+    auto opened = std::make_shared<MessageCache>();
+    pendingCache = opened;
+    cacheLoader = QThread::create([this, dir, path, opened]() {
+        QDir().mkpath(dir);
+        opened->open(path);
+        QMetaObject::invokeMethod(this, [this, opened]() { handleCacheOpened(opened); }, Qt::QueuedConnection);
+    });
+    cacheLoader->start();
+}
+
+void MainWindow::handleCacheOpened(const std::shared_ptr<MessageCache> &opened)
+{
+    // A result from an earlier login is dropped.
+    if (!isLoggedIn || opened != pendingCache) {
+        return;
+    }
+    pendingCache.reset();
+    cache = std::move(*opened);
+    cacheReady = true;
+    for (const Message &msg : uncachedMessages) {
+        cache.append(msg);
+    }
+    cache.flush();
+    uncachedMessages.clear();
+
+    // Show the cached conversation, then ask the server only for what
+    // arrived after the newest cached message.
+    fetchOlderHistory();
+    if (cache.lastId() > 0) {
+        client.syncSince(cache.lastId());
+    }
+}
+
+void MainWindow::waitForCacheLoader()
+{
+    if (cacheLoader) {
+        cacheLoader->wait();
+        delete cacheLoader;
+        cacheLoader = nullptr;
+    }
+}
+
+void MainWindow::handleHistory(const std::vector<Message> &page, bool hasMore, bool fromCache)
+{
+    if (!fromCache) {
+        historyPending = false;
+    }
+
+    QScrollBar *bar = ui->MessageHistory->verticalScrollBar();
+    bool wasEmpty = messagesModel->rowCount() == 0;
+    int inserted = messagesModel->prependHistory(page, client.getCurrentUser(), hasMore, fromCache);
+
+    // Keep the rows the user was looking at in place.
+    if (wasEmpty) {
+        ui->MessageHistory->scrollToBottom();
+    } else if (inserted > 0) {
+        bar->setValue(bar->value() + inserted);
+    }
+}
+
+void MainWindow::handleLoginResult(bool success, const QString &username)
+{
+    if (!success) {
+        QMessageBox::warning(this, "Ошибка", "Неверные данные для входа!");
+        return;
+    }
+
+    isLoggedIn = true;
+    setWindowTitle("Chat Client - " + username);
+
+    messagesModel->clear();
+    historyPending = false;
+
+    // History and SYNC follow once the cache is open (handleCacheOpened).
+    openCache(username);
+    QMessageBox::information(this, "Успех", "Вход выполнен!");
+
+    ui->LoginText->clear();
+    ui->PasswordText->clear();
+    ui->NameText->clear();
+}
+
+void MainWindow::handleRegisterResult(bool success)
+{
+    if (!success) {
+        QMessageBox::warning(this, "Ошибка", "Пользователь с таким логином уже существует!");
+        return;
+    }
+
+    QMessageBox::information(this, "Успех", "Регистрация завершена!");
+    ui->LoginText->clear();
+    ui->PasswordText->clear();
+    ui->NameText->clear();
+}
+
+void MainWindow::handleBanned()
+{
+    QMessageBox::warning(this, "Ошибка", "Пользователь заблокирован!");
+}
+
+void MainWindow::handleDisconnected()
+{
+    statusBar()->showMessage("Соединение с сервером потеряно, переподключение...");
+}
+
+void MainWindow::handleConnectResult(bool success)
+{
+    if (success) {
+        statusBar()->showMessage("Подключено к серверу", 3000);
+    } else {
+        statusBar()->showMessage("Не удалось подключиться к серверу, повторная попытка...");
+    }
+}
+
+void MainWindow::handleReconnected()
+{
+    statusBar()->showMessage("Соединение восстановлено", 3000);
 }
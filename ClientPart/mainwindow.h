@@ -2,7 +2,16 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include "client.hpp"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "chatclient.hpp"
+#include "messagecache.hpp"
+
+class MessageListModel;
+class QTimer;
+class QThread;
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -18,17 +27,50 @@ public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
 private slots:
     void on_SendButton_clicked();
     void on_RegButton_clicked();
     void on_LogButton_clicked();
-    void checkForNewMessages();
 
 private:
+    void flushPendingMessages();
+    void fetchOlderHistory();
+    void reloadNewest();
+    void handleHistory(const std::vector<Message> &page, bool hasMore, bool fromCache = false);
+    void handleSent(const Message &msg);
+    void handleMessageRefused(const QString &status);
+    void cacheMessage(const Message &msg);
+    void openCache(const QString &username);
+    void handleCacheOpened(const std::shared_ptr<MessageCache> &opened);
+    void waitForCacheLoader();
+    void handleLoginResult(bool success, const QString &username);
+    void handleRegisterResult(bool success);
+    void handleBanned();
+    void handleConnectResult(bool success);
+    void handleDisconnected();
+    void handleReconnected();
+
     Ui::MainWindow *ui;
     ChatClient client;
+    MessageCache cache;
+    MessageListModel *messagesModel;
     bool isLoggedIn;
-    QTimer *messageTimer;
+    bool historyPending;
+    // Opens and scans the cache file off the GUI thread; until it is done
+    // incoming messages wait in uncachedMessages.
+    QThread *cacheLoader;
+    std::shared_ptr<MessageCache> pendingCache;
+    bool cacheReady;
+    std::vector<Message> uncachedMessages;
+
+    QTimer *frameTimer;
+    std::mutex pendingMutex;
+    std::vector<Message> pendingMessages;
+    std::vector<Message> drainBuffer;
+    std::atomic<bool> flushScheduled;
 };
 
 #endif
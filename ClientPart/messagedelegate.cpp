@@ -0,0 +1,89 @@
+#include "messagedelegate.h"
+#include "messagelistmodel.h"
+#include <QPainter>
+#include <QApplication>
+#include <QAbstractItemView>
+#include <algorithm>
+#include <climits>
+
+static const int kPadding = 4;
+static const int kTextFlags = Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap;
+
+// Height of the message text wrapped to `width`; one line for the common
+// case of text that fits, without laying it out.
+static int textHeight(const QFontMetrics &metrics, const QString &text, int width)
+{
+    if (width <= 0 || (!text.contains(QLatin1Char('\n')) && metrics.horizontalAdvance(text) <= width)) {
+        return metrics.height();
+    }
+    return std::max(metrics.height(), metrics.boundingRect(QRect(0, 0, width, INT_MAX), kTextFlags, text).height());
+}
+
+MessageDelegate::MessageDelegate(QObject *parent)
+    : QStyledItemDelegate(parent)
+{
+}
+
+void MessageDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+    opt.text.clear();
+
+    QStyle *style = opt.widget ? opt.widget->style() : QApplication::style();
+    style->drawPrimitive(QStyle::PE_PanelItemViewItem, &opt, painter, opt.widget);
+
+    QString header = index.data(MessageListModel::HeaderRole).toString();
+    const QString text = index.data(MessageListModel::TextRole).toString();
+    const QString priority = index.data(MessageListModel::PriorityRole).toString();
+    const QColor priorityColor = index.data(MessageListModel::PriorityColorRole).value<QColor>();
+
+    QFont boldFont = opt.font;
+    boldFont.setBold(true);
+    const QFontMetrics boldMetrics(boldFont);
+    const QFontMetrics metrics(opt.font);
+
+    QRect line = opt.rect.adjusted(kPadding, kPadding, -kPadding, 0);
+    line.setHeight(metrics.height());
+
+    painter->save();
+
+    painter->setFont(boldFont);
+    painter->setPen(opt.palette.color(QPalette::Text));
+    header = boldMetrics.elidedText(header, Qt::ElideRight, line.width());
+    painter->drawText(line, Qt::AlignLeft | Qt::AlignVCenter, header);
+
+    int x = line.left() + boldMetrics.horizontalAdvance(header) + kPadding;
+    QRect priorityRect(x, line.top(), std::max(0, line.right() - x), line.height());
+    painter->setPen(priorityColor);
+    painter->drawText(priorityRect, Qt::AlignLeft | Qt::AlignVCenter, priority);
+
+    QRect body(QPoint(line.left(), line.bottom() + 1), QPoint(line.right(), opt.rect.bottom() - kPadding));
+    painter->setFont(opt.font);
+    painter->setPen(opt.palette.color(QPalette::Text));
+    painter->drawText(body, kTextFlags, text);
+
+    painter->setPen(opt.palette.color(QPalette::Mid));
+    painter->drawLine(opt.rect.bottomLeft(), opt.rect.bottomRight());
+
+    painter->restore();
+}
+
+QSize MessageDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const QVariant cached = index.data(Qt::SizeHintRole);
+    if (cached.isValid()) {
+        return cached.toSize();
+    }
+
+    // The list lays rows out before they have a rect, so wrap to the viewport.
+    const QAbstractItemView *view = qobject_cast<const QAbstractItemView *>(option.widget);
+    int width = view ? view->viewport()->width() : option.rect.width();
+    return QSize(width, rowHeight(option.font, index.data(MessageListModel::TextRole).toString(), width));
+}
+
+int MessageDelegate::rowHeight(const QFont &font, const QString &text, int viewportWidth)
+{
+    const QFontMetrics metrics(font);
+    return metrics.height() + textHeight(metrics, text, viewportWidth - 2 * kPadding) + 2 * kPadding + 1;
+}
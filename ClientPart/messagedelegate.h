@@ -0,0 +1,23 @@
+#ifndef MESSAGEDELEGATE_H
+#define MESSAGEDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+// Paints one chat message as a header line over its text, wrapped to the
+// view's width. Row heights come from MessageListModel, which caches them
+// per viewport width, so relayouts do not measure text again.
+class MessageDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit MessageDelegate(QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    // Height of a row showing `text` in a viewport `viewportWidth` wide.
+    static int rowHeight(const QFont &font, const QString &text, int viewportWidth);
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "messagelistmodel.h"
+#include "messagedelegate.h"
+#include <algorithm>
+
+MessageListModel::Row MessageListModel::makeRow(const Message &msg, bool outgoing)
+{
+    Row row;
+    row.message = msg;
+    row.outgoing = outgoing;
+
+    if (msg.Tag == "High" || msg.Tag == "Maximum") {
+        row.priority = QStringLiteral("Priority: Maximum");
+        row.priorityColor = Qt::red;
+    } else if (msg.Tag == "Medium") {
+        row.priority = QStringLiteral("Priority: Medium");
+        row.priorityColor = QColor(255, 140, 0);
+    } else {
+        row.priority = QStringLiteral("Priority: Minimum");
+        row.priorityColor = Qt::darkGreen;
+    }
+
+    const QString receiver = (msg.Getter == "ALL") ? QStringLiteral("Everyone") : QString::fromStdString(msg.Getter);
+
+    // Built by appending into a pre-sized buffer rather than chained arg() calls.
+    QString &header = row.header;
+    if (outgoing) {
+        header.reserve(8 + receiver.size());
+        header += QStringLiteral("[You → ");
+        header += receiver;
+        header += QLatin1Char(']');
+    } else {
+        const QString sender = QString::fromStdString(msg.Sender);
+        header.reserve(16 + sender.size() + receiver.size());
+        header += QStringLiteral("From: ");
+        header += sender;
+        header += QStringLiteral(" | To: ");
+        header += receiver;
+        header += QStringLiteral(" |");
+    }
+
+    row.text = QString::fromStdString(msg.Text);
+    return row;
+}
+
+MessageListModel::MessageListModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , hasOlder(true)
+    , newestDropped(false)
+    , rowWidth(0)
+{
+}
+
+int MessageListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : (int)rows.size();
+}
+
+QVariant MessageListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= (int)rows.size()) {
+        return QVariant();
+    }
+
+    const Row &row = rows[index.row()];
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::ToolTipRole:
+    case TextRole:
+        return row.text;
+    case HeaderRole:
+        return row.header;
+    case PriorityRole:
+        return row.priority;
+    case PriorityColorRole:
+        return row.priorityColor;
+    case SenderRole:
+        return QString::fromStdString(row.message.Sender);
+    case GetterRole:
+        return QString::fromStdString(row.message.Getter);
+    case TagRole:
+        return QString::fromStdString(row.message.Tag);
+    case OutgoingRole:
+        return row.outgoing;
+    case Qt::SizeHintRole:
+        if (rowWidth <= 0) {
+            return QVariant();
+        }
+        if (row.height < 0) {
+            row.height = MessageDelegate::rowHeight(rowFont, row.text, rowWidth);
+        }
+        return QSize(rowWidth, row.height);
+    default:
+        return QVariant();
+    }
+}
+
+int MessageListModel::trimFront(int incoming)
+{
+    int excess = (int)rows.size() + incoming - kMaxRows;
+    if (excess <= 0) {
+        return 0;
+    }
+
+    excess = std::min(excess, (int)rows.size());
+    beginRemoveRows(QModelIndex(), 0, excess - 1);
+    rows.erase(rows.begin(), rows.begin() + excess);
+    endRemoveRows();
+    hasOlder = true;
+    return excess;
+}
+
+int MessageListModel::appendMessage(const Message &msg, bool outgoing)
+{
+    // Cached already; shown once the view reloads from the bottom.
+    if (newestDropped) {
+        return 0;
+    }
+    int trimmed = trimFront(1);
+
+    int row = (int)rows.size();
+    beginInsertRows(QModelIndex(), row, row);
+    rows.push_back(makeRow(msg, outgoing));
+    endInsertRows();
+    return trimmed;
+}
+
+int MessageListModel::appendMessages(const std::vector<Message> &batch)
+{
+    if (batch.empty() || newestDropped) {
+        return 0;
+    }
+
+    // A burst larger than the window only ever shows its tail.
+    size_t skip = batch.size() > (size_t)kMaxRows ? batch.size() - kMaxRows : 0;
+    int count = (int)(batch.size() - skip);
+
+    int trimmed = trimFront(count);
+
+    int first = (int)rows.size();
+    beginInsertRows(QModelIndex(), first, first + count - 1);
+    for (size_t i = skip; i < batch.size(); ++i) {
+        rows.push_back(makeRow(batch[i], false));
+    }
+    endInsertRows();
+
+    if (skip > 0) {
+        hasOlder = true;
+    }
+    return trimmed;
+}
+
+int MessageListModel::prependHistory(const std::vector<Message> &newestFirst, const std::string &currentUser,
+                                     bool hasMore, bool contiguous)
+{
+    hasOlder = hasMore;
+
+    long long oldest = oldestId();
+    std::vector<const Message *> older;
+    for (const Message &msg : newestFirst) {
+        if (contiguous || oldest == 0 || (msg.Id > 0 && msg.Id < oldest)) {
+            older.push_back(&msg);
+        }
+    }
+
+    if ((int)older.size() > kMaxRows) {
+        older.resize(kMaxRows);
+    }
+    if (older.empty()) {
+        return 0;
+    }
+
+    // The user is reading at the top, so the rows furthest away go.
+    int excess = (int)rows.size() + (int)older.size() - kMaxRows;
+    if (excess > 0) {
+        beginRemoveRows(QModelIndex(), (int)rows.size() - excess, (int)rows.size() - 1);
+        rows.erase(rows.end() - excess, rows.end());
+        endRemoveRows();
+        newestDropped = true;
+    }
+
+    int count = (int)older.size();
+    beginInsertRows(QModelIndex(), 0, count - 1);
+    for (const Message *msg : older) {
+        rows.push_front(makeRow(*msg, msg->Sender == currentUser));
+    }
+    endInsertRows();
+
+    return count;
+}
+
+bool MessageListModel::stampOutgoing(const Message &sent)
+{
+    Row *match = nullptr;
+    for (auto it = rows.rbegin(); it != rows.rend(); ++it) {
+        const Message &msg = it->message;
+        if (it->outgoing && !it->failed && msg.Id == 0 && msg.Getter == sent.Getter && msg.Text == sent.Text && msg.Tag == sent.Tag) {
+            match = &*it;
+        }
+    }
+    if (!match) {
+        return false;
+    }
+    // The id is not displayed, so no dataChanged().
+    match->message.Id = sent.Id;
+    return true;
+}
+
+bool MessageListModel::markOutgoingFailed()
+{
+    for (size_t i = 0; i < rows.size(); ++i) {
+        Row &row = rows[i];
+        if (row.outgoing && !row.failed && row.message.Id == 0) {
+            row.failed = true;
+            row.header += QStringLiteral(" (not delivered)");
+            const QModelIndex changed = index((int)i);
+            emit dataChanged(changed, changed, {HeaderRole});
+            return true;
+        }
+    }
+    return false;
+}
+
+void MessageListModel::clear()
+{
+    beginResetModel();
+    rows.clear();
+    hasOlder = true;
+    newestDropped = false;
+    endResetModel();
+}
+
+long long MessageListModel::oldestId() const
+{
+    for (const Row &row : rows) {
+        if (row.message.Id > 0) {
+            return row.message.Id;
+        }
+    }
+    return 0;
+}
+
+bool MessageListModel::canFetchOlder() const
+{
+    return hasOlder;
+}
+
+bool MessageListModel::missingNewest() const
+{
+    return newestDropped;
+}
+
+void MessageListModel::setRowLayout(const QFont &font, int viewportWidth)
+{
+    if (font == rowFont && viewportWidth == rowWidth) {
+        return;
+    }
+    rowFont = font;
+    rowWidth = viewportWidth;
+    for (const Row &row : rows) {
+        row.height = -1;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef MESSAGELISTMODEL_H
+#define MESSAGELISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QColor>
+#include <QFont>
+#include <deque>
+#include <vector>
+#include "message.hpp"
+
+// Chat history as a list model. Only a bounded window of kMaxRows rows is
+// kept in memory. Live messages push the oldest rows out; paging back
+// through a full window drops the newest rows instead, and live messages
+// are then left out until the view reloads from the bottom.
+// Display strings are formatted once when a row is inserted, not on paint,
+// and row heights once per viewport width (Qt::SizeHintRole).
+class MessageListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Roles {
+        SenderRole = Qt::UserRole + 1,
+        GetterRole,
+        TextRole,
+        TagRole,
+        OutgoingRole,
+        HeaderRole,
+        PriorityRole,
+        PriorityColorRole
+    };
+
+    static const int kMaxRows = 5000;
+
+    explicit MessageListModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // Both return how many of the oldest rows were dropped to make room.
+    int appendMessage(const Message &msg, bool outgoing);
+    // Inserts a whole batch with a single row-insertion notification.
+    int appendMessages(const std::vector<Message> &batch);
+    // Returns the number of rows inserted at the top. Server pages are
+    // filtered against the oldest id shown; cache pages are contiguous.
+    int prependHistory(const std::vector<Message> &newestFirst, const std::string &currentUser,
+                       bool hasMore, bool contiguous = false);
+    // Font and width rows are sized for; a change drops the cached heights.
+    void setRowLayout(const QFont &font, int viewportWidth);
+
+    // Gives the oldest matching outgoing row without an id the id the
+    // server stored it under.
+    bool stampOutgoing(const Message &sent);
+    // Marks the oldest outgoing row still without an id as not delivered.
+    bool markOutgoingFailed();
+    void clear();
+
+    long long oldestId() const;
+    bool canFetchOlder() const;
+    // True after paging back dropped the newest rows.
+    bool missingNewest() const;
+
+private:
+    struct Row {
+        Message message;
+        bool outgoing;
+        bool failed = false;
+        QString header;
+        QString text;
+        QString priority;
+        QColor priorityColor;
+        mutable int height = -1;
+    };
+
+    static Row makeRow(const Message &msg, bool outgoing);
+    int trimFront(int incoming);
+
+    std::deque<Row> rows;
+    bool hasOlder;
+    bool newestDropped;
+    QFont rowFont;
+    int rowWidth;
+};
+
+#endif
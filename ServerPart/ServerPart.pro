@@ -5,19 +5,34 @@ CONFIG += c++17
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 SOURCES += \
+    adminmodels.cpp \
+    adminworker.cpp \
     main.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    adminmodels.h \
+    adminworker.h \
+    channels.hpp \
+    flightrecorder.hpp \
     mainwindow.h \
-    server.hpp
+    messagetrace.hpp \
+    metrics.hpp \
+    metricsexporter.hpp \
+    mpscqueue.hpp \
+    outbound.hpp \
+    ratelimit.hpp \
+    server.hpp \
+    serverevents.hpp \
+    sqlprofiler.hpp \
+    trafficcapture.hpp
 
 FORMS += \
     mainwindow.ui
 
 win32 {
-    LIBS += -lws2_32
-    DEFINES += _WINSOCK_DEPRECATED_NO_WARNINGS WIN32_LEAN_AND_MEAN
+    LIBS += -lws2_32 -lpsapi
+    DEFINES += _WINSOCK_DEPRECATED_NO_WARNINGS WIN32_LEAN_AND_MEAN NOMINMAX
 }
 
 QMAKE_CXXFLAGS += -Wno-unknown-pragmas
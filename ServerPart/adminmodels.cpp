@@ -0,0 +1,422 @@
+#include "adminmodels.h"
+#include <QColor>
+#include <algorithm>
+
+AdminUsersModel::AdminUsersModel(AdminWorker *worker, QObject *parent)
+    : QAbstractTableModel(parent)
+    , worker(worker)
+    , sortColumn(AdminWorker::UsernameColumn)
+    , sortOrder(Qt::AscendingOrder)
+    , generation(0)
+    , pending(false)
+    , exhausted(false)
+{
+    connect(worker, &AdminWorker::usersPageLoaded, this, &AdminUsersModel::applyPage);
+}
+
+int AdminUsersModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int AdminUsersModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : 3;
+}
+
+QVariant AdminUsersModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size()) {
+        return QVariant();
+    }
+
+    const AdminUserRow &user = rows.at(index.row());
+    bool isOnline = online.contains(user.username);
+
+    if (role == Qt::DisplayRole) {
+        switch (index.column()) {
+        case AdminWorker::UsernameColumn: return user.username;
+        case AdminWorker::NameColumn: return user.name;
+        case AdminWorker::StatusColumn:
+            if (user.isBanned) return QStringLiteral("Banned");
+            return isOnline ? QStringLiteral("Online") : QStringLiteral("Active");
+        }
+    } else if (role == Qt::ForegroundRole) {
+        if (user.isBanned && index.column() != AdminWorker::NameColumn) {
+            return QColor(Qt::red);
+        }
+        if (index.column() == AdminWorker::StatusColumn) {
+            return QColor(isOnline ? Qt::blue : Qt::darkGreen);
+        }
+    }
+    return QVariant();
+}
+
+QVariant AdminUsersModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    static const char *labels[] = {"Username", "Name", "Status"};
+    return section >= 0 && section < 3 ? QString(labels[section]) : QVariant();
+}
+
+bool AdminUsersModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !exhausted && !pending;
+}
+
+void AdminUsersModel::fetchMore(const QModelIndex &parent)
+{
+    if (canFetchMore(parent)) {
+        requestPage();
+    }
+}
+
+void AdminUsersModel::sort(int column, Qt::SortOrder order)
+{
+    if (column < 0 || column > AdminWorker::StatusColumn) {
+        return;
+    }
+    if (column == sortColumn && order == sortOrder) {
+        return;
+    }
+    sortColumn = column;
+    sortOrder = order;
+    reload();
+}
+
+void AdminUsersModel::setPrefixFilter(const QString &value)
+{
+    if (value == prefix) {
+        return;
+    }
+    prefix = value;
+    reload();
+}
+
+// Drops every loaded row; the view fetches the first page again. Pages
+// still in flight are recognised by their old generation and ignored.
+void AdminUsersModel::reload()
+{
+    beginResetModel();
+    rows.clear();
+    ++generation;
+    pending = false;
+    exhausted = false;
+    endResetModel();
+}
+
+void AdminUsersModel::requestPage()
+{
+    AdminUsersPageRequest request;
+    request.prefix = prefix;
+    request.sortColumn = sortColumn;
+    request.order = sortOrder;
+    request.limit = kPageSize;
+    if (!rows.isEmpty()) {
+        const AdminUserRow &last = rows.last();
+        request.hasAfter = true;
+        request.afterUsername = last.username;
+        if (sortColumn == AdminWorker::NameColumn) request.afterKey = last.name;
+        if (sortColumn == AdminWorker::StatusColumn) request.afterKey = last.isBanned ? 1 : 0;
+    }
+
+    pending = true;
+    quint64 requestGeneration = generation;
+    AdminWorker *target = worker;
+    QMetaObject::invokeMethod(worker, [target, requestGeneration, request]() {
+        target->loadUsersPage(requestGeneration, request);
+    }, Qt::QueuedConnection);
+}
+
+void AdminUsersModel::applyPage(quint64 pageGeneration, const QVector<AdminUserRow> &page)
+{
+    if (pageGeneration != generation) {
+        return;
+    }
+    pending = false;
+    exhausted = page.size() < kPageSize;
+
+    if (!page.isEmpty()) {
+        beginInsertRows(QModelIndex(), rows.size(), rows.size() + page.size() - 1);
+        rows += page;
+        endInsertRows();
+    }
+}
+
+// Mirrors the ORDER BY used for the current sort.
+bool AdminUsersModel::lessThan(const AdminUserRow &a, const AdminUserRow &b) const
+{
+    int order = 0;
+    if (sortColumn == AdminWorker::NameColumn) {
+        order = QString::compare(a.name, b.name);
+    } else if (sortColumn == AdminWorker::StatusColumn) {
+        order = int(a.isBanned) - int(b.isBanned);
+    }
+    if (order == 0) {
+        order = QString::compare(a.username, b.username);
+    }
+    return sortOrder == Qt::AscendingOrder ? order < 0 : order > 0;
+}
+
+int AdminUsersModel::findRow(const QString &username) const
+{
+    if (sortColumn == AdminWorker::UsernameColumn) {
+        AdminUserRow key{username, QString(), false};
+        auto it = std::lower_bound(rows.cbegin(), rows.cend(), key,
+                                   [this](const AdminUserRow &a, const AdminUserRow &b) { return lessThan(a, b); });
+        if (it != rows.cend() && it->username == username) {
+            return int(it - rows.cbegin());
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < rows.size(); ++i) {
+        if (rows.at(i).username == username) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// A new account is shown only if it falls inside the loaded range;
+// otherwise a later page will bring it in.
+void AdminUsersModel::userRegistered(const QString &username, const QString &name)
+{
+    if (!username.startsWith(prefix) || findRow(username) >= 0) {
+        return;
+    }
+
+    AdminUserRow user{username, name, false};
+    auto it = std::lower_bound(rows.cbegin(), rows.cend(), user,
+                               [this](const AdminUserRow &a, const AdminUserRow &b) { return lessThan(a, b); });
+    int row = int(it - rows.cbegin());
+    if (row == rows.size() && !exhausted) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), row, row);
+    rows.insert(row, user);
+    endInsertRows();
+}
+
+void AdminUsersModel::userBanChanged(const QString &username, bool banned)
+{
+    int row = findRow(username);
+    if (row < 0 || rows.at(row).isBanned == banned) {
+        return;
+    }
+
+    // Under the status sort the row changes place; reloading keeps the
+    // keyset paging consistent.
+    if (sortColumn == AdminWorker::StatusColumn) {
+        reload();
+        return;
+    }
+
+    rows[row].isBanned = banned;
+    emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+}
+
+void AdminUsersModel::setOnline(const QString &username, bool isOnline)
+{
+    bool changed = isOnline ? !online.contains(username) : online.contains(username);
+    if (!changed) {
+        return;
+    }
+    if (isOnline) {
+        online.insert(username);
+    } else {
+        online.remove(username);
+    }
+
+    int row = findRow(username);
+    if (row >= 0) {
+        emit dataChanged(index(row, AdminWorker::StatusColumn), index(row, AdminWorker::StatusColumn));
+    }
+}
+
+void AdminUsersModel::clearOnline()
+{
+    online.clear();
+    if (!rows.isEmpty()) {
+        emit dataChanged(index(0, AdminWorker::StatusColumn), index(rows.size() - 1, AdminWorker::StatusColumn));
+    }
+}
+
+AdminMessagesModel::AdminMessagesModel(AdminWorker *worker, QObject *parent)
+    : QAbstractTableModel(parent)
+    , worker(worker)
+    , sortOrder(Qt::DescendingOrder)
+    , generation(0)
+    , pending(false)
+    , exhausted(false)
+{
+    connect(worker, &AdminWorker::messagesPageLoaded, this, &AdminMessagesModel::applyPage);
+}
+
+int AdminMessagesModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int AdminMessagesModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : 4;
+}
+
+QVariant AdminMessagesModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size()) {
+        return QVariant();
+    }
+
+    const AdminMessageRow &msg = rows.at(index.row());
+    if (role == Qt::DisplayRole) {
+        switch (index.column()) {
+        case 0: return msg.sender;
+        case 1: return msg.getter;
+        case 2: return msg.text.length() > 20 ? msg.text.left(20) + "..." : msg.text;
+        case 3: return msg.timestamp.toLocalTime().toString("hh:mm");
+        }
+    } else if (role == Qt::ToolTipRole && index.column() == 2) {
+        return msg.text;
+    }
+    return QVariant();
+}
+
+QVariant AdminMessagesModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    static const char *labels[] = {"Sender", "To", "Message", "Time"};
+    return section >= 0 && section < 4 ? QString(labels[section]) : QVariant();
+}
+
+bool AdminMessagesModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !exhausted && !pending;
+}
+
+void AdminMessagesModel::fetchMore(const QModelIndex &parent)
+{
+    if (canFetchMore(parent)) {
+        requestPage();
+    }
+}
+
+// Only the id order is indexed, so every column sorts by time.
+void AdminMessagesModel::sort(int, Qt::SortOrder order)
+{
+    if (order == sortOrder) {
+        return;
+    }
+    sortOrder = order;
+    reload();
+}
+
+void AdminMessagesModel::setParticipantFilter(const QString &value)
+{
+    if (value == participant) {
+        return;
+    }
+    participant = value;
+    reload();
+}
+
+void AdminMessagesModel::reload()
+{
+    beginResetModel();
+    rows.clear();
+    heldLive.clear();
+    ++generation;
+    pending = false;
+    exhausted = false;
+    endResetModel();
+}
+
+void AdminMessagesModel::requestPage()
+{
+    AdminMessagesPageRequest request;
+    request.participant = participant;
+    request.order = sortOrder;
+    request.afterId = rows.isEmpty() ? 0 : rows.last().id;
+    request.limit = kPageSize;
+
+    pending = true;
+    quint64 requestGeneration = generation;
+    AdminWorker *target = worker;
+    QMetaObject::invokeMethod(worker, [target, requestGeneration, request]() {
+        target->loadMessagesPage(requestGeneration, request);
+    }, Qt::QueuedConnection);
+}
+
+void AdminMessagesModel::applyPage(quint64 pageGeneration, const QVector<AdminMessageRow> &page)
+{
+    if (pageGeneration != generation) {
+        return;
+    }
+    pending = false;
+    exhausted = page.size() < kPageSize;
+
+    if (!page.isEmpty()) {
+        beginInsertRows(QModelIndex(), rows.size(), rows.size() + page.size() - 1);
+        rows += page;
+        endInsertRows();
+    }
+
+    // Messages routed while the first page was loading may or may not be
+    // in it; replay them now that the boundary is known.
+    QVector<AdminMessageRow> held;
+    held.swap(heldLive);
+    for (const AdminMessageRow &msg : held) {
+        messageRouted(msg);
+    }
+}
+
+void AdminMessagesModel::messageRouted(const AdminMessageRow &msg)
+{
+    if (!participant.isEmpty() && msg.sender != participant && msg.getter != participant) {
+        return;
+    }
+
+    if (rows.isEmpty() && !exhausted) {
+        heldLive.append(msg);
+        return;
+    }
+
+    if (sortOrder == Qt::AscendingOrder) {
+        if (exhausted && (rows.isEmpty() || msg.id > rows.last().id)) {
+            beginInsertRows(QModelIndex(), rows.size(), rows.size());
+            rows.append(msg);
+            endInsertRows();
+        }
+        return;
+    }
+
+    // Handler threads can publish slightly out of id order.
+    auto it = std::lower_bound(rows.cbegin(), rows.cend(), msg.id,
+                               [](const AdminMessageRow &row, qint64 id) { return row.id > id; });
+    int row = int(it - rows.cbegin());
+    if (it != rows.cend() && it->id == msg.id) {
+        return;
+    }
+    if (row == rows.size() && !exhausted) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), row, row);
+    rows.insert(row, msg);
+    endInsertRows();
+
+    // Live traffic must not grow the model forever; the tail can be
+    // paged in again from the last kept id.
+    if (rows.size() > kMaxRows) {
+        beginRemoveRows(QModelIndex(), kMaxRows, rows.size() - 1);
+        rows.resize(kMaxRows);
+        endRemoveRows();
+        exhausted = false;
+    }
+}
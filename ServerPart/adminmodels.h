@@ -0,0 +1,99 @@
+#ifndef ADMINMODELS_H
+#define ADMINMODELS_H
+
+#include <QAbstractTableModel>
+#include <QSet>
+#include <QVector>
+#include "adminworker.h"
+
+// Registered users, fetched a page at a time as the view scrolls
+// (canFetchMore/fetchMore). Filtering by username prefix and sorting run
+// in SQL on the worker; live events patch the rows already loaded.
+class AdminUsersModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    static const int kPageSize = 200;
+
+    explicit AdminUsersModel(AdminWorker *worker, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    void setPrefixFilter(const QString &prefix);
+    void reload();
+
+    void userRegistered(const QString &username, const QString &name);
+    void userBanChanged(const QString &username, bool banned);
+    void setOnline(const QString &username, bool online);
+    void clearOnline();
+
+public slots:
+    void applyPage(quint64 generation, const QVector<AdminUserRow> &page);
+
+private:
+    bool lessThan(const AdminUserRow &a, const AdminUserRow &b) const;
+    int findRow(const QString &username) const;
+    void requestPage();
+
+    AdminWorker *worker;
+    QVector<AdminUserRow> rows;
+    QSet<QString> online;
+    QString prefix;
+    int sortColumn;
+    Qt::SortOrder sortOrder;
+    quint64 generation;
+    bool pending;
+    bool exhausted;
+};
+
+// Message log, newest first by default, paged by id. The filter matches
+// a participant (sender or recipient) exactly so it stays indexed.
+class AdminMessagesModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    static const int kPageSize = 200;
+    static const int kMaxRows = 100000;
+
+    explicit AdminMessagesModel(AdminWorker *worker, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    void setParticipantFilter(const QString &participant);
+    void reload();
+
+    void messageRouted(const AdminMessageRow &message);
+
+public slots:
+    void applyPage(quint64 generation, const QVector<AdminMessageRow> &page);
+
+private:
+    void requestPage();
+
+    AdminWorker *worker;
+    QVector<AdminMessageRow> rows;
+    QVector<AdminMessageRow> heldLive;
+    QString participant;
+    Qt::SortOrder sortOrder;
+    quint64 generation;
+    bool pending;
+    bool exhausted;
+};
+
+#endif
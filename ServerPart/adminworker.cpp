@@ -0,0 +1,197 @@
+#include "adminworker.h"
+#include "sqlprofiler.hpp"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QTimeZone>
+#include <QStringList>
+
+AdminWorker::AdminWorker(const QString &databasePath, SqlProfiler *profiler, QObject *parent)
+    : QObject(parent)
+    , databasePath(databasePath)
+    , profiler(profiler)
+    , readerName(QString("admin_reader_%1").arg(quintptr(this)))
+    , writerName(QString("admin_writer_%1").arg(quintptr(this)))
+{
+    qRegisterMetaType<AdminUserRow>();
+    qRegisterMetaType<AdminMessageRow>();
+    qRegisterMetaType<QVector<AdminUserRow>>();
+    qRegisterMetaType<QVector<AdminMessageRow>>();
+    qRegisterMetaType<AdminWorker::BanResult>();
+}
+
+AdminWorker::~AdminWorker()
+{
+    // Connections are created lazily on the worker thread, so they are
+    // removed from there too (the worker is deleted on QThread::finished).
+    for (const QString &name : {readerName, writerName}) {
+        if (QSqlDatabase::contains(name)) {
+            QSqlDatabase::database(name, false).close();
+            QSqlDatabase::removeDatabase(name);
+        }
+    }
+}
+
+QSqlDatabase AdminWorker::openConnection(const QString &name, bool readOnly)
+{
+    if (QSqlDatabase::contains(name)) {
+        QSqlDatabase db = QSqlDatabase::database(name);
+        if (db.isOpen()) {
+            return db;
+        }
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+    db.setDatabaseName(databasePath);
+    db.setConnectOptions(readOnly ? "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=1000"
+                                  : "QSQLITE_BUSY_TIMEOUT=5000");
+    db.open();
+    return db;
+}
+
+// Every ORDER BY below is served by an index (username, name + username,
+// is_banned + username, or the rowid), so paging stays cheap at any depth.
+void AdminWorker::loadUsersPage(quint64 generation, const AdminUsersPageRequest &request)
+{
+    QVector<AdminUserRow> users;
+
+    QSqlDatabase db = openConnection(readerName, true);
+    if (!db.isOpen()) {
+        emit usersPageLoaded(generation, users);
+        return;
+    }
+
+    QString key;
+    switch (request.sortColumn) {
+    case NameColumn: key = "name"; break;
+    case StatusColumn: key = "is_banned"; break;
+    default: break;
+    }
+    bool ascending = request.order == Qt::AscendingOrder;
+    QString direction = ascending ? "ASC" : "DESC";
+
+    QStringList where;
+    QVariantList binds;
+    if (!request.prefix.isEmpty()) {
+        // A range instead of LIKE keeps the username index usable;
+        // U+10FFFF sorts after any character that can follow the prefix.
+        where << "username >= ? AND username < ?";
+        binds << request.prefix << request.prefix + QString::fromUcs4(U"\U0010FFFF");
+    }
+    if (request.hasAfter) {
+        if (key.isEmpty()) {
+            where << QString("username %1 ?").arg(ascending ? ">" : "<");
+            binds << request.afterUsername;
+        } else {
+            where << QString("(%1, username) %2 (?, ?)").arg(key, ascending ? ">" : "<");
+            binds << request.afterKey << request.afterUsername;
+        }
+    }
+
+    QString sql = "SELECT username, name, is_banned FROM users";
+    if (!where.isEmpty()) {
+        sql += " WHERE " + where.join(" AND ");
+    }
+    sql += key.isEmpty() ? QString(" ORDER BY username %1").arg(direction)
+                         : QString(" ORDER BY %1 %2, username %2").arg(key, direction);
+    sql += " LIMIT ?";
+    binds << request.limit;
+
+    TimedQuery query(profiler, "admin_users_page", db);
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    for (const QVariant &value : binds) {
+        query.addBindValue(value);
+    }
+
+    if (query.exec()) {
+        users.reserve(request.limit);
+        while (query.next()) {
+            users.append({query.value(0).toString(),
+                          query.value(1).toString(),
+                          query.value(2).toBool()});
+        }
+    }
+
+    emit usersPageLoaded(generation, users);
+}
+
+void AdminWorker::loadMessagesPage(quint64 generation, const AdminMessagesPageRequest &request)
+{
+    QVector<AdminMessageRow> messages;
+
+    QSqlDatabase db = openConnection(readerName, true);
+    if (!db.isOpen()) {
+        emit messagesPageLoaded(generation, messages);
+        return;
+    }
+
+    bool ascending = request.order == Qt::AscendingOrder;
+
+    QStringList where;
+    QVariantList binds;
+    if (!request.participant.isEmpty()) {
+        // Served by idx_messages_sender and idx_messages_getter together.
+        where << "(sender = ? OR getter = ?)";
+        binds << request.participant << request.participant;
+    }
+    if (request.afterId > 0) {
+        where << QString("id %1 ?").arg(ascending ? ">" : "<");
+        binds << request.afterId;
+    }
+
+    QString sql = "SELECT id, sender, getter, text, timestamp FROM messages";
+    if (!where.isEmpty()) {
+        sql += " WHERE " + where.join(" AND ");
+    }
+    sql += ascending ? " ORDER BY id ASC LIMIT ?" : " ORDER BY id DESC LIMIT ?";
+    binds << request.limit;
+
+    TimedQuery query(profiler, "admin_messages_page", db);
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    for (const QVariant &value : binds) {
+        query.addBindValue(value);
+    }
+
+    if (query.exec()) {
+        messages.reserve(request.limit);
+        while (query.next()) {
+            // SQLite's CURRENT_TIMESTAMP is UTC.
+            QDateTime timestamp = query.value(4).toDateTime();
+            timestamp.setTimeZone(QTimeZone::UTC);
+            messages.append({query.value(0).toLongLong(),
+                             query.value(1).toString(),
+                             query.value(2).toString(),
+                             query.value(3).toString(),
+                             timestamp});
+        }
+    }
+
+    emit messagesPageLoaded(generation, messages);
+}
+
+void AdminWorker::setBanned(const QString &username, bool banned)
+{
+    QSqlDatabase reader = openConnection(readerName, true);
+    QSqlDatabase writer = openConnection(writerName, false);
+    if (!reader.isOpen() || !writer.isOpen()) {
+        emit banFinished(username, banned, DatabaseError);
+        return;
+    }
+
+    TimedQuery checkQuery(profiler, "admin_user_exists", reader);
+    checkQuery.prepare("SELECT username FROM users WHERE username = ?");
+    checkQuery.addBindValue(username);
+
+    if (!checkQuery.exec() || !checkQuery.next()) {
+        emit banFinished(username, banned, UserNotFound);
+        return;
+    }
+
+    TimedQuery query(profiler, "admin_set_banned", writer);
+    query.prepare("UPDATE users SET is_banned = ? WHERE username = ?");
+    query.addBindValue(banned ? 1 : 0);
+    query.addBindValue(username);
+
+    emit banFinished(username, banned, query.exec() ? BanApplied : DatabaseError);
+}
@@ -0,0 +1,95 @@
+#ifndef ADMINWORKER_H
+#define ADMINWORKER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QDateTime>
+#include <QMetaType>
+#include <QSqlDatabase>
+#include <QVariant>
+
+struct AdminUserRow {
+    QString username;
+    QString name;
+    bool isBanned;
+};
+
+struct AdminMessageRow {
+    qint64 id;
+    QString sender;
+    QString getter;
+    QString text;
+    QDateTime timestamp;
+};
+
+// One keyset page: rows strictly after (afterKey, afterUsername) in the
+// requested order, so no page costs more than its own rows.
+struct AdminUsersPageRequest {
+    QString prefix;
+    int sortColumn = 0;
+    Qt::SortOrder order = Qt::AscendingOrder;
+    bool hasAfter = false;
+    QVariant afterKey;
+    QString afterUsername;
+    int limit = 200;
+};
+
+struct AdminMessagesPageRequest {
+    QString participant;
+    Qt::SortOrder order = Qt::DescendingOrder;
+    qint64 afterId = 0;
+    int limit = 200;
+};
+
+class SqlProfiler;
+
+Q_DECLARE_METATYPE(AdminUserRow)
+Q_DECLARE_METATYPE(AdminMessageRow)
+
+// Runs every admin panel query on its own thread. Reads use a read-only
+// SQLite connection that is never shared with ChatServer; ban/unban go
+// through a separate writable connection owned by the same thread.
+// Results come back as signals, queued to the GUI thread. Queries are
+// timed into `profiler` when one is given.
+class AdminWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum BanResult {
+        BanApplied,
+        UserNotFound,
+        DatabaseError
+    };
+    Q_ENUM(BanResult)
+
+    explicit AdminWorker(const QString &databasePath, SqlProfiler *profiler = nullptr, QObject *parent = nullptr);
+    ~AdminWorker();
+
+    enum UserColumn {
+        UsernameColumn,
+        NameColumn,
+        StatusColumn
+    };
+
+public slots:
+    void loadUsersPage(quint64 generation, const AdminUsersPageRequest &request);
+    void loadMessagesPage(quint64 generation, const AdminMessagesPageRequest &request);
+    void setBanned(const QString &username, bool banned);
+
+signals:
+    void usersPageLoaded(quint64 generation, const QVector<AdminUserRow> &rows);
+    void messagesPageLoaded(quint64 generation, const QVector<AdminMessageRow> &rows);
+    void banFinished(const QString &username, bool banned, AdminWorker::BanResult result);
+
+private:
+    QSqlDatabase openConnection(const QString &name, bool readOnly);
+
+    QString databasePath;
+    SqlProfiler *profiler;
+    QString readerName;
+    QString writerName;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CHANNELS_HPP
+#define CHANNELS_HPP
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// "#" followed by 1-31 letters, digits, '_' or '-'; nothing that could
+// clash with the ';', ':' and ',' separators of the protocol.
+inline bool isChannelName(const std::string& name) {
+    if (name.size() < 2 || name.size() > 32 || name[0] != '#') {
+        return false;
+    }
+    for (size_t i = 1; i < name.size(); ++i) {
+        char c = name[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// In-memory membership index: channel -> members and user -> channels.
+// Member lists are immutable sorted vectors replaced on join/leave, so
+// routing takes a reference under the lock in O(1) and walks it unlocked;
+// a message costs the size of its channel, not of the whole server.
+class ChannelDirectory {
+public:
+    using Members = std::vector<std::string>;
+
+    // False when the user was already a member.
+    bool join(const std::string& channel, const std::string& username) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& members = byChannel[channel];
+        Members updated = members ? *members : Members();
+        auto pos = std::lower_bound(updated.begin(), updated.end(), username);
+        if (pos != updated.end() && *pos == username) {
+            return false;
+        }
+        updated.insert(pos, username);
+        members = std::make_shared<const Members>(std::move(updated));
+
+        auto& channels = byUser[username];
+        channels.insert(std::lower_bound(channels.begin(), channels.end(), channel), channel);
+        ++memberships;
+        return true;
+    }
+
+    // Publishes a channel's whole member list at once, for loading at
+    // startup; replaces whatever the channel had.
+    void load(const std::string& channel, Members members) {
+        if (!std::is_sorted(members.begin(), members.end())) {
+            std::sort(members.begin(), members.end());
+        }
+        members.erase(std::unique(members.begin(), members.end()), members.end());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& current = byChannel[channel];
+        if (current) {
+            for (const auto& member : *current) {
+                forgetChannelLocked(member, channel);
+            }
+        }
+        for (const auto& member : members) {
+            auto& joined = byUser[member];
+            joined.insert(std::lower_bound(joined.begin(), joined.end(), channel), channel);
+        }
+        memberships += members.size();
+        if (members.empty()) {
+            byChannel.erase(channel);
+        } else {
+            current = std::make_shared<const Members>(std::move(members));
+        }
+    }
+
+    // False when the user was not a member. Empty channels are forgotten.
+    bool leave(const std::string& channel, const std::string& username) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byChannel.find(channel);
+        if (it == byChannel.end() || !std::binary_search(it->second->begin(), it->second->end(), username)) {
+            return false;
+        }
+        Members updated;
+        updated.reserve(it->second->size() - 1);
+        for (const auto& member : *it->second) {
+            if (member != username) {
+                updated.push_back(member);
+            }
+        }
+        if (updated.empty()) {
+            byChannel.erase(it);
+        } else {
+            it->second = std::make_shared<const Members>(std::move(updated));
+        }
+
+        forgetChannelLocked(username, channel);
+        return true;
+    }
+
+    bool isMember(const std::string& channel, const std::string& username) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byChannel.find(channel);
+        return it != byChannel.end() && std::binary_search(it->second->begin(), it->second->end(), username);
+    }
+
+    // Null for a channel nobody has joined.
+    std::shared_ptr<const Members> members(const std::string& channel) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byChannel.find(channel);
+        return it == byChannel.end() ? nullptr : it->second;
+    }
+
+    std::vector<std::string> channelsOf(const std::string& username) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byUser.find(username);
+        return it == byUser.end() ? std::vector<std::string>() : it->second;
+    }
+
+    size_t channelCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return byChannel.size();
+    }
+
+    size_t membershipCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return memberships;
+    }
+
+private:
+    void forgetChannelLocked(const std::string& username, const std::string& channel) {
+        auto user = byUser.find(username);
+        user->second.erase(std::lower_bound(user->second.begin(), user->second.end(), channel));
+        if (user->second.empty()) {
+            byUser.erase(user);
+        }
+        --memberships;
+    }
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const Members>> byChannel;
+    std::unordered_map<std::string, std::vector<std::string>> byUser;
+    size_t memberships = 0;
+};
+
+#endif
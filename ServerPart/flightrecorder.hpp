@@ -0,0 +1,362 @@
+#ifndef FLIGHTRECORDER_HPP
+#define FLIGHTRECORDER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// One fixed-size event. `thread` is a serial number given to each thread
+// on its first event; `size` and `aux` depend on the type (bytes for I/O,
+// a command kind, a message id...).
+struct FlightRecord {
+    uint64_t timestampNs;
+    uint32_t connectionId;
+    uint16_t type;
+    uint16_t thread;
+    uint32_t size;
+    uint32_t aux;
+};
+
+static_assert(sizeof(FlightRecord) == 24, "FlightRecord layout is part of the dump format");
+
+enum FlightEvent : uint16_t {
+    FlightConnectionOpened = 1,
+    FlightBytesReceived,
+    FlightCommand,
+    FlightFrameSent,
+    FlightSendFailed,
+    FlightLoggedIn,
+    FlightLoginRejected,
+    FlightLoggedOut,
+    FlightMessageLogged,
+    FlightConnectionClosed,
+    FlightHandlerException,
+    FlightDumpRequested,
+    FlightRateLimited
+};
+
+// `aux` of FlightCommand.
+enum FlightCommandKind : uint32_t {
+    FlightCmdUnknown,
+    FlightCmdLogin,
+    FlightCmdResume,
+    FlightCmdSync,
+    FlightCmdHistory,
+    FlightCmdRegister,
+    FlightCmdMessage,
+    FlightCmdGetUsers,
+    FlightCmdBan,
+    FlightCmdUnban,
+    FlightCmdJoin,
+    FlightCmdLeave,
+    FlightCmdChannelHistory,
+    FlightCmdRead
+};
+
+inline const char* flightEventName(uint16_t type) {
+    switch (type) {
+    case FlightConnectionOpened: return "ConnectionOpened";
+    case FlightBytesReceived: return "BytesReceived";
+    case FlightCommand: return "Command";
+    case FlightFrameSent: return "FrameSent";
+    case FlightSendFailed: return "SendFailed";
+    case FlightLoggedIn: return "LoggedIn";
+    case FlightLoginRejected: return "LoginRejected";
+    case FlightLoggedOut: return "LoggedOut";
+    case FlightMessageLogged: return "MessageLogged";
+    case FlightConnectionClosed: return "ConnectionClosed";
+    case FlightHandlerException: return "HandlerException";
+    case FlightDumpRequested: return "DumpRequested";
+    case FlightRateLimited: return "RateLimited";
+    default: return "Unknown";
+    }
+}
+
+inline const char* flightCommandName(uint32_t kind) {
+    static const char* const names[] = {
+        "?", "LOGIN", "RESUME", "SYNC", "HISTORY", "REGISTER", "MESSAGE", "GET_USERS", "BAN", "UNBAN",
+        "JOIN", "LEAVE", "CHANNEL_HISTORY", "READ"
+    };
+    return kind < sizeof(names) / sizeof(names[0]) ? names[kind] : "?";
+}
+
+// Dump file: FlightDumpHeader, then for each ring a FlightDumpRing
+// followed by its records, oldest first. Timestamps are steady-clock
+// nanoseconds; the header pairs one with wall time for the decoder.
+struct FlightDumpHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t steadyNs;
+    uint64_t wallNs;
+    uint32_t ringCount;
+    uint32_t reserved;
+};
+
+struct FlightDumpRing {
+    uint32_t ring;
+    uint32_t recordCount;
+};
+
+static const char kFlightMagic[8] = {'C', 'H', 'A', 'T', 'F', 'L', 'T', '1'};
+
+inline uint64_t flightSteadyNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lock-free black box: every thread appends to its own ring of the last
+// kRingRecords events with a plain store, no atomics beyond publishing
+// the position. Rings are linked into a list that is only ever prepended
+// to, so a crash handler can walk it without locks. A thread's ring is
+// handed to the next new thread when it exits, which keeps memory bounded
+// by the number of threads alive at once.
+class FlightRecorder {
+public:
+    static const uint32_t kRingRecords = 1024;
+
+    static FlightRecorder& instance() {
+        static FlightRecorder recorder;
+        return recorder;
+    }
+
+    void record(uint16_t type, uint32_t connectionId, uint32_t size = 0, uint32_t aux = 0) {
+        ThreadSlot& thread = threadSlot();
+        Ring* ring = thread.ring;
+        uint64_t pos = ring->position.load(std::memory_order_relaxed);
+        FlightRecord& slot = ring->records[pos & (kRingRecords - 1)];
+        slot.timestampNs = flightSteadyNs();
+        slot.connectionId = connectionId;
+        slot.type = type;
+        slot.thread = thread.serial;
+        slot.size = size;
+        slot.aux = aux;
+        ring->position.store(pos + 1, std::memory_order_release);
+    }
+
+    uint32_t nextConnectionId() {
+        return connectionIds.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    // Writes every ring to `path`. Uses only raw OS writes and no heap so
+    // it can run from a crash or signal handler; a ring that is being
+    // written to concurrently may contribute one torn record.
+    bool dump(const char* path) {
+        FlightDumpHeader header;
+        std::memcpy(header.magic, kFlightMagic, sizeof(header.magic));
+        header.version = 1;
+        header.recordSize = sizeof(FlightRecord);
+        header.steadyNs = flightSteadyNs();
+        header.wallNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        header.ringCount = 0;
+        header.reserved = 0;
+        for (Ring* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+            ++header.ringCount;
+        }
+
+        File file = openFile(path);
+        if (!validFile(file)) {
+            return false;
+        }
+
+        bool ok = writeFile(file, &header, sizeof(header));
+        uint32_t written = 0;
+        for (Ring* ring = rings.load(std::memory_order_acquire); ring && written < header.ringCount;
+             ring = ring->next, ++written) {
+            uint64_t end = ring->position.load(std::memory_order_acquire);
+            uint64_t begin = end > kRingRecords ? end - kRingRecords : 0;
+
+            FlightDumpRing info;
+            info.ring = ring->index;
+            info.recordCount = (uint32_t)(end - begin);
+            ok = ok && writeFile(file, &info, sizeof(info));
+
+            // Oldest first: the tail of the array, then its head.
+            uint32_t first = (uint32_t)(begin & (kRingRecords - 1));
+            uint32_t count = info.recordCount;
+            uint32_t tail = count < kRingRecords - first ? count : kRingRecords - first;
+            ok = ok && writeFile(file, &ring->records[first], tail * sizeof(FlightRecord));
+            ok = ok && writeFile(file, &ring->records[0], (count - tail) * sizeof(FlightRecord));
+        }
+
+        closeFile(file);
+        return ok;
+    }
+
+    // Dumps to `path` on a crash, and on demand on SIGBREAK (Ctrl+Break)
+    // or SIGUSR1. `path` must stay valid for the life of the process.
+    void installHandlers(const char* path) {
+        dumpPath = path;
+        std::signal(SIGABRT, &FlightRecorder::onFatalSignal);
+        std::signal(SIGSEGV, &FlightRecorder::onFatalSignal);
+        std::signal(SIGFPE, &FlightRecorder::onFatalSignal);
+        std::signal(SIGILL, &FlightRecorder::onFatalSignal);
+#ifdef _WIN32
+        std::signal(SIGBREAK, &FlightRecorder::onDumpSignal);
+        SetUnhandledExceptionFilter(&FlightRecorder::onUnhandledException);
+#else
+        std::signal(SIGUSR1, &FlightRecorder::onDumpSignal);
+#endif
+    }
+
+    const char* installedPath() const {
+        return dumpPath;
+    }
+
+private:
+    struct Ring {
+        FlightRecord records[kRingRecords];
+        std::atomic<uint64_t> position{0};
+        std::atomic<bool> inUse{true};
+        uint32_t index = 0;
+        Ring* next = nullptr;
+    };
+
+    // Returns the ring to the pool when its thread exits.
+    struct ThreadSlot {
+        Ring* ring = nullptr;
+        uint16_t serial = 0;
+        ~ThreadSlot() {
+            if (ring) {
+                ring->inUse.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<Ring*> rings{nullptr};
+    std::atomic<uint32_t> ringCount{0};
+    std::atomic<uint32_t> threadSerials{0};
+    std::atomic<uint32_t> connectionIds{0};
+    const char* volatile dumpPath = nullptr;
+
+    FlightRecorder() = default;
+
+    ThreadSlot& threadSlot() {
+        static thread_local ThreadSlot slot;
+        if (!slot.ring) {
+            slot.ring = acquireRing();
+            slot.serial = (uint16_t)(threadSerials.fetch_add(1, std::memory_order_relaxed) + 1);
+        }
+        return slot;
+    }
+
+    Ring* acquireRing() {
+        for (Ring* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+            bool idle = false;
+            if (ring->inUse.compare_exchange_strong(idle, true, std::memory_order_acq_rel)) {
+                return ring;
+            }
+        }
+
+        Ring* ring = new Ring;
+        ring->index = ringCount.fetch_add(1, std::memory_order_relaxed);
+        Ring* head = rings.load(std::memory_order_relaxed);
+        do {
+            ring->next = head;
+        } while (!rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+        return ring;
+    }
+
+    static void onFatalSignal(int sig) {
+        FlightRecorder& recorder = instance();
+        if (recorder.dumpPath) {
+            recorder.dump(recorder.dumpPath);
+        }
+        std::signal(sig, SIG_DFL);
+        std::raise(sig);
+    }
+
+    static void onDumpSignal(int sig) {
+        FlightRecorder& recorder = instance();
+        if (recorder.dumpPath) {
+            recorder.dump(recorder.dumpPath);
+        }
+        std::signal(sig, &FlightRecorder::onDumpSignal);
+    }
+
+#ifdef _WIN32
+    static LONG WINAPI onUnhandledException(EXCEPTION_POINTERS*) {
+        FlightRecorder& recorder = instance();
+        if (recorder.dumpPath) {
+            recorder.dump(recorder.dumpPath);
+        }
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    typedef HANDLE File;
+
+    static File openFile(const char* path) {
+        return CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+
+    static bool validFile(File file) {
+        return file != INVALID_HANDLE_VALUE;
+    }
+
+    static bool writeFile(File file, const void* data, size_t size) {
+        const char* bytes = (const char*)data;
+        while (size > 0) {
+            DWORD written = 0;
+            if (!WriteFile(file, bytes, (DWORD)size, &written, nullptr) || written == 0) {
+                return false;
+            }
+            bytes += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    static void closeFile(File file) {
+        CloseHandle(file);
+    }
+#else
+    typedef int File;
+
+    static File openFile(const char* path) {
+        return ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    static bool validFile(File file) {
+        return file >= 0;
+    }
+
+    static bool writeFile(File file, const void* data, size_t size) {
+        const char* bytes = (const char*)data;
+        while (size > 0) {
+            ssize_t written = ::write(file, bytes, size);
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            size -= (size_t)written;
+        }
+        return true;
+    }
+
+    static void closeFile(File file) {
+        ::close(file);
+    }
+#endif
+};
+
+inline void flightRecord(uint16_t type, uint32_t connectionId, uint32_t size = 0, uint32_t aux = 0) {
+    FlightRecorder::instance().record(type, connectionId, size, aux);
+}
+
+#endif
@@ -3,24 +3,103 @@
 #include <QMessageBox>
 #include <thread>
 #include "server.hpp"
+#include "serverevents.hpp"
+#include "metricsexporter.hpp"
+#include "flightrecorder.hpp"
+#include "trafficcapture.hpp"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
-    ChatServer server(8888);
+    // Written on a crash, on Ctrl+Break, or via /flightrecorder on the
+    // metrics port; decode with Tools/FlightDecoder.
+    static const std::string flightDumpPath =
+        qEnvironmentVariable("CHAT_FLIGHT_DUMP", "chat_server.flight").toStdString();
+    FlightRecorder::instance().installHandlers(flightDumpPath.c_str());
+
+    ServerEventQueue events(kServerEventQueueCapacity);
+    ChatServer server(8888, &events);
 
     if (!server.initialize()) {
         QMessageBox::critical(nullptr, "Ошибка", "Не удалось инициализировать сервер!");
         return 1;
     }
 
+    // One message in CHAT_TRACE_SAMPLE_RATE is traced (default 1%); the
+    // slowest ones are served on /traces.
+    bool rateSet = false;
+    double sampleRate = qEnvironmentVariable("CHAT_TRACE_SAMPLE_RATE").toDouble(&rateSet);
+    int slowest = qEnvironmentVariableIntValue("CHAT_TRACE_SLOWEST");
+    server.messageTracer().configure(rateSet ? sampleRate : 0.01,
+                                     slowest > 0 ? (size_t)slowest : MessageTracer::kDefaultSlowest);
+
+    // Statements slower than CHAT_SLOW_QUERY_MS (default 50, 0 = off) are
+    // logged with their query plan to CHAT_SLOW_QUERY_LOG.
+    bool thresholdSet = false;
+    int slowQueryMs = qEnvironmentVariableIntValue("CHAT_SLOW_QUERY_MS", &thresholdSet);
+    server.sqlProfiler().configureSlowLog(
+        qEnvironmentVariable("CHAT_SLOW_QUERY_LOG", "chat_server_slow.log").toStdString(),
+        thresholdSet ? slowQueryMs : 50);
+
+    // MESSAGE commands are limited per user (CHAT_RATE_USER, default 20:60)
+    // and per IP address (CHAT_RATE_IP, default off), each given as
+    // messages per second:burst, "0" for no limit. CHAT_RATE_COST is what a
+    // Low, Medium and High message takes from the buckets (default 1,1,3).
+    auto rateFromEnv = [](const char* name, const QString& fallback) {
+        QStringList parts = qEnvironmentVariable(name, fallback).split(':');
+        RateLimit limit;
+        limit.perSecond = parts.value(0).toDouble();
+        limit.burst = parts.size() > 1 ? parts.value(1).toDouble() : limit.perSecond;
+        return limit;
+    };
+    QStringList costParts = qEnvironmentVariable("CHAT_RATE_COST", "1,1,3").split(',');
+    double costs[3];
+    for (int i = 0; i < 3; ++i) {
+        bool ok = false;
+        double cost = costParts.value(i).toDouble(&ok);
+        costs[i] = ok && cost > 0 ? cost : 1;
+    }
+    server.rateLimiter().configure(rateFromEnv("CHAT_RATE_USER", "20:60"), rateFromEnv("CHAT_RATE_IP", "0"), costs);
+
+    // Both off unless set: CHAT_METRICS_FILE=path, CHAT_METRICS_PORT=9464.
+    MetricsExporter exporter(server.metricsRegistry(),
+                             qEnvironmentVariable("CHAT_METRICS_FILE").toStdString(),
+                             (unsigned short)qEnvironmentVariableIntValue("CHAT_METRICS_PORT"));
+    exporter.addPage("/traces", [&server]() {
+        return server.messageTracer().dumpSlowest();
+    });
+    exporter.addPage("/flightrecorder", []() {
+        flightRecord(FlightDumpRequested, 0);
+        bool ok = FlightRecorder::instance().dump(flightDumpPath.c_str());
+        return (ok ? "dumped to " : "failed to write ") + flightDumpPath + "\n";
+    });
+    if (!exporter.start()) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось открыть порт для метрик!");
+    }
+
+    // CHAT_CAPTURE=path records inbound commands for Tools/Replay, up to
+    // CHAT_CAPTURE_MAX_MB (default 1024). Message texts are blanked unless
+    // CHAT_CAPTURE_KEEP_TEXT=1; passwords never are written.
+    TrafficCapture capture;
+    QString capturePath = qEnvironmentVariable("CHAT_CAPTURE");
+    if (!capturePath.isEmpty()) {
+        bool maxSet = false;
+        int maxMb = qEnvironmentVariableIntValue("CHAT_CAPTURE_MAX_MB", &maxSet);
+        if (capture.start(capturePath.toStdString(), qEnvironmentVariableIntValue("CHAT_CAPTURE_KEEP_TEXT") == 1,
+                          (unsigned long long)(maxSet ? maxMb : 1024) << 20)) {
+            server.setTrafficCapture(&capture);
+        } else {
+            QMessageBox::warning(nullptr, "Ошибка", "Не удалось открыть файл для записи трафика!");
+        }
+    }
+
     std::thread serverThread([&server]() {
         server.run();
     });
 
-    MainWindow w;
-    w.setFixedSize(444, 652);
+    MainWindow w(&server, &events);
+    w.setFixedSize(444, 852);
     w.show();
 
     int result = a.exec();
@@ -29,6 +108,8 @@ int main(int argc, char *argv[])
     if (serverThread.joinable()) {
         serverThread.join();
     }
+    exporter.stop();
+    capture.stop();
 
     return result;
 }
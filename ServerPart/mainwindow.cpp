@@ -1,151 +1,257 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "adminmodels.h"
 #include <QMessageBox>
-#include <QSqlDatabase>
-#include <QSqlQuery>
-#include <QSqlError>
 #include <QTimer>
 #include <QDateTime>
+#include <QSet>
+#include "server.hpp"
 
-MainWindow::MainWindow(QWidget *parent)
+static const int kEventDrainIntervalMs = 50;
+static const int kMaxEventsPerDrain = 4096;
+static const int kSessionsRefreshMs = 1000;
+static const int kFilterDelayMs = 300;
+
+MainWindow::MainWindow(ChatServer *server, ServerEventQueue *events, QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , usersModel(new QStandardItemModel(this))
-    , messagesModel(new QStandardItemModel(this))
+    , sessionsModel(new QStandardItemModel(this))
+    , server(server)
+    , worker(new AdminWorker("chat_server.db", &server->sqlProfiler()))
+    , events(events)
+    , seenDropped(0)
 {
     ui->setupUi(this);
     setWindowTitle("Chat Server - Admin Panel");
 
-    usersModel->setHorizontalHeaderLabels({"Username", "IP", "Status"});
+    // All SQL runs on workerThread; results arrive as queued signals.
+    worker->moveToThread(&workerThread);
+    connect(&workerThread, &QThread::finished, worker, &QObject::deleteLater);
+    connect(worker, &AdminWorker::banFinished, this, &MainWindow::handleBanFinished);
+    workerThread.start();
+
+    // Both tables load a page at a time as they are scrolled; sorting and
+    // filtering are done by the database, not by the view.
+    usersModel = new AdminUsersModel(worker, this);
     ui->UsersView->setModel(usersModel);
     ui->UsersView->setHeaderHidden(false);
     ui->UsersView->setRootIsDecorated(false);
+    ui->UsersView->setUniformRowHeights(true);
+    ui->UsersView->setSortingEnabled(true);
+    ui->UsersView->sortByColumn(AdminWorker::UsernameColumn, Qt::AscendingOrder);
 
     ui->UsersView->setColumnWidth(0, 70);
     ui->UsersView->setColumnWidth(1, 70);
     ui->UsersView->setColumnWidth(2, 40);
 
-    messagesModel->setHorizontalHeaderLabels({"Sender", "Receiver", "Message", "Time"});
+    messagesModel = new AdminMessagesModel(worker, this);
     ui->MessagesView->setModel(messagesModel);
     ui->MessagesView->setHeaderHidden(false);
     ui->MessagesView->setRootIsDecorated(false);
+    ui->MessagesView->setUniformRowHeights(true);
+    ui->MessagesView->setSortingEnabled(true);
+    ui->MessagesView->sortByColumn(3, Qt::DescendingOrder);
 
     ui->MessagesView->setColumnWidth(0, 50);
     ui->MessagesView->setColumnWidth(1, 50);
     ui->MessagesView->setColumnWidth(2, 60);
     ui->MessagesView->setColumnWidth(3, 70);
 
-    QTimer *timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &MainWindow::updateUsersList);
-    connect(timer, &QTimer::timeout, this, &MainWindow::updateMessagesList);
-    timer->start(2000);
+    // Typing restarts the timer, so a query runs once the user pauses.
+    QTimer *filterTimer = new QTimer(this);
+    filterTimer->setSingleShot(true);
+    filterTimer->setInterval(kFilterDelayMs);
+    connect(ui->UsersFilter, &QLineEdit::textChanged, filterTimer, qOverload<>(&QTimer::start));
+    connect(ui->MessagesFilter, &QLineEdit::textChanged, filterTimer, qOverload<>(&QTimer::start));
+    connect(filterTimer, &QTimer::timeout, this, [this]() {
+        usersModel->setPrefixFilter(ui->UsersFilter->text().trimmed());
+        messagesModel->setParticipantFilter(ui->MessagesFilter->text().trimmed());
+    });
+
+    sessionsModel->setHorizontalHeaderLabels({"User", "IP", "Since", "In", "Out", "Queue", "Idle", "Msg/s"});
+    ui->SessionsView->setModel(sessionsModel);
+    ui->SessionsView->setHeaderHidden(false);
+    ui->SessionsView->setRootIsDecorated(false);
+
+    ui->SessionsView->setColumnWidth(0, 60);
+    ui->SessionsView->setColumnWidth(1, 80);
+    ui->SessionsView->setColumnWidth(2, 55);
+    ui->SessionsView->setColumnWidth(3, 50);
+    ui->SessionsView->setColumnWidth(4, 50);
+    ui->SessionsView->setColumnWidth(5, 40);
+    ui->SessionsView->setColumnWidth(6, 35);
+    ui->SessionsView->setColumnWidth(7, 40);
+
+    // After the first pages the tables follow ChatServer's event feed and
+    // only go back to the database if the feed overflowed.
+    if (events) {
+        QTimer *eventTimer = new QTimer(this);
+        connect(eventTimer, &QTimer::timeout, this, &MainWindow::drainEvents);
+        eventTimer->start(kEventDrainIntervalMs);
+    }
+
+    // Live sessions come straight from ChatServer's lock-free snapshot.
+    QTimer *sessionsTimer = new QTimer(this);
+    connect(sessionsTimer, &QTimer::timeout, this, &MainWindow::refreshSessions);
+    sessionsTimer->start(kSessionsRefreshMs);
 
-    updateUsersList();
-    updateMessagesList();
+    resyncOnline();
+    refreshSessions();
 }
 
 MainWindow::~MainWindow()
 {
+    workerThread.quit();
+    workerThread.wait();
     delete ui;
 }
 
-void MainWindow::updateUsersList()
+void MainWindow::drainEvents()
 {
-    usersModel->removeRows(0, usersModel->rowCount());
-
-    QSqlDatabase db = QSqlDatabase::database("chat_server_connection");
-    if (!db.isOpen()) {
-        db = QSqlDatabase::addDatabase("QSQLITE", "chat_server_connection");
-        db.setDatabaseName("chat_server.db");
-        if (!db.open()) {
-            return;
+    if (events->dropped() != seenDropped) {
+        // Something was missed; start over from the database and the
+        // current session list.
+        seenDropped = events->dropped();
+        ServerEvent skipped;
+        while (events->tryPop(skipped)) {
         }
+        usersModel->reload();
+        messagesModel->reload();
+        resyncOnline();
+        return;
     }
 
-    QSqlQuery query(db);
-    query.prepare("SELECT username, name, is_banned FROM users ORDER BY username");
-
-    if (query.exec()) {
-        while (query.next()) {
-            QString username = query.value(0).toString();
-            QString name = query.value(1).toString();
-            bool isBanned = query.value(2).toBool();
-
-            QList<QStandardItem*> rowItems;
-
-            QStandardItem *usernameItem = new QStandardItem(username);
-            rowItems.append(usernameItem);
-
-            QStandardItem *nameItem = new QStandardItem(name);
-            rowItems.append(nameItem);
-
-            QStandardItem *statusItem = new QStandardItem();
-            if (isBanned) {
-                statusItem->setText("Banned");
-                statusItem->setForeground(Qt::red);
-                usernameItem->setForeground(Qt::red);
-            } else {
-                statusItem->setText("Active");
-                statusItem->setForeground(Qt::darkGreen);
-            }
-            rowItems.append(statusItem);
+    ServerEvent event;
+    for (int i = 0; i < kMaxEventsPerDrain && events->tryPop(event); ++i) {
+        applyEvent(event);
+    }
+}
 
-            usersModel->appendRow(rowItems);
-        }
+void MainWindow::resyncOnline()
+{
+    onlineCounts.clear();
+    usersModel->clearOnline();
+    if (!server) {
+        return;
     }
 
-    usersModel->setHorizontalHeaderLabels({"Username", "Name", "Status"});
+    std::shared_ptr<const SessionSnapshot> snapshot = server->sessionSnapshot();
+    for (const SessionInfo &session : *snapshot) {
+        QString username = QString::fromStdString(session.username);
+        ++onlineCounts[username];
+        usersModel->setOnline(username, true);
+    }
 }
 
-void MainWindow::updateMessagesList()
+void MainWindow::applyEvent(const ServerEvent &event)
 {
-    messagesModel->removeRows(0, messagesModel->rowCount());
-
-    QSqlDatabase db = QSqlDatabase::database("chat_server_connection");
-    if (!db.isOpen()) {
-        db = QSqlDatabase::addDatabase("QSQLITE", "chat_server_connection");
-        db.setDatabaseName("chat_server.db");
-        if (!db.open()) {
-            return;
+    QString username = QString::fromStdString(event.username);
+
+    switch (event.type) {
+    case ServerEvent::MessageRouted: {
+        AdminMessageRow row;
+        row.id = event.messageId;
+        row.sender = username;
+        row.getter = QString::fromStdString(event.getter);
+        row.text = QString::fromStdString(event.text);
+        row.timestamp = QDateTime::fromMSecsSinceEpoch(
+            std::chrono::duration_cast<std::chrono::milliseconds>(event.time.time_since_epoch()).count());
+        messagesModel->messageRouted(row);
+        break;
+    }
+    case ServerEvent::UserRegistered:
+        usersModel->userRegistered(username, QString::fromStdString(event.name));
+        break;
+    case ServerEvent::UserLoggedIn:
+        ++onlineCounts[username];
+        usersModel->setOnline(username, true);
+        break;
+    case ServerEvent::UserLoggedOut:
+        if (--onlineCounts[username] <= 0) {
+            onlineCounts.remove(username);
+            usersModel->setOnline(username, false);
         }
+        break;
+    case ServerEvent::UserBanned:
+    case ServerEvent::UserUnbanned:
+        usersModel->userBanChanged(username, event.type == ServerEvent::UserBanned);
+        break;
     }
+}
 
-    QSqlQuery query(db);
-    query.prepare("SELECT sender, getter, text, tag, timestamp FROM messages ORDER BY timestamp DESC LIMIT 50");
+static QString formatBytes(unsigned long long bytes)
+{
+    if (bytes < 1024) return QString::number(bytes) + " B";
+    if (bytes < 1024 * 1024) return QString::number(bytes / 1024.0, 'f', 1) + " K";
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " M";
+}
 
-    if (query.exec()) {
-        while (query.next()) {
-            QString sender = query.value(0).toString();
-            QString receiver = query.value(1).toString();
-            QString text = query.value(2).toString();
-            QString tag = query.value(3).toString();
-            QDateTime timestamp = query.value(4).toDateTime();
+void MainWindow::setCellText(QStandardItemModel *model, int row, int column, const QString &text)
+{
+    QStandardItem *item = model->item(row, column);
+    if (item->text() != text) {
+        item->setText(text);
+    }
+}
 
-            QList<QStandardItem*> rowItems;
+// Sessions are keyed by connection: new ones are appended, closed ones
+// removed, and only cells whose text changed are touched.
+void MainWindow::refreshSessions()
+{
+    if (!server) {
+        return;
+    }
 
-            QStandardItem *senderItem = new QStandardItem(sender);
-            rowItems.append(senderItem);
+    std::shared_ptr<const SessionSnapshot> snapshot = server->sessionSnapshot();
+    qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
 
-            QStandardItem *receiverItem = new QStandardItem(receiver);
-            rowItems.append(receiverItem);
+    QSet<const Connection*> live;
+    for (const SessionInfo &session : *snapshot) {
+        const Connection *conn = session.connection.get();
+        live.insert(conn);
 
-            QString displayText = text;
-            if (displayText.length() > 20) {
-                displayText = displayText.left(20) + "...";
+        unsigned long long messagesIn = conn->messagesIn.load(std::memory_order_relaxed);
+        auto it = sessionRows.find(conn);
+        if (it == sessionRows.end()) {
+            QList<QStandardItem*> items;
+            for (int column = 0; column < sessionsModel->columnCount(); ++column) {
+                items.append(new QStandardItem());
             }
-            QStandardItem *textItem = new QStandardItem(displayText);
-            textItem->setToolTip(text);
-            rowItems.append(textItem);
-
-            QString timeStr = timestamp.toString("hh:mm");
-            QStandardItem *timeItem = new QStandardItem(timeStr);
-            rowItems.append(timeItem);
+            sessionsModel->appendRow(items);
+            it = sessionRows.insert(conn, SessionRow{session.connection, items.first(), messagesIn, nowMs});
+        }
 
-            messagesModel->appendRow(rowItems);
+        SessionRow &state = it.value();
+        double rate = 0;
+        if (nowMs > state.lastSampleMs) {
+            rate = (messagesIn - state.lastMessagesIn) * 1000.0 / (nowMs - state.lastSampleMs);
         }
+        state.lastMessagesIn = messagesIn;
+        state.lastSampleMs = nowMs;
+
+        qint64 connectedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            conn->connectedAt.time_since_epoch()).count();
+        qint64 idleMs = nowMs - conn->lastActivityMs.load(std::memory_order_relaxed);
+
+        int row = state.item->row();
+        setCellText(sessionsModel, row, 0, QString::fromStdString(session.username));
+        setCellText(sessionsModel, row, 1, QString::fromStdString(conn->ip));
+        setCellText(sessionsModel, row, 2, QDateTime::fromMSecsSinceEpoch(connectedMs).toString("hh:mm:ss"));
+        setCellText(sessionsModel, row, 3, formatBytes(conn->bytesIn.load(std::memory_order_relaxed)));
+        setCellText(sessionsModel, row, 4, formatBytes(conn->bytesOut.load(std::memory_order_relaxed)));
+        setCellText(sessionsModel, row, 5, formatBytes(conn->outbox.queuedBytes()));
+        setCellText(sessionsModel, row, 6, QString::number(qMax<qint64>(0, idleMs / 1000)) + "s");
+        setCellText(sessionsModel, row, 7, QString::number(rate, 'f', 1));
     }
 
-    messagesModel->setHorizontalHeaderLabels({"Sender", "To", "Message", "Time"});
+    for (auto it = sessionRows.begin(); it != sessionRows.end(); ) {
+        if (!live.contains(it.key())) {
+            sessionsModel->removeRow(it.value().item->row());
+            it = sessionRows.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void MainWindow::on_BanButton_clicked()
@@ -157,36 +263,7 @@ void MainWindow::on_BanButton_clicked()
         return;
     }
 
-    QSqlDatabase db = QSqlDatabase::database("chat_server_connection");
-    if (!db.isOpen()) {
-        db = QSqlDatabase::addDatabase("QSQLITE", "chat_server_connection");
-        db.setDatabaseName("chat_server.db");
-        if (!db.open()) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось подключиться к базе данных!");
-            return;
-        }
-    }
-
-    QSqlQuery checkQuery(db);
-    checkQuery.prepare("SELECT username FROM users WHERE username = ?");
-    checkQuery.addBindValue(username);
-
-    if (!checkQuery.exec() || !checkQuery.next()) {
-        QMessageBox::warning(this, "Ошибка", "Пользователь не найден!");
-        return;
-    }
-
-    QSqlQuery query(db);
-    query.prepare("UPDATE users SET is_banned = 1 WHERE username = ?");
-    query.addBindValue(username);
-
-    if (query.exec()) {
-        QMessageBox::information(this, "Бан", "Пользователь " + username + " забанен");
-        ui->UserLine->clear();
-        updateUsersList();
-    } else {
-        QMessageBox::warning(this, "Ошибка", "Не удалось забанить пользователя!");
-    }
+    QMetaObject::invokeMethod(worker, [this, username]() { worker->setBanned(username, true); }, Qt::QueuedConnection);
 }
 
 void MainWindow::on_UnbanButton_clicked()
@@ -198,34 +275,28 @@ void MainWindow::on_UnbanButton_clicked()
         return;
     }
 
-    QSqlDatabase db = QSqlDatabase::database("chat_server_connection");
-    if (!db.isOpen()) {
-        db = QSqlDatabase::addDatabase("QSQLITE", "chat_server_connection");
-        db.setDatabaseName("chat_server.db");
-        if (!db.open()) {
-            QMessageBox::warning(this, "Ошибка", "Не удалось подключиться к базе данных!");
-            return;
-        }
-    }
-
-    QSqlQuery checkQuery(db);
-    checkQuery.prepare("SELECT username FROM users WHERE username = ?");
-    checkQuery.addBindValue(username);
+    QMetaObject::invokeMethod(worker, [this, username]() { worker->setBanned(username, false); }, Qt::QueuedConnection);
+}
 
-    if (!checkQuery.exec() || !checkQuery.next()) {
+void MainWindow::handleBanFinished(const QString &username, bool banned, AdminWorker::BanResult result)
+{
+    if (result == AdminWorker::UserNotFound) {
         QMessageBox::warning(this, "Ошибка", "Пользователь не найден!");
         return;
     }
+    if (result == AdminWorker::DatabaseError) {
+        QMessageBox::warning(this, "Ошибка", banned ? "Не удалось забанить пользователя!"
+                                                    : "Не удалось разбанить пользователя!");
+        return;
+    }
 
-    QSqlQuery query(db);
-    query.prepare("UPDATE users SET is_banned = 0 WHERE username = ?");
-    query.addBindValue(username);
-
-    if (query.exec()) {
+    if (banned) {
+        QMessageBox::information(this, "Бан", "Пользователь " + username + " забанен");
+    } else {
         QMessageBox::information(this, "Разбан", "Пользователь " + username + " разбанен");
+    }
+    if (ui->UserLine->text().trimmed() == username) {
         ui->UserLine->clear();
-        updateUsersList();
-    } else {
-        QMessageBox::warning(this, "Ошибка", "Не удалось разбанить пользователя!");
     }
+    usersModel->userBanChanged(username, banned);
 }
@@ -3,6 +3,16 @@
 
 #include <QMainWindow>
 #include <QStandardItemModel>
+#include <QHash>
+#include <QThread>
+#include "adminworker.h"
+#include "serverevents.hpp"
+#include <memory>
+
+class ChatServer;
+class AdminUsersModel;
+class AdminMessagesModel;
+struct Connection;
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -15,19 +25,41 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    explicit MainWindow(QWidget *parent = nullptr);
+    MainWindow(ChatServer *server, ServerEventQueue *events, QWidget *parent = nullptr);
     ~MainWindow();
 
 private slots:
     void on_BanButton_clicked();
     void on_UnbanButton_clicked();
-    void updateUsersList();
-    void updateMessagesList();
+    void handleBanFinished(const QString &username, bool banned, AdminWorker::BanResult result);
+    void drainEvents();
+    void refreshSessions();
 
 private:
+    void applyEvent(const ServerEvent &event);
+    void resyncOnline();
+    void setCellText(QStandardItemModel *model, int row, int column, const QString &text);
+
+    // Keeps the Connection alive while its row exists, so a recycled
+    // address can never be mistaken for it.
+    struct SessionRow {
+        std::shared_ptr<const Connection> connection;
+        QStandardItem *item;
+        unsigned long long lastMessagesIn;
+        qint64 lastSampleMs;
+    };
+
     Ui::MainWindow *ui;
-    QStandardItemModel *usersModel;
-    QStandardItemModel *messagesModel;
+    AdminUsersModel *usersModel;
+    AdminMessagesModel *messagesModel;
+    QStandardItemModel *sessionsModel;
+    ChatServer *server;
+    QHash<const Connection*, SessionRow> sessionRows;
+    QThread workerThread;
+    AdminWorker *worker;
+    ServerEventQueue *events;
+    unsigned long long seenDropped;
+    QHash<QString, int> onlineCounts;
 };
 
 #endif
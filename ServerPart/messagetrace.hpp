@@ -0,0 +1,182 @@
+#ifndef MESSAGETRACE_HPP
+#define MESSAGETRACE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+
+#include "metrics.hpp"
+
+// Timeline of one sampled MESSAGE command, from the recv() that completed
+// it until its frame was queued for the last recipient; the socket write
+// happens later and is measured per priority by chat_outbound_wait_seconds.
+// Stage times are microseconds since
+// `received`; -1 marks a stage the message never reached (banned sender,
+// nobody online).
+struct MessageTrace {
+    enum Stage {
+        Parsed,
+        BanChecked,
+        Logged,
+        Routed,
+        FirstQueued,
+        LastQueued,
+        StageCount
+    };
+
+    std::chrono::steady_clock::time_point received;
+    long long at[StageCount] = {-1, -1, -1, -1, -1, -1};
+    long long messageId = 0;
+    std::string sender;
+    std::string getter;
+    size_t bytes = 0;
+    int recipients = 0;
+    // Summed over recipients while routing a broadcast.
+    long long recipientBanCheckMicros = 0;
+    long long enqueueMicros = 0;
+
+    long long sinceReceived(std::chrono::steady_clock::time_point when) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(when - received).count();
+    }
+
+    void mark(Stage stage) {
+        at[stage] = sinceReceived(std::chrono::steady_clock::now());
+    }
+
+    long long total() const {
+        for (int i = StageCount - 1; i >= 0; --i) {
+            if (at[i] >= 0) {
+                return at[i];
+            }
+        }
+        return 0;
+    }
+};
+
+static const char* const kTraceStageNames[MessageTrace::StageCount] = {
+    "parse", "ban_check", "log", "route", "first_enqueue", "last_enqueue"
+};
+
+// Samples one in every `period` messages per handler thread, records the
+// stage-to-stage latency of each into histograms and keeps the slowest
+// traces for inspection. Unsampled messages cost one thread-local
+// increment.
+class MessageTracer {
+private:
+    std::atomic<unsigned> period;
+    std::atomic<size_t> keep;
+    Histogram* stageMicros[MessageTrace::StageCount];
+    Histogram& recipientBanCheckMicros;
+    Histogram& enqueueMicros;
+    Histogram& totalMicros;
+    Counter& sampled;
+
+    std::mutex slowestMutex;
+    std::vector<MessageTrace> slowest;
+
+public:
+    static const size_t kDefaultSlowest = 20;
+
+    explicit MessageTracer(MetricsRegistry& registry)
+        : period(100), keep(kDefaultSlowest)
+        , recipientBanCheckMicros(registry.histogram("chat_message_recipient_ban_checks_seconds",
+              "Per-recipient ban checks summed over one sampled broadcast.", latencyBoundsSeconds(), 1e-6))
+        , enqueueMicros(registry.histogram("chat_message_enqueues_seconds",
+              "Outbound queue pushes summed over one sampled message.", latencyBoundsSeconds(), 1e-6))
+        , totalMicros(registry.histogram("chat_message_total_seconds",
+              "recv() until the last recipient's frame was queued, sampled messages.", latencyBoundsSeconds(), 1e-6))
+        , sampled(registry.counter("chat_message_traces_total", "Messages sampled for tracing.")) {
+        for (int i = 0; i < MessageTrace::StageCount; ++i) {
+            stageMicros[i] = &registry.histogram("chat_message_stage_seconds",
+                "Time spent reaching each stage from the previous one, sampled messages.",
+                latencyBoundsSeconds(), 1e-6, std::string("stage=\"") + kTraceStageNames[i] + "\"");
+        }
+    }
+
+    MessageTracer(const MessageTracer&) = delete;
+    MessageTracer& operator=(const MessageTracer&) = delete;
+
+    // sampleRate in [0, 1]; 0 disables tracing.
+    void configure(double sampleRate, size_t slowestToKeep) {
+        period = sampleRate <= 0 ? 0u : (unsigned)std::max(1.0, 1.0 / std::min(sampleRate, 1.0) + 0.5);
+        keep = slowestToKeep;
+    }
+
+    bool shouldSample() {
+        unsigned every = period.load(std::memory_order_relaxed);
+        if (every == 0) {
+            return false;
+        }
+        static thread_local unsigned counter = 0;
+        return ++counter % every == 0;
+    }
+
+    void finish(const MessageTrace& trace) {
+        sampled.inc();
+
+        long long previous = 0;
+        for (int i = 0; i < MessageTrace::StageCount; ++i) {
+            if (trace.at[i] < 0) {
+                continue;
+            }
+            stageMicros[i]->record((uint64_t)std::max(0LL, trace.at[i] - previous));
+            previous = trace.at[i];
+        }
+        if (trace.recipients > 0) {
+            recipientBanCheckMicros.record((uint64_t)trace.recipientBanCheckMicros);
+            enqueueMicros.record((uint64_t)trace.enqueueMicros);
+        }
+        totalMicros.record((uint64_t)trace.total());
+
+        size_t limit = keep.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(slowestMutex);
+        auto faster = [](const MessageTrace& a, const MessageTrace& b) { return a.total() > b.total(); };
+        if (slowest.size() < limit) {
+            slowest.push_back(trace);
+            std::push_heap(slowest.begin(), slowest.end(), faster);
+        } else if (!slowest.empty() && trace.total() > slowest.front().total()) {
+            std::pop_heap(slowest.begin(), slowest.end(), faster);
+            slowest.back() = trace;
+            std::push_heap(slowest.begin(), slowest.end(), faster);
+        }
+    }
+
+    // Slowest first, one line per message, stage times in microseconds
+    // since recv().
+    std::string dumpSlowest() {
+        std::vector<MessageTrace> traces;
+        {
+            std::lock_guard<std::mutex> lock(slowestMutex);
+            traces = slowest;
+        }
+        std::sort(traces.begin(), traces.end(), [](const MessageTrace& a, const MessageTrace& b) {
+            return a.total() > b.total();
+        });
+
+        std::ostringstream out;
+        out << "# " << traces.size() << " slowest sampled messages, microseconds since recv\n";
+        for (const auto& trace : traces) {
+            out << "id=" << trace.messageId
+                << " sender=" << trace.sender
+                << " getter=" << trace.getter
+                << " bytes=" << trace.bytes
+                << " recipients=" << trace.recipients
+                << " total=" << trace.total();
+            for (int i = 0; i < MessageTrace::StageCount; ++i) {
+                if (trace.at[i] >= 0) {
+                    out << ' ' << kTraceStageNames[i] << '=' << trace.at[i];
+                }
+            }
+            out << " recipient_ban_checks=" << trace.recipientBanCheckMicros
+                << " enqueues=" << trace.enqueueMicros << '\n';
+        }
+        return out.str();
+    }
+};
+
+#endif
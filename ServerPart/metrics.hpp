@@ -0,0 +1,367 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <sstream>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <dirent.h>
+#include <fstream>
+#endif
+
+// Writers touch only their own shard, so hot paths never share a cache
+// line with another thread; readers sum the shards.
+static const size_t kMetricShards = 16;
+
+inline size_t metricShard() {
+    static std::atomic<size_t> nextShard(0);
+    static thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+    return shard;
+}
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) {
+        cells[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& cell : cells) {
+            total += cell.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value{0};
+    };
+    Cell cells[kMetricShards];
+};
+
+// Up/down value such as open connections. Increments and decrements may
+// land on different shards; only the sum is meaningful.
+class Gauge {
+public:
+    void add(int64_t n) {
+        cells[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void inc() { add(1); }
+    void dec() { add(-1); }
+
+    int64_t value() const {
+        int64_t total = 0;
+        for (const auto& cell : cells) {
+            total += cell.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<int64_t> value{0};
+    };
+    Cell cells[kMetricShards];
+};
+
+// Aggregated copy of a Histogram, cheap to query repeatedly.
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    // Upper bound of the bucket holding the q-th value, 0 <= q <= 1.
+    uint64_t percentile(double q) const;
+    uint64_t max() const;
+};
+
+// HDR-style log-linear histogram of non-negative integers (microseconds,
+// recipients, bytes...). Values below 32 are exact; above that every
+// power of two is split into 16 buckets, so any value is reported within
+// about 6% regardless of magnitude, up to 2^36.
+class Histogram {
+public:
+    static const int kSubBits = 4;
+    static const int kLinear = 2 << kSubBits;
+    static const int kMaxExponent = 36;
+    static const int kBuckets = kLinear + (kMaxExponent - kSubBits - 1) * (1 << kSubBits);
+
+    static int bucketIndex(uint64_t value) {
+        if (value < (uint64_t)kLinear) {
+            return (int)value;
+        }
+        int msb = 63;
+        while (!(value >> msb)) {
+            --msb;
+        }
+        if (msb >= kMaxExponent) {
+            return kBuckets - 1;
+        }
+        int shift = msb - kSubBits;
+        int top = (int)(value >> shift) - (1 << kSubBits);
+        return kLinear + (shift - 1) * (1 << kSubBits) + top;
+    }
+
+    // Largest value that lands in bucket `index`.
+    static uint64_t bucketUpperBound(int index) {
+        if (index < kLinear) {
+            return (uint64_t)index;
+        }
+        int shift = (index - kLinear) / (1 << kSubBits) + 1;
+        uint64_t top = (uint64_t)((index - kLinear) % (1 << kSubBits) + (1 << kSubBits));
+        return ((top + 1) << shift) - 1;
+    }
+
+    void record(uint64_t value) {
+        Shard& shard = shards[metricShard()];
+        shard.buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    HistogramSnapshot snapshot() const {
+        HistogramSnapshot snap;
+        snap.buckets.assign(kBuckets, 0);
+        for (const auto& shard : shards) {
+            for (int i = 0; i < kBuckets; ++i) {
+                uint64_t n = shard.buckets[i].load(std::memory_order_relaxed);
+                snap.buckets[i] += n;
+                snap.count += n;
+            }
+            snap.sum += shard.sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[kBuckets] = {};
+        std::atomic<uint64_t> sum{0};
+    };
+    Shard shards[kMetricShards];
+};
+
+inline uint64_t HistogramSnapshot::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return Histogram::bucketUpperBound((int)i);
+        }
+    }
+    return Histogram::bucketUpperBound((int)buckets.size() - 1);
+}
+
+inline uint64_t HistogramSnapshot::max() const {
+    for (size_t i = buckets.size(); i > 0; --i) {
+        if (buckets[i - 1]) {
+            return Histogram::bucketUpperBound((int)i - 1);
+        }
+    }
+    return 0;
+}
+
+// Bucket boundaries for the Prometheus export, in exported units.
+inline std::vector<double> latencyBoundsSeconds() {
+    return {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+            0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+}
+
+inline std::vector<double> countBounds() {
+    return {0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+}
+
+// Owns named metrics and renders them in the Prometheus text format.
+// Metrics are registered up front and never removed, so the references
+// handed out stay valid for the registry's lifetime.
+class MetricsRegistry {
+public:
+    // `labels` is either empty or a ready-made label list such as
+    // result="failed"; entries sharing a name form one family.
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+        auto metric = std::make_shared<Counter>();
+        add(name, help, "counter", labels, [metric](std::ostream& out, const std::string& series) {
+            out << series << ' ' << metric->value() << '\n';
+        });
+        return *metric;
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "") {
+        auto metric = std::make_shared<Gauge>();
+        add(name, help, "gauge", labels, [metric](std::ostream& out, const std::string& series) {
+            out << series << ' ' << metric->value() << '\n';
+        });
+        return *metric;
+    }
+
+    // Sampled at render time, for values owned elsewhere (queue depths,
+    // process stats). `type` is "gauge" or "counter".
+    void callback(const std::string& name, const std::string& help, const std::string& type,
+                  std::function<double()> read) {
+        add(name, help, type, "", [read](std::ostream& out, const std::string& series) {
+            out << series << ' ' << read() << '\n';
+        });
+    }
+
+    // Values are recorded in raw units and multiplied by `scale` on export
+    // (1e-6 turns recorded microseconds into seconds).
+    Histogram& histogram(const std::string& name, const std::string& help,
+                         std::vector<double> bounds, double scale = 1.0, const std::string& labels = "") {
+        auto metric = std::make_shared<Histogram>();
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+        add(name, help, "histogram", labels,
+            [metric, bounds, scale, name, prefix, suffix](std::ostream& out, const std::string&) {
+            HistogramSnapshot snap = metric->snapshot();
+            uint64_t cumulative = 0;
+            int next = 0;
+            for (double bound : bounds) {
+                // A bucket counts towards `le` when all of its values fit.
+                while (next < Histogram::kBuckets &&
+                       (double)Histogram::bucketUpperBound(next) * scale <= bound * (1 + 1e-9)) {
+                    cumulative += snap.buckets[next++];
+                }
+                out << name << "_bucket{" << prefix << "le=\"" << bound << "\"} " << cumulative << '\n';
+            }
+            out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << snap.count << '\n';
+            out << name << "_sum" << suffix << ' ' << (double)snap.sum * scale << '\n';
+            out << name << "_count" << suffix << ' ' << snap.count << '\n';
+        });
+        return *metric;
+    }
+
+    std::string renderPrometheus() const {
+        std::ostringstream out;
+        out.precision(15);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Entry& entry = entries[i];
+            if (i == 0 || entries[i - 1].name != entry.name) {
+                out << "# HELP " << entry.name << ' ' << entry.help << '\n';
+                out << "# TYPE " << entry.name << ' ' << entry.type << '\n';
+            }
+            entry.render(out, entry.labels.empty() ? entry.name : entry.name + "{" + entry.labels + "}");
+        }
+        return out.str();
+    }
+
+private:
+    struct Entry {
+        std::string name;
+        std::string help;
+        std::string type;
+        std::string labels;
+        std::function<void(std::ostream&, const std::string&)> render;
+    };
+
+    void add(const std::string& name, const std::string& help, const std::string& type,
+             const std::string& labels, std::function<void(std::ostream&, const std::string&)> render) {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Series of one family must be contiguous in the output, even when
+        // registered at different times.
+        auto position = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->name == name) {
+                position = it + 1;
+            }
+        }
+        entries.insert(position, Entry{name, help, type, labels, std::move(render)});
+    }
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+};
+
+struct ProcessStats {
+    uint64_t residentBytes = 0;
+    uint64_t threads = 0;
+    uint64_t openHandles = 0;
+};
+
+// Resident memory, thread count and open handles (fds on POSIX) of the
+// current process; zero where the platform gives no answer.
+inline ProcessStats readProcessStats() {
+    ProcessStats stats;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memory;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) {
+        stats.residentBytes = memory.WorkingSetSize;
+    }
+
+    DWORD handles = 0;
+    if (GetProcessHandleCount(GetCurrentProcess(), &handles)) {
+        stats.openHandles = handles;
+    }
+
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot != INVALID_HANDLE_VALUE) {
+        THREADENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        DWORD pid = GetCurrentProcessId();
+        for (BOOL ok = Thread32First(snapshot, &entry); ok; ok = Thread32Next(snapshot, &entry)) {
+            if (entry.th32OwnerProcessID == pid) {
+                ++stats.threads;
+            }
+        }
+        CloseHandle(snapshot);
+    }
+#else
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            stats.residentBytes = std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        } else if (line.compare(0, 8, "Threads:") == 0) {
+            stats.threads = std::strtoull(line.c_str() + 8, nullptr, 10);
+        }
+    }
+
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                ++stats.openHandles;
+            }
+        }
+        closedir(dir);
+        // The directory stream itself holds one.
+        if (stats.openHandles > 0) {
+            --stats.openHandles;
+        }
+    }
+#endif
+    return stats;
+}
+
+inline void registerProcessMetrics(MetricsRegistry& registry) {
+    registry.callback("process_resident_memory_bytes", "Resident memory size in bytes.", "gauge",
+                      [] { return (double)readProcessStats().residentBytes; });
+    registry.callback("process_threads", "Number of OS threads in the process.", "gauge",
+                      [] { return (double)readProcessStats().threads; });
+    registry.callback("process_open_fds", "Number of open file descriptors or handles.", "gauge",
+                      [] { return (double)readProcessStats().openHandles; });
+}
+
+#endif
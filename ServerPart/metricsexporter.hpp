@@ -0,0 +1,206 @@
+#ifndef METRICSEXPORTER_HPP
+#define METRICSEXPORTER_HPP
+
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+
+#include "metrics.hpp"
+
+// Publishes a MetricsRegistry for scrapers: rewrites a text file every
+// interval and/or answers HTTP GET / and /metrics on 127.0.0.1:<port>
+// with the current Prometheus text. Either side can be disabled (empty
+// path, port 0). Extra plain-text pages can be served with addPage().
+class MetricsExporter {
+private:
+    MetricsRegistry& registry;
+    std::string filePath;
+    unsigned short httpPort;
+    std::chrono::milliseconds interval;
+    SOCKET listenSocket;
+    std::atomic<bool> running;
+    std::thread fileThread;
+    std::thread httpThread;
+    std::map<std::string, std::function<std::string()>> pages;
+
+public:
+    MetricsExporter(MetricsRegistry& registry, const std::string& filePath, unsigned short httpPort,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(1000))
+        : registry(registry), filePath(filePath), httpPort(httpPort), interval(interval),
+          listenSocket(INVALID_SOCKET), running(false) {
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+    }
+
+    ~MetricsExporter() {
+        stop();
+        WSACleanup();
+    }
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // Before start() only.
+    void addPage(const std::string& path, std::function<std::string()> render) {
+        pages[path] = std::move(render);
+    }
+
+    // False only if the HTTP port was requested and could not be bound.
+    bool start() {
+        running = true;
+
+        if (!filePath.empty()) {
+            fileThread = std::thread(&MetricsExporter::fileLoop, this);
+        }
+
+        if (httpPort != 0) {
+            listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (listenSocket == INVALID_SOCKET) {
+                return false;
+            }
+
+            sockaddr_in addr;
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(httpPort);
+
+            if (bind(listenSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+                listen(listenSocket, 16) == SOCKET_ERROR) {
+                closesocket(listenSocket);
+                listenSocket = INVALID_SOCKET;
+                return false;
+            }
+
+            httpThread = std::thread(&MetricsExporter::httpLoop, this);
+        }
+
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (fileThread.joinable()) {
+            fileThread.join();
+        }
+        if (httpThread.joinable()) {
+            httpThread.join();
+        }
+        if (listenSocket != INVALID_SOCKET) {
+            closesocket(listenSocket);
+            listenSocket = INVALID_SOCKET;
+        }
+    }
+
+private:
+    void fileLoop() {
+        while (running) {
+            writeFile();
+            auto deadline = std::chrono::steady_clock::now() + interval;
+            while (running && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+        writeFile();
+    }
+
+    // Written aside and renamed so a scraper never reads half a file.
+    void writeFile() {
+        std::string tempPath = filePath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                return;
+            }
+            out << registry.renderPrometheus();
+        }
+        MoveFileExA(tempPath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING);
+    }
+
+    void httpLoop() {
+        while (running) {
+            fd_set readSet;
+            FD_ZERO(&readSet);
+            FD_SET(listenSocket, &readSet);
+            timeval timeout = {0, 200000};
+
+            if (select((int)listenSocket + 1, &readSet, nullptr, nullptr, &timeout) <= 0) {
+                continue;
+            }
+
+            sockaddr_in clientAddr;
+            int clientAddrSize = sizeof(clientAddr);
+            SOCKET client = accept(listenSocket, (sockaddr*)&clientAddr, &clientAddrSize);
+            if (client == INVALID_SOCKET) {
+                continue;
+            }
+            serve(client);
+            closesocket(client);
+        }
+    }
+
+    void serve(SOCKET client) {
+        DWORD readTimeout = 1000;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&readTimeout, sizeof(readTimeout));
+
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            int received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                break;
+            }
+            request.append(buffer, received);
+        }
+
+        // "GET /path?query HTTP/1.1"
+        std::string path;
+        size_t start = request.find(' ');
+        if (start != std::string::npos) {
+            size_t end = request.find_first_of(" ?\r\n", start + 1);
+            path = request.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+        }
+
+        std::string status = "200 OK";
+        std::string contentType = "text/plain; version=0.0.4";
+        std::string body;
+        auto page = pages.find(path);
+        if (path == "/" || path == "/metrics") {
+            body = registry.renderPrometheus();
+        } else if (page != pages.end()) {
+            contentType = "text/plain; charset=utf-8";
+            body = page->second();
+        } else {
+            status = "404 Not Found";
+            contentType = "text/plain";
+            body = "not found\n";
+        }
+
+        std::string response =
+            "HTTP/1.0 " + status + "\r\n"
+            "Content-Type: " + contentType + "\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+
+        size_t offset = 0;
+        while (offset < response.size()) {
+            int sent = send(client, response.c_str() + offset, (int)(response.size() - offset), 0);
+            if (sent <= 0) {
+                break;
+            }
+            offset += (size_t)sent;
+        }
+    }
+};
+
+#endif
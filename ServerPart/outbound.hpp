@@ -0,0 +1,227 @@
+#ifndef OUTBOUND_HPP
+#define OUTBOUND_HPP
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// One encoded frame shared by every queue it is routed to.
+using SharedFrame = std::shared_ptr<const std::string>;
+
+// Delivery classes, lowest first. Message levels come from the Tag chosen
+// in the client; Control covers replies to the connection's own commands.
+enum DeliveryPriority : uint8_t {
+    PriorityLow,
+    PriorityMedium,
+    PriorityHigh,
+    PriorityControl,
+    PriorityLevels
+};
+
+static const char* const kPriorityNames[PriorityLevels] = {"low", "medium", "high", "control"};
+
+// "Maximum" is what older clients labelled the top radio button.
+inline DeliveryPriority priorityOfTag(const std::string& tag) {
+    if (tag == "High" || tag == "Maximum") {
+        return PriorityHigh;
+    }
+    if (tag == "Medium") {
+        return PriorityMedium;
+    }
+    return PriorityLow;
+}
+
+// Server-wide counters fed by every connection's queue.
+struct OutboundStats {
+    Counter* shed[PriorityLevels] = {};
+    Histogram* waitMicros[PriorityLevels] = {};
+};
+
+// Per-connection outbound frames, one FIFO per priority. There is no
+// writer thread: whichever thread queues into an idle connection becomes
+// its drainer and writes batches until the queue is empty, while others
+// only queue and move on, so a slow recipient stalls one thread instead
+// of everyone routing to it.
+//
+// Control frames go first. The message levels share the socket by weighted
+// round robin (High 4 : Medium 2 : Low 1 frames per round), so High jumps
+// ahead of a backlog without starving the rest. Past kMaxQueuedBytes
+// frames are shed from the bottom up: Low is refused at half the limit,
+// Medium at three quarters, and a High frame that does not fit evicts the
+// oldest queued Low, then Medium, frames.
+class OutboundQueue {
+public:
+    static const size_t kMaxQueuedBytes = 1 << 20;
+    static const size_t kMaxBatchBytes = 16 * 1024;
+
+    OutboundQueue() : bytes(0), queuedBytesValue(0), draining(false), closed(false) {
+        resetCredits();
+    }
+
+    OutboundQueue(const OutboundQueue&) = delete;
+    OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+    // True when the caller now owns draining and must call takeBatch()
+    // until it returns false.
+    bool push(SharedFrame frame, DeliveryPriority level, OutboundStats& stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) {
+            return false;
+        }
+        if (level != PriorityControl && !makeRoom(frame->size(), level, stats)) {
+            countShed(stats, level, 1);
+            return false;
+        }
+        bytes += frame->size();
+        queuedBytesValue.store(bytes, std::memory_order_relaxed);
+        levels[level].push_back(Frame{std::move(frame), std::chrono::steady_clock::now()});
+
+        if (draining) {
+            return false;
+        }
+        draining = true;
+        return true;
+    }
+
+    // Moves up to kMaxBatchBytes of frames, in delivery order, into `batch`.
+    // Releases ownership and returns false once the queue is empty.
+    bool takeBatch(std::string& batch, int& frames, OutboundStats& stats) {
+        batch.clear();
+        frames = 0;
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        while (batch.size() < kMaxBatchBytes) {
+            int level = nextLevel();
+            if (level < 0) {
+                break;
+            }
+            Frame& frame = levels[level].front();
+            if (stats.waitMicros[level]) {
+                stats.waitMicros[level]->record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - frame.queuedAt).count());
+            }
+            bytes -= frame.data->size();
+            batch += *frame.data;
+            ++frames;
+            levels[level].pop_front();
+        }
+        queuedBytesValue.store(bytes, std::memory_order_relaxed);
+
+        if (frames == 0) {
+            draining = false;
+            return false;
+        }
+        return true;
+    }
+
+    // After a failed write: drops everything queued and refuses new frames.
+    // The drainer still calls takeBatch(), which then gives up ownership.
+    void fail() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        for (auto& level : levels) {
+            level.clear();
+        }
+        bytes = 0;
+        queuedBytesValue.store(0, std::memory_order_relaxed);
+    }
+
+    // True when no thread is draining: everything pushed so far has been
+    // written or dropped.
+    bool idle() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !draining;
+    }
+
+    size_t queuedBytes() const {
+        return queuedBytesValue.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Frame {
+        SharedFrame data;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    static size_t limitFor(DeliveryPriority level) {
+        switch (level) {
+        case PriorityLow: return kMaxQueuedBytes / 2;
+        case PriorityMedium: return kMaxQueuedBytes / 4 * 3;
+        default: return kMaxQueuedBytes;
+        }
+    }
+
+    bool makeRoom(size_t size, DeliveryPriority level, OutboundStats& stats) {
+        size_t limit = limitFor(level);
+        if (bytes + size <= limit) {
+            return true;
+        }
+        if (level != PriorityHigh) {
+            return false;
+        }
+        for (int victim = PriorityLow; victim < PriorityHigh && bytes + size > limit; ++victim) {
+            while (!levels[victim].empty() && bytes + size > limit) {
+                bytes -= levels[victim].front().data->size();
+                levels[victim].pop_front();
+                countShed(stats, victim, 1);
+            }
+        }
+        return bytes + size <= limit;
+    }
+
+    static void countShed(OutboundStats& stats, int level, uint64_t frames) {
+        if (stats.shed[level]) {
+            stats.shed[level]->inc(frames);
+        }
+    }
+
+    // Control strictly first; then the highest message level that still has
+    // credit this round; refills when every waiting level has used its share.
+    int nextLevel() {
+        if (!levels[PriorityControl].empty()) {
+            return PriorityControl;
+        }
+        for (int pass = 0; pass < 2; ++pass) {
+            bool waiting = false;
+            for (int level = PriorityHigh; level >= PriorityLow; --level) {
+                if (levels[level].empty()) {
+                    continue;
+                }
+                waiting = true;
+                if (credits[level] > 0) {
+                    --credits[level];
+                    return level;
+                }
+            }
+            if (!waiting) {
+                return -1;
+            }
+            resetCredits();
+        }
+        return -1;
+    }
+
+    void resetCredits() {
+        credits[PriorityLow] = 1;
+        credits[PriorityMedium] = 2;
+        credits[PriorityHigh] = 4;
+        credits[PriorityControl] = 0;
+    }
+
+    mutable std::mutex mutex;
+    std::deque<Frame> levels[PriorityLevels];
+    int credits[PriorityLevels];
+    size_t bytes;
+    std::atomic<size_t> queuedBytesValue;
+    bool draining;
+    bool closed;
+};
+
+#endif
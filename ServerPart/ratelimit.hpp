@@ -0,0 +1,142 @@
+#ifndef RATELIMIT_HPP
+#define RATELIMIT_HPP
+
+#include "outbound.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Tokens per second and bucket size; a zero rate disables the limit.
+struct RateLimit {
+    double perSecond = 0;
+    double burst = 0;
+
+    bool enabled() const {
+        return perSecond > 0;
+    }
+};
+
+class TokenBucket {
+public:
+    explicit TokenBucket(const RateLimit& limit)
+        : limit(limit), tokens(limit.burst), refilledAt(std::chrono::steady_clock::now()) {}
+
+    bool tryTake(double cost, std::chrono::steady_clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        refill(now);
+        if (tokens < cost) {
+            return false;
+        }
+        tokens -= cost;
+        return true;
+    }
+
+    // Undoes a tryTake() when a later check rejected the same message.
+    void giveBack(double cost) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tokens = std::min(limit.burst, tokens + cost);
+    }
+
+    bool full(std::chrono::steady_clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        refill(now);
+        return tokens >= limit.burst;
+    }
+
+private:
+    void refill(std::chrono::steady_clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - refilledAt).count();
+        if (elapsed > 0) {
+            tokens = std::min(limit.burst, tokens + elapsed * limit.perSecond);
+            refilledAt = now;
+        }
+    }
+
+    RateLimit limit;
+    std::mutex mutex;
+    double tokens;
+    std::chrono::steady_clock::time_point refilledAt;
+};
+
+// Hands out one bucket per user and one per IP address, shared by every
+// connection of that user or address. Connections keep their buckets, so
+// the per-message check never touches the maps. Buckets nobody holds are
+// kept until they have refilled, so reconnecting does not reset a limit.
+class RateLimiter {
+public:
+    static const size_t kPruneEvery = 1024;
+
+    RateLimiter() : costs{1, 1, 1}, created(0) {}
+
+    // Call before the server starts; buckets keep the limits they were made with.
+    void configure(const RateLimit& perUser, const RateLimit& perIp, const double (&priorityCosts)[3]) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::copy(priorityCosts, priorityCosts + 3, costs);
+        // A bucket smaller than a message's cost would refuse it forever.
+        double largest = *std::max_element(costs, costs + 3);
+        userLimit = perUser;
+        userLimit.burst = std::max(userLimit.burst, largest);
+        ipLimit = perIp;
+        ipLimit.burst = std::max(ipLimit.burst, largest);
+    }
+
+    // Null when that limit is off.
+    std::shared_ptr<TokenBucket> userBucket(const std::string& username) {
+        return bucket(users, userLimit, username);
+    }
+
+    std::shared_ptr<TokenBucket> ipBucket(const std::string& ip) {
+        return bucket(addresses, ipLimit, ip);
+    }
+
+    // Tokens one MESSAGE of this priority takes.
+    double cost(DeliveryPriority level) const {
+        return level < PriorityControl ? costs[level] : 1;
+    }
+
+private:
+    using Buckets = std::unordered_map<std::string, std::shared_ptr<TokenBucket>>;
+
+    std::shared_ptr<TokenBucket> bucket(Buckets& buckets, const RateLimit& limit, const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!limit.enabled()) {
+            return nullptr;
+        }
+        std::shared_ptr<TokenBucket>& entry = buckets[key];
+        if (entry) {
+            return entry;
+        }
+        std::shared_ptr<TokenBucket> made = std::make_shared<TokenBucket>(limit);
+        entry = made;
+        if (++created % kPruneEvery == 0) {
+            prune(users);
+            prune(addresses);
+        }
+        return made;
+    }
+
+    static void prune(Buckets& buckets) {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = buckets.begin(); it != buckets.end(); ) {
+            if (it->second.use_count() == 1 && it->second->full(now)) {
+                it = buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::mutex mutex;
+    RateLimit userLimit;
+    RateLimit ipLimit;
+    double costs[3];
+    Buckets users;
+    Buckets addresses;
+    unsigned long long created;
+};
+
+#endif
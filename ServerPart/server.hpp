@@ -3,6 +3,7 @@
 
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -13,6 +14,14 @@
 #include <mutex>
 #include <atomic>
 #include <sstream>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <cstring>
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
@@ -21,6 +30,15 @@
 #include <QString>
 #include <QDateTime>
 
+#include "serverevents.hpp"
+#include "metrics.hpp"
+#include "messagetrace.hpp"
+#include "flightrecorder.hpp"
+#include "sqlprofiler.hpp"
+#include "trafficcapture.hpp"
+#include "channels.hpp"
+#include "outbound.hpp"
+#include "ratelimit.hpp"
 
 class Message {
 public:
@@ -28,50 +46,235 @@ public:
     std::string Sender;
     std::string Text;
     std::string Tag;
+    long long Id = 0;
 
     Message() = default;
     Message(const std::string& g, const std::string& s, const std::string& t, const std::string& tg)
         : Getter(g), Sender(s), Text(t), Tag(tg) {}
 
+    // The storage id travels as an optional fifth field; older readers stop after Tag.
     std::string getData() const {
-        return Sender + ";" + Getter + ";" + Text + ";" + Tag;
+        std::string data = Sender + ";" + Getter + ";" + Text + ";" + Tag;
+        if (Id > 0) {
+            data += ";" + std::to_string(Id);
+        }
+        return data;
     }
 
     static Message getMessage(const std::string& data) {
         std::istringstream ss(data);
-        std::string parts[4];
-        for (int i = 0; i < 4 && std::getline(ss, parts[i], ';'); ++i);
-        if (!parts[0].empty() && !parts[1].empty() && !parts[2].empty() && !parts[3].empty())
-            return Message(parts[1], parts[0], parts[2], parts[3]);
+        std::string parts[5];
+        for (int i = 0; i < 5 && std::getline(ss, parts[i], ';'); ++i);
+        if (!parts[0].empty() && !parts[1].empty() && !parts[2].empty() && !parts[3].empty()) {
+            Message msg(parts[1], parts[0], parts[2], parts[3]);
+            msg.Id = std::strtoll(parts[4].c_str(), nullptr, 10);
+            return msg;
+        }
         return Message();
     }
 };
 
+static const size_t kMaxFrameSize = 64 * 1024;
+static const int kSyncBatchSize = 500;
+static const int kMaxSessionsPerUser = 8;
+static const int kHistoryPageLimit = 200;
+static const std::chrono::hours kSessionTtl(12);
+
+// Per-connection counters. Written by the connection's handler thread and
+// by whichever thread sends to it; read without locks by the admin panel.
+struct Connection {
+    SOCKET socket = INVALID_SOCKET;
+    uint32_t id = 0;
+    std::string ip;
+    std::chrono::system_clock::time_point connectedAt;
+    std::atomic<unsigned long long> bytesIn{0};
+    std::atomic<unsigned long long> bytesOut{0};
+    std::atomic<unsigned long long> messagesIn{0};
+    std::atomic<unsigned long long> framesOut{0};
+    std::atomic<int> sendsInFlight{0};
+    std::atomic<long long> lastActivityMs{0};
+    // Newest message id this session has reported as read (READ:<id>).
+    std::atomic<long long> lastReadId{0};
+    OutboundQueue outbox;
+    // MESSAGE limits; only the connection's own handler thread uses these.
+    std::shared_ptr<TokenBucket> ipBucket;
+    std::shared_ptr<TokenBucket> userBucket;
+    // Set after a refused MESSAGE has been answered, cleared by the next
+    // accepted one.
+    bool refusalNotified = false;
+    // Set when the session is dropped (BAN): the socket is shut down once
+    // the frames already queued for it have been written.
+    std::atomic<bool> shutdownWhenDrained{false};
+};
+
+struct SessionInfo {
+    std::string username;
+    std::shared_ptr<const Connection> connection;
+};
+
+// Immutable once published; a new one replaces it on every login/logout.
+using SessionSnapshot = std::vector<SessionInfo>;
+
+// Server-wide numbers for scrapers; see MetricsExporter.
+struct ServerMetrics {
+    MetricsRegistry registry;
+    Counter& accepts;
+    Gauge& connections;
+    Counter& loginsSucceeded;
+    Counter& loginsInvalid;
+    Counter& loginsBanned;
+    Counter& loginsSessionLimit;
+    Counter& resumesSucceeded;
+    Counter& resumesFailed;
+    Counter& messagesIn;
+    Counter& messagesNoSession;
+    Counter& messagesSenderMismatch;
+    Counter& messagesOut;
+    Counter& bytesIn;
+    Counter& bytesOut;
+    Counter& framesOut;
+    Gauge& sendsInFlight;
+    Histogram& fanout;
+    Histogram& dbCommitMicros;
+    OutboundStats outbound;
+    // [0] per IP, [1] per user; by DeliveryPriority.
+    Counter* rateLimited[2][PriorityControl];
+
+    ServerMetrics()
+        : accepts(registry.counter("chat_accepts_total", "Accepted TCP connections."))
+        , connections(registry.gauge("chat_connections", "Open client connections."))
+        , loginsSucceeded(registry.counter("chat_logins_total", "LOGIN commands by outcome.", "result=\"success\""))
+        , loginsInvalid(registry.counter("chat_logins_total", "LOGIN commands by outcome.", "result=\"invalid\""))
+        , loginsBanned(registry.counter("chat_logins_total", "LOGIN commands by outcome.", "result=\"banned\""))
+        , loginsSessionLimit(registry.counter("chat_logins_total", "LOGIN commands by outcome.",
+                                              "result=\"session_limit\""))
+        , resumesSucceeded(registry.counter("chat_resumes_total", "RESUME commands by outcome.", "result=\"success\""))
+        , resumesFailed(registry.counter("chat_resumes_total", "RESUME commands by outcome.", "result=\"failed\""))
+        , messagesIn(registry.counter("chat_messages_in_total", "MESSAGE commands received."))
+        , messagesNoSession(registry.counter("chat_messages_refused_total", "MESSAGE commands refused before routing.",
+                                             "reason=\"no_session\""))
+        , messagesSenderMismatch(registry.counter("chat_messages_refused_total",
+                                                  "MESSAGE commands refused before routing.",
+                                                  "reason=\"sender_mismatch\""))
+        , messagesOut(registry.counter("chat_messages_out_total", "Live MESSAGE frames delivered to recipients."))
+        , bytesIn(registry.counter("chat_bytes_in_total", "Bytes received from clients."))
+        , bytesOut(registry.counter("chat_bytes_out_total", "Bytes sent to clients."))
+        , framesOut(registry.counter("chat_frames_out_total", "Frames sent to clients."))
+        , sendsInFlight(registry.gauge("chat_sends_in_flight", "send() calls currently blocked in the kernel."))
+        , fanout(registry.histogram("chat_fanout_recipients", "Recipients per routed message.", countBounds()))
+        , dbCommitMicros(registry.histogram("chat_db_commit_seconds", "Time to insert one message.",
+                                            latencyBoundsSeconds(), 1e-6)) {
+        for (int level = 0; level < PriorityLevels; ++level) {
+            std::string label = std::string("priority=\"") + kPriorityNames[level] + "\"";
+            if (level != PriorityControl) {
+                outbound.shed[level] = &registry.counter("chat_outbound_shed_total",
+                                                         "Frames dropped from full outbound queues.", label);
+            }
+            outbound.waitMicros[level] = &registry.histogram("chat_outbound_wait_seconds",
+                                                             "Time frames spent in outbound queues.",
+                                                             latencyBoundsSeconds(), 1e-6, label);
+        }
+        for (int scope = 0; scope < 2; ++scope) {
+            for (int level = 0; level < PriorityControl; ++level) {
+                rateLimited[scope][level] = &registry.counter(
+                    "chat_rate_limited_total", "MESSAGE commands refused by a rate limit.",
+                    std::string("scope=\"") + (scope ? "user" : "ip") + "\",priority=\"" + kPriorityNames[level] + "\"");
+            }
+        }
+        registerProcessMetrics(registry);
+    }
+};
+
 class ChatServer {
 private:
     SOCKET serverSocket;
     unsigned short port;
     std::atomic<bool> running;
-    std::vector<std::thread> clientThreads;
     std::mutex clientsMutex;
 
+    // One per connection; `done` is set as the handler returns so run() can
+    // join and drop finished threads instead of keeping one per connection
+    // ever accepted.
+    struct ClientThread {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::vector<ClientThread> clientThreads;
+    std::mutex threadsMutex;
+
     // Qt SQL Database
     QSqlDatabase db;
 
+    // Logged-in connections, indexed both ways: by socket for the commands
+    // a connection sends, by name for routing. One user may hold up to
+    // kMaxSessionsPerUser sessions, e.g. one per device.
     struct OnlineUser {
-        SOCKET socket;
         std::string username;
         std::string ip;
+        std::shared_ptr<Connection> connection;
     };
-    std::vector<OnlineUser> onlineUsers;
+    std::unordered_map<SOCKET, OnlineUser> sessionsBySocket;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Connection>>> sessionsByUser;
+    std::shared_ptr<const SessionSnapshot> liveSessions;
+
+    // Resumption tokens handed out on login so a reconnecting client
+    // can re-attach without resending credentials.
+    struct SessionToken {
+        std::string username;
+        std::chrono::steady_clock::time_point expiresAt;
+    };
+    std::unordered_map<std::string, SessionToken> sessionTokens;
+    std::mutex sessionsMutex;
+
+    // Live feed for the admin panel; optional, and never blocks the server.
+    ServerEventQueue* events;
+
+    // Inbound traffic recorder for Tools/Replay; optional, set before run().
+    TrafficCapture* capture;
+
+    ServerMetrics metrics;
+    MessageTracer tracer;
+    SqlProfiler sqlStats;
+    RateLimiter limiter;
+
+protected:
+    // Loaded from channel_members at startup and kept in step with it.
+    ChannelDirectory channels;
 
 public:
-    ChatServer(unsigned short port) : port(port), running(false) {
+    ChatServer(unsigned short port, ServerEventQueue* events = nullptr)
+        : serverSocket(INVALID_SOCKET), port(port), running(false),
+          liveSessions(std::make_shared<SessionSnapshot>()), events(events), capture(nullptr),
+          tracer(metrics.registry), sqlStats(metrics.registry) {
         WSADATA wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+        metrics.registry.callback("chat_online_users", "Logged-in sessions.", "gauge", [this] {
+            return (double)sessionSnapshot()->size();
+        });
+        metrics.registry.callback("chat_online_usernames", "Distinct users with at least one session.", "gauge", [this] {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            return (double)sessionsByUser.size();
+        });
+        metrics.registry.callback("chat_handler_threads", "Connection threads not yet joined.", "gauge", [this] {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            return (double)clientThreads.size();
+        });
+        metrics.registry.callback("chat_channels", "Channels with at least one member.", "gauge", [this] {
+            return (double)channels.channelCount();
+        });
+        metrics.registry.callback("chat_channel_memberships", "Channel memberships across all users.", "gauge", [this] {
+            return (double)channels.membershipCount();
+        });
+        if (events) {
+            metrics.registry.callback("chat_event_queue_depth", "Events waiting for the admin panel.", "gauge",
+                                      [events] { return (double)events->size(); });
+            metrics.registry.callback("chat_event_queue_dropped_total", "Events dropped on a full queue.", "counter",
+                                      [events] { return (double)events->dropped(); });
+        }
     }
 
-    ~ChatServer() {
+    virtual ~ChatServer() {
         stop();
         if (db.isOpen()) {
             db.close();
@@ -118,187 +321,910 @@ public:
             if (clientSocket == INVALID_SOCKET) {
                 continue;
             }
+            metrics.accepts.inc();
 
-            clientThreads.emplace_back(&ChatServer::handleClient, this, clientSocket);
+            auto done = std::make_shared<std::atomic<bool>>(false);
+            std::thread thread([this, clientSocket, done] {
+                handleClient(clientSocket);
+                done->store(true, std::memory_order_release);
+            });
+
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            reapFinishedThreadsLocked();
+            clientThreads.push_back(ClientThread{std::move(thread), done});
         }
     }
 
+    // Lock-free: returns the list published at the last login/logout. The
+    // counters inside are live atomics, so re-reading them on the same
+    // snapshot shows current traffic.
+    std::shared_ptr<const SessionSnapshot> sessionSnapshot() const {
+        return std::atomic_load(&liveSessions);
+    }
+
+    MetricsRegistry& metricsRegistry() {
+        return metrics.registry;
+    }
+
+    MessageTracer& messageTracer() {
+        return tracer;
+    }
+
+    SqlProfiler& sqlProfiler() {
+        return sqlStats;
+    }
+
+    RateLimiter& rateLimiter() {
+        return limiter;
+    }
+
+    void setTrafficCapture(TrafficCapture* recorder) {
+        capture = recorder;
+        metrics.registry.callback("chat_capture_records_total", "Records written to the traffic capture.", "counter",
+                                  [recorder] { return (double)recorder->records(); });
+        metrics.registry.callback("chat_capture_dropped_total", "Capture records lost to a full queue.", "counter",
+                                  [recorder] { return (double)recorder->dropped(); });
+    }
+
     void stop() {
         running = false;
         closesocket(serverSocket);
 
-        for (auto& thread : clientThreads) {
-            if (thread.joinable()) {
-                thread.join();
+        std::vector<ClientThread> threads;
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.swap(clientThreads);
+        }
+        for (auto& client : threads) {
+            if (client.thread.joinable()) {
+                client.thread.join();
             }
         }
-        clientThreads.clear();
     }
 
 private:
+    // Joins handlers that have already returned; callers hold threadsMutex.
+    void reapFinishedThreadsLocked() {
+        auto finished = std::partition(clientThreads.begin(), clientThreads.end(), [](const ClientThread& client) {
+            return !client.done->load(std::memory_order_acquire);
+        });
+        for (auto it = finished; it != clientThreads.end(); ++it) {
+            it->thread.join();
+        }
+        clientThreads.erase(finished, clientThreads.end());
+    }
+
     void handleClient(SOCKET clientSocket) {
         char buffer[4096];
+        std::string pending;
+
+        auto conn = std::make_shared<Connection>();
+        conn->socket = clientSocket;
+        conn->connectedAt = std::chrono::system_clock::now();
+
+        char clientIP[INET_ADDRSTRLEN] = "";
+        sockaddr_in addr;
+        int addrLen = sizeof(addr);
+        if (getpeername(clientSocket, (sockaddr*)&addr, &addrLen) == 0) {
+            inet_ntop(AF_INET, &addr.sin_addr, clientIP, INET_ADDRSTRLEN);
+        }
+        conn->ip = clientIP;
+        conn->id = FlightRecorder::instance().nextConnectionId();
+        conn->ipBucket = limiter.ipBucket(conn->ip);
+        metrics.connections.inc();
+        flightRecord(FlightConnectionOpened, conn->id);
+        if (capture) capture->connectionOpened(conn->id);
 
         try {
             while (running) {
-                int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
+                int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
                 if (bytesReceived <= 0) {
                     break;
                 }
+                auto receivedAt = std::chrono::steady_clock::now();
+                conn->bytesIn.fetch_add((unsigned long long)bytesReceived, std::memory_order_relaxed);
+                metrics.bytesIn.inc((uint64_t)bytesReceived);
+                flightRecord(FlightBytesReceived, conn->id, (uint32_t)bytesReceived);
+                conn->lastActivityMs.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
 
-                buffer[bytesReceived] = '\0';
-                std::string messageData(buffer);
-
-                if (messageData.find("LOGIN:") == 0) {
-                    std::string credentials = messageData.substr(6);
-                    size_t pos = credentials.find(':');
-                    if (pos != std::string::npos) {
-                        std::string username = credentials.substr(0, pos);
-                        std::string password = credentials.substr(pos + 1);
-
-                        if (authenticateUser(username, password)) {
-                            if (isUserBanned(username)) {
-                                std::string response = "BANNED:User is banned";
-                                send(clientSocket, response.c_str(), response.length(), 0);
-                            } else {
-                                OnlineUser onlineUser;
-                                onlineUser.socket = clientSocket;
-                                onlineUser.username = username;
-
-                                char clientIP[INET_ADDRSTRLEN];
-                                sockaddr_in addr;
-                                int addrLen = sizeof(addr);
-                                getpeername(clientSocket, (sockaddr*)&addr, &addrLen);
-                                inet_ntop(AF_INET, &addr.sin_addr, clientIP, INET_ADDRSTRLEN);
-                                onlineUser.ip = clientIP;
-
-                                {
-                                    std::lock_guard<std::mutex> lock(clientsMutex);
-                                    onlineUsers.push_back(onlineUser);
-                                }
-
-                                std::string response = "LOGIN_SUCCESS:" + username;
-                                send(clientSocket, response.c_str(), response.length(), 0);
-                                sendUserList(clientSocket);
-                            }
-                        } else {
-                            std::string response = "LOGIN_FAILED:Invalid credentials";
-                            send(clientSocket, response.c_str(), response.length(), 0);
-                        }
-                    }
-                }
-                else if (messageData.find("REGISTER:") == 0) {
-                    std::string data = messageData.substr(9);
-                    size_t pos1 = data.find(':');
-                    size_t pos2 = data.find(':', pos1 + 1);
-
-                    if (pos1 != std::string::npos && pos2 != std::string::npos) {
-                        std::string username = data.substr(0, pos1);
-                        std::string password = data.substr(pos1 + 1, pos2 - pos1 - 1);
-                        std::string name = data.substr(pos2 + 1);
-
-                        if (registerUser(username, password, name)) {
-                            std::string response = "REGISTER_SUCCESS";
-                            send(clientSocket, response.c_str(), response.length(), 0);
-                        } else {
-                            std::string response = "REGISTER_FAILED:Username exists";
-                            send(clientSocket, response.c_str(), response.length(), 0);
-                        }
-                    }
+                pending.append(buffer, bytesReceived);
+                dispatchCommands(conn, pending, receivedAt);
+
+                if (pending.size() > kMaxFrameSize) {
+                    break;
                 }
-                else if (messageData.find("MESSAGE:") == 0) {
-                    std::string data = messageData.substr(8);
-                    Message msg = Message::getMessage(data);
+            }
+        }
+        catch (...) {
+            flightRecord(FlightHandlerException, conn->id);
+        }
+
+        std::string loggedOut;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            loggedOut = removeSessionLocked(*conn);
+            if (!loggedOut.empty()) {
+                publishSessionsLocked();
+            }
+        }
+        if (!loggedOut.empty()) {
+            flightRecord(FlightLoggedOut, conn->id);
+            publishUserEvent(ServerEvent::UserLoggedOut, loggedOut);
+        }
+
+        closesocket(clientSocket);
+        metrics.connections.dec();
+        flightRecord(FlightConnectionClosed, conn->id, (uint32_t)pending.size());
+        if (capture) capture->connectionClosed(conn->id);
+    }
 
-                    if (!isUserBanned(msg.Sender)) {
-                        processMessage(msg);
-                        logMessage(msg);
+protected:
+    // Commands are '\n'-terminated; a recv may carry several or a partial one.
+    // Handles every complete command and leaves the partial tail in `pending`.
+    void dispatchCommands(const std::shared_ptr<Connection>& conn, std::string& pending,
+                          std::chrono::steady_clock::time_point receivedAt) {
+        size_t start = 0;
+        size_t pos;
+        while ((pos = pending.find('\n', start)) != std::string::npos) {
+            handleCommand(conn, pending.substr(start, pos - start), receivedAt);
+            start = pos + 1;
+        }
+        pending.erase(0, start);
+    }
+
+    void handleCommand(const std::shared_ptr<Connection>& conn, const std::string& messageData,
+                       std::chrono::steady_clock::time_point receivedAt) {
+        flightRecord(FlightCommand, conn->id, (uint32_t)messageData.size(), flightCommandKind(messageData));
+        if (capture) capture->command(conn->id, messageData, receivedAt);
+
+        if (messageData.find("LOGIN:") == 0) {
+            std::string credentials = messageData.substr(6);
+            size_t pos = credentials.find(':');
+            if (pos != std::string::npos) {
+                std::string username = credentials.substr(0, pos);
+                std::string password = credentials.substr(pos + 1);
+
+                if (authenticateUser(username, password)) {
+                    if (isUserBanned(username)) {
+                        metrics.loginsBanned.inc();
+                        flightRecord(FlightLoginRejected, conn->id, 0, 1);
+                        sendFrame(*conn, "BANNED:User is banned");
+                    } else if (!addOnlineUser(conn, username)) {
+                        metrics.loginsSessionLimit.inc();
+                        flightRecord(FlightLoginRejected, conn->id, 0, 2);
+                        sendFrame(*conn, "LOGIN_FAILED:Too many sessions");
+                    } else {
+                        metrics.loginsSucceeded.inc();
+                        flightRecord(FlightLoggedIn, conn->id);
+                        sendFrame(*conn, "LOGIN_SUCCESS:" + username);
+                        sendFrame(*conn, "SESSION:" + issueSessionToken(username) + ":" +
+                                                std::to_string(latestMessageId()));
+                        sendUserList(*conn);
+                        sendChannelList(*conn, username);
                     }
+                } else {
+                    metrics.loginsInvalid.inc();
+                    flightRecord(FlightLoginRejected, conn->id, 0, 0);
+                    sendFrame(*conn, "LOGIN_FAILED:Invalid credentials");
                 }
-                else if (messageData == "GET_USERS") {
-                    sendUserList(clientSocket);
+            }
+        }
+        else if (messageData.find("RESUME:") == 0) {
+            std::string data = messageData.substr(7);
+            size_t pos = data.find(':');
+            if (pos != std::string::npos) {
+                std::string username = data.substr(0, pos);
+                std::string token = data.substr(pos + 1);
+
+                if (!validateSessionToken(username, token)) {
+                    metrics.resumesFailed.inc();
+                    sendFrame(*conn, "RESUME_FAILED:Unknown session");
+                } else if (isUserBanned(username)) {
+                    metrics.resumesFailed.inc();
+                    sendFrame(*conn, "BANNED:User is banned");
+                } else if (!addOnlineUser(conn, username)) {
+                    metrics.resumesFailed.inc();
+                    sendFrame(*conn, "RESUME_FAILED:Too many sessions");
+                } else {
+                    metrics.resumesSucceeded.inc();
+                    flightRecord(FlightLoggedIn, conn->id, 0, 1);
+                    sendFrame(*conn, "RESUME_SUCCESS:" + username);
+                    sendUserList(*conn);
+                    sendChannelList(*conn, username);
                 }
-                else if (messageData.find("BAN:") == 0) {
-                    std::string username = messageData.substr(4);
-                    if (banUser(username)) {
-                        std::lock_guard<std::mutex> lock(clientsMutex);
-                        for (auto it = onlineUsers.begin(); it != onlineUsers.end(); ) {
-                            if (it->username == username) {
-                                std::string banMsg = "BANNED:You have been banned";
-                                send(it->socket, banMsg.c_str(), banMsg.length(), 0);
-                                closesocket(it->socket);
-                                it = onlineUsers.erase(it);
-                            } else {
-                                ++it;
-                            }
+            }
+        }
+        else if (messageData.find("SYNC:") == 0) {
+            std::string username = onlineUsername(*conn);
+            if (!username.empty()) {
+                long long sinceId = std::strtoll(messageData.c_str() + 5, nullptr, 10);
+                sendMissedMessages(*conn, username, sinceId);
+            }
+        }
+        else if (messageData.find("HISTORY:") == 0) {
+            std::string username = onlineUsername(*conn);
+            std::string data = messageData.substr(8);
+            size_t pos = data.find(':');
+            if (!username.empty() && pos != std::string::npos) {
+                long long beforeId = std::strtoll(data.c_str(), nullptr, 10);
+                int count = std::atoi(data.c_str() + pos + 1);
+                sendHistoryPage(*conn, username, beforeId, count);
+            }
+        }
+        else if (messageData.find("JOIN:") == 0) {
+            std::string username = onlineUsername(*conn);
+            std::string channel = messageData.substr(5);
+            if (username.empty()) {
+                return;
+            }
+            if (!isChannelName(channel)) {
+                sendFrame(*conn, "CHANNEL_FAILED:" + channel + ":Invalid channel name");
+            } else if (channels.isMember(channel, username) || joinChannel(channel, username)) {
+                sendFrame(*conn, "JOINED:" + channel);
+            } else {
+                sendFrame(*conn, "CHANNEL_FAILED:" + channel + ":Join failed");
+            }
+        }
+        else if (messageData.find("LEAVE:") == 0) {
+            std::string username = onlineUsername(*conn);
+            std::string channel = messageData.substr(6);
+            if (!username.empty() && (!channels.isMember(channel, username) || leaveChannel(channel, username))) {
+                sendFrame(*conn, "LEFT:" + channel);
+            }
+        }
+        else if (messageData.find("CHANNEL_HISTORY:") == 0) {
+            std::string username = onlineUsername(*conn);
+            std::string data = messageData.substr(16);
+            size_t pos1 = data.find(':');
+            size_t pos2 = pos1 == std::string::npos ? pos1 : data.find(':', pos1 + 1);
+            if (username.empty() || pos2 == std::string::npos) {
+                return;
+            }
+            std::string channel = data.substr(0, pos1);
+            if (!channels.isMember(channel, username)) {
+                sendFrame(*conn, "CHANNEL_FAILED:" + channel + ":Not a member");
+            } else {
+                long long beforeId = std::strtoll(data.c_str() + pos1 + 1, nullptr, 10);
+                int count = std::atoi(data.c_str() + pos2 + 1);
+                sendChannelHistoryPage(*conn, channel, beforeId, count);
+            }
+        }
+        else if (messageData.find("REGISTER:") == 0) {
+            std::string data = messageData.substr(9);
+            size_t pos1 = data.find(':');
+            size_t pos2 = data.find(':', pos1 + 1);
+
+            if (pos1 != std::string::npos && pos2 != std::string::npos) {
+                std::string username = data.substr(0, pos1);
+                std::string password = data.substr(pos1 + 1, pos2 - pos1 - 1);
+                std::string name = data.substr(pos2 + 1);
+
+                if (registerUser(username, password, name)) {
+                    sendFrame(*conn, "REGISTER_SUCCESS");
+                    ServerEvent event = makeEvent(ServerEvent::UserRegistered, username);
+                    event.name = name;
+                    publish(std::move(event));
+                } else {
+                    sendFrame(*conn, "REGISTER_FAILED:Username exists");
+                }
+            }
+        }
+        else if (messageData.find("MESSAGE:") == 0) {
+            conn->messagesIn.fetch_add(1, std::memory_order_relaxed);
+            metrics.messagesIn.inc();
+            std::string sessionUser;
+            if (!admitMessage(*conn, messageData, sessionUser)) {
+                return;
+            }
+
+            std::unique_ptr<MessageTrace> trace;
+            if (tracer.shouldSample()) {
+                trace.reset(new MessageTrace);
+                trace->received = receivedAt;
+                trace->bytes = messageData.size();
+            }
+
+            std::string data = messageData.substr(8);
+            Message msg = Message::getMessage(data);
+            if (trace) trace->mark(MessageTrace::Parsed);
+            if (msg.Sender != sessionUser) {
+                metrics.messagesSenderMismatch.inc();
+                refuseMessage(*conn, "MESSAGE_FAILED:Sender does not match session");
+                return;
+            }
+
+            bool banned = isUserBanned(sessionUser);
+            if (trace) trace->mark(MessageTrace::BanChecked);
+
+            if (!banned && isChannelName(msg.Getter) && !channels.isMember(msg.Getter, sessionUser)) {
+                sendFrame(*conn, "CHANNEL_FAILED:" + msg.Getter + ":Not a member");
+            } else if (!banned) {
+                msg.Id = logMessage(msg);
+                if (trace) trace->mark(MessageTrace::Logged);
+                flightRecord(FlightMessageLogged, conn->id, (uint32_t)msg.Text.size(), (uint32_t)msg.Id);
+                processMessage(msg, trace.get());
+                // Tells the sender which id its message was stored under.
+                if (msg.Id > 0) {
+                    sendFrame(*conn, "SENT:" + msg.getData());
+                }
+
+                ServerEvent event = makeEvent(ServerEvent::MessageRouted, msg.Sender);
+                event.messageId = msg.Id;
+                event.getter = msg.Getter;
+                event.text = msg.Text;
+                event.tag = msg.Tag;
+                publish(std::move(event));
+            }
+
+            if (trace) {
+                trace->messageId = msg.Id;
+                trace->sender = msg.Sender;
+                trace->getter = msg.Getter;
+                tracer.finish(*trace);
+            }
+        }
+        else if (messageData.find("READ:") == 0) {
+            markRead(conn, std::strtoll(messageData.c_str() + 5, nullptr, 10));
+        }
+        else if (messageData == "GET_USERS") {
+            sendUserList(*conn);
+        }
+        else if (messageData.find("BAN:") == 0) {
+            std::string username = messageData.substr(4);
+            if (banUser(username)) {
+                publishUserEvent(ServerEvent::UserBanned, username);
+
+                std::vector<std::shared_ptr<Connection>> sessions;
+                std::vector<std::shared_ptr<Connection>> claimed;
+                {
+                    std::lock_guard<std::mutex> lock(clientsMutex);
+                    auto online = sessionsByUser.find(username);
+                    if (online != sessionsByUser.end()) {
+                        sessions = online->second;
+                        SharedFrame frame = std::make_shared<const std::string>("BANNED:You have been banned\n");
+                        for (const auto& session : sessions) {
+                            // Set before queueing so whichever thread drains
+                            // the BANNED frame sees it.
+                            session->shutdownWhenDrained = true;
+                            queueFrame(session, frame, PriorityControl, claimed);
+                            flightRecord(FlightLoggedOut, session->id, 0, 1);
+                            removeSessionLocked(*session);
+                            publishUserEvent(ServerEvent::UserLoggedOut, username);
                         }
+                        publishSessionsLocked();
                     }
                 }
-                else if (messageData.find("UNBAN:") == 0) {
-                    std::string username = messageData.substr(6);
-                    unbanUser(username);
+                flushClaimed(claimed);
+                // A drainer still busy shuts the session down itself once
+                // BANNED is written; an idle or failed outbox is ours to end.
+                for (const auto& session : sessions) {
+                    if (session->outbox.idle()) {
+                        shutdown(session->socket, SD_BOTH);
+                    }
                 }
             }
         }
-        catch (...) {
+        else if (messageData.find("UNBAN:") == 0) {
+            std::string username = messageData.substr(6);
+            if (unbanUser(username)) {
+                publishUserEvent(ServerEvent::UserUnbanned, username);
+            }
+        }
+    }
+
+private:
+    // Runs on the raw command, before it is parsed, logged or routed. Only
+    // logged-in connections may send, and `sessionUser` is who the session
+    // belongs to; the user bucket was handed out for that name at login.
+    // The Tag sets the cost.
+    bool admitMessage(Connection& conn, const std::string& messageData, std::string& sessionUser) {
+        sessionUser = onlineUsername(conn);
+        if (sessionUser.empty()) {
+            metrics.messagesNoSession.inc();
+            refuseMessage(conn, "MESSAGE_FAILED:Not logged in");
+            return false;
+        }
+        if (!conn.ipBucket && !conn.userBucket) {
+            conn.refusalNotified = false;
+            return true;
+        }
+        DeliveryPriority level = priorityOfTag(commandTag(messageData));
+        double cost = limiter.cost(level);
+        auto now = std::chrono::steady_clock::now();
+
+        int scope = -1;
+        if (conn.ipBucket && !conn.ipBucket->tryTake(cost, now)) {
+            scope = 0;
+        } else if (conn.userBucket && !conn.userBucket->tryTake(cost, now)) {
+            if (conn.ipBucket) conn.ipBucket->giveBack(cost);
+            scope = 1;
+        }
+        if (scope < 0) {
+            conn.refusalNotified = false;
+            return true;
         }
 
+        metrics.rateLimited[scope][level]->inc();
+        flightRecord(FlightRateLimited, conn.id, (uint32_t)messageData.size(), (uint32_t)(scope << 8 | level));
+        refuseMessage(conn, scope ? "RATE_LIMITED:user" : "RATE_LIMITED:ip");
+        return false;
+    }
+
+    // Only the first refusal in a row is answered, so a flood gets one
+    // reply rather than one per command.
+    void refuseMessage(Connection& conn, const std::string& reply) {
+        if (!conn.refusalNotified) {
+            conn.refusalNotified = true;
+            sendFrame(conn, reply);
+        }
+    }
+
+    // Fourth ';'-separated field of MESSAGE:Sender;Getter;Text;Tag[;Id].
+    static std::string commandTag(const std::string& messageData) {
+        size_t start = 8;
+        for (int field = 0; field < 3; ++field) {
+            start = messageData.find(';', start);
+            if (start == std::string::npos) {
+                return std::string();
+            }
+            ++start;
+        }
+        size_t end = messageData.find(';', start);
+        return messageData.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    }
+
+    static uint32_t flightCommandKind(const std::string& messageData) {
+        static const struct { const char* prefix; FlightCommandKind kind; } kinds[] = {
+            {"MESSAGE:", FlightCmdMessage}, {"LOGIN:", FlightCmdLogin}, {"RESUME:", FlightCmdResume},
+            {"SYNC:", FlightCmdSync}, {"HISTORY:", FlightCmdHistory}, {"REGISTER:", FlightCmdRegister},
+            {"GET_USERS", FlightCmdGetUsers}, {"BAN:", FlightCmdBan}, {"UNBAN:", FlightCmdUnban},
+            {"JOIN:", FlightCmdJoin}, {"LEAVE:", FlightCmdLeave}, {"CHANNEL_HISTORY:", FlightCmdChannelHistory},
+            {"READ:", FlightCmdRead}
+        };
+        for (const auto& entry : kinds) {
+            if (messageData.compare(0, std::strlen(entry.prefix), entry.prefix) == 0) {
+                return entry.kind;
+            }
+        }
+        return FlightCmdUnknown;
+    }
+
+protected:
+    // False when the user already holds kMaxSessionsPerUser sessions. A
+    // second login on the same connection replaces the first.
+    bool addOnlineUser(const std::shared_ptr<Connection>& conn, const std::string& username) {
         {
             std::lock_guard<std::mutex> lock(clientsMutex);
-            for (auto it = onlineUsers.begin(); it != onlineUsers.end(); ) {
-                if (it->socket == clientSocket) {
-                    it = onlineUsers.erase(it);
-                    break;
-                } else {
-                    ++it;
+            bool replaced = !removeSessionLocked(*conn).empty();
+            auto& sessions = sessionsByUser[username];
+            if (sessions.size() >= (size_t)kMaxSessionsPerUser) {
+                if (replaced) {
+                    publishSessionsLocked();
                 }
+                return false;
             }
+            sessions.push_back(conn);
+            sessionsBySocket[conn->socket] = OnlineUser{username, conn->ip, conn};
+            publishSessionsLocked();
         }
+        conn->userBucket = limiter.userBucket(username);
 
-        closesocket(clientSocket);
+        ServerEvent event = makeEvent(ServerEvent::UserLoggedIn, username);
+        event.ip = conn->ip;
+        publish(std::move(event));
+        return true;
     }
 
-    void processMessage(const Message& msg) {
+    // Records how far this session has read and tells the user's other
+    // sessions, so what was read on one device is not unread on another.
+    void markRead(const std::shared_ptr<Connection>& conn, long long messageId) {
+        std::vector<std::shared_ptr<Connection>> claimed;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            auto online = sessionsBySocket.find(conn->socket);
+            if (online == sessionsBySocket.end() || online->second.connection != conn ||
+                messageId <= conn->lastReadId.load(std::memory_order_relaxed)) {
+                return;
+            }
+            conn->lastReadId.store(messageId, std::memory_order_relaxed);
+
+            SharedFrame frame = std::make_shared<const std::string>("READ:" + std::to_string(messageId) + "\n");
+            for (const auto& session : sessionsByUser[online->second.username]) {
+                if (session != conn) {
+                    queueFrame(session, frame, PriorityLow, claimed);
+                }
+            }
+        }
+        flushClaimed(claimed);
+    }
+
+    // Persists first so the index never holds a membership the database lost.
+    bool joinChannel(const std::string& channel, const std::string& username) {
+        if (!saveChannelMember(channel, username)) {
+            return false;
+        }
+        channels.join(channel, username);
+        return true;
+    }
+
+    bool leaveChannel(const std::string& channel, const std::string& username) {
+        if (!deleteChannelMember(channel, username)) {
+            return false;
+        }
+        channels.leave(channel, username);
+        return true;
+    }
+
+private:
+    // Returns the user the connection was logged in as, or "" if it was not.
+    // Matches on the Connection, not just the socket: a closed socket's
+    // handle may already belong to a newer connection. Callers hold
+    // clientsMutex and republish the snapshot.
+    std::string removeSessionLocked(const Connection& conn) {
+        auto online = sessionsBySocket.find(conn.socket);
+        if (online == sessionsBySocket.end() || online->second.connection.get() != &conn) {
+            return std::string();
+        }
+        std::string username = online->second.username;
+        sessionsBySocket.erase(online);
+
+        auto it = sessionsByUser.find(username);
+        auto& sessions = it->second;
+        sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [&conn](const std::shared_ptr<Connection>& c) {
+            return c.get() == &conn;
+        }), sessions.end());
+        if (sessions.empty()) {
+            sessionsByUser.erase(it);
+        }
+        return username;
+    }
+
+    // Rebuilds the published session list; callers hold clientsMutex.
+    void publishSessionsLocked() {
+        auto snapshot = std::make_shared<SessionSnapshot>();
+        snapshot->reserve(sessionsBySocket.size());
+        for (const auto& online : sessionsBySocket) {
+            snapshot->push_back(SessionInfo{online.second.username, online.second.connection});
+        }
+        std::atomic_store(&liveSessions, std::shared_ptr<const SessionSnapshot>(std::move(snapshot)));
+    }
+
+    ServerEvent makeEvent(ServerEvent::Type type, const std::string& username) const {
+        ServerEvent event;
+        event.type = type;
+        event.username = username;
+        event.time = std::chrono::system_clock::now();
+        return event;
+    }
+
+    void publish(ServerEvent event) {
+        if (events) {
+            events->tryPush(std::move(event));
+        }
+    }
+
+    void publishUserEvent(ServerEvent::Type type, const std::string& username) {
+        if (events) {
+            events->tryPush(makeEvent(type, username));
+        }
+    }
+
+    std::string onlineUsername(const Connection& conn) {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        auto online = sessionsBySocket.find(conn.socket);
+        if (online == sessionsBySocket.end() || online->second.connection.get() != &conn) {
+            return std::string();
+        }
+        return online->second.username;
+    }
+
+    std::string issueSessionToken(const std::string& username) {
+        static thread_local std::mt19937_64 rng(std::random_device{}() ^
+            (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count());
+        static const char hex[] = "0123456789abcdef";
+
+        std::string token;
+        for (int i = 0; i < 2; ++i) {
+            unsigned long long bits = rng();
+            for (int j = 0; j < 16; ++j) {
+                token.push_back(hex[bits & 0xF]);
+                bits >>= 4;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        for (auto it = sessionTokens.begin(); it != sessionTokens.end(); ) {
+            if (it->second.expiresAt <= now) {
+                it = sessionTokens.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        sessionTokens[token] = SessionToken{username, now + kSessionTtl};
+        return token;
+    }
+
+    bool validateSessionToken(const std::string& username, const std::string& token) {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = sessionTokens.find(token);
+        if (it == sessionTokens.end() || it->second.username != username) {
+            return false;
+        }
+        if (it->second.expiresAt <= std::chrono::steady_clock::now()) {
+            sessionTokens.erase(it);
+            return false;
+        }
+        it->second.expiresAt = std::chrono::steady_clock::now() + kSessionTtl;
+        return true;
+    }
+
+    // Replays messages the user missed while disconnected, oldest first.
+    // SYNC_DONE carries the last id sent and whether another batch is pending.
+    void sendMissedMessages(Connection& conn, const std::string& username, long long sinceId) {
+        std::vector<Message> missed = loadMessagesSince(username, sinceId, kSyncBatchSize);
+
+        long long lastId = sinceId;
+        for (const auto& msg : missed) {
+            sendFrame(conn, "MESSAGE:" + msg.getData());
+            lastId = msg.Id;
+        }
+
+        bool hasMore = missed.size() == (size_t)kSyncBatchSize;
+        sendFrame(conn, "SYNC_DONE:" + std::to_string(lastId) + ":" + (hasMore ? "1" : "0"));
+    }
+
+    // Pages backwards through the user's conversation, newest first.
+    // beforeId == 0 starts from the most recent message.
+    void sendHistoryPage(Connection& conn, const std::string& username, long long beforeId, int count) {
+        count = std::max(1, std::min(count, kHistoryPageLimit));
+        std::vector<Message> page = loadHistoryBefore(username, beforeId, count);
+
+        for (const auto& msg : page) {
+            sendFrame(conn, "HISTORY:" + msg.getData());
+        }
+        sendFrame(conn, std::string("HISTORY_DONE:") + (page.size() == (size_t)count ? "1" : "0"));
+    }
+
+    // Same frames as sendHistoryPage, restricted to one channel.
+    void sendChannelHistoryPage(Connection& conn, const std::string& channel, long long beforeId, int count) {
+        count = std::max(1, std::min(count, kHistoryPageLimit));
+        std::vector<Message> page = loadChannelHistoryBefore(channel, beforeId, count);
+
+        for (const auto& msg : page) {
+            sendFrame(conn, "HISTORY:" + msg.getData());
+        }
+        sendFrame(conn, std::string("HISTORY_DONE:") + (page.size() == (size_t)count ? "1" : "0"));
+    }
+
+    void sendChannelList(Connection& conn, const std::string& username) {
+        std::string list = "CHANNELS:";
+        for (const auto& channel : channels.channelsOf(username)) {
+            list += channel + ",";
+        }
+        if (list.back() == ',') {
+            list.pop_back();
+        }
+        sendFrame(conn, list);
+    }
+
+    void sendFrame(Connection& conn, const std::string& payload) {
+        sendRaw(conn, payload + "\n");
+    }
+
+    // Everything for a connection goes through its outbox so concurrent
+    // senders never interleave bytes on the socket.
+    void sendRaw(Connection& conn, const std::string& frame) {
+        if (conn.outbox.push(std::make_shared<const std::string>(frame), PriorityControl, metrics.outbound)) {
+            flushOutbox(conn);
+        }
+    }
+
+    // For routing under clientsMutex: connections this thread has to drain
+    // are collected and flushed once the lock is released.
+    void queueFrame(const std::shared_ptr<Connection>& conn, const SharedFrame& frame, DeliveryPriority level,
+                    std::vector<std::shared_ptr<Connection>>& claimed) {
+        if (conn->outbox.push(frame, level, metrics.outbound)) {
+            claimed.push_back(conn);
+        }
+    }
+
+    void flushClaimed(const std::vector<std::shared_ptr<Connection>>& claimed) {
+        for (const auto& conn : claimed) {
+            flushOutbox(*conn);
+        }
+    }
+
+    void flushOutbox(Connection& conn) {
+        std::string batch;
+        int frames;
+        while (conn.outbox.takeBatch(batch, frames, metrics.outbound)) {
+            if (!writeBatch(conn, batch, frames)) {
+                conn.outbox.fail();
+            }
+        }
+        // shutdown() ends the handler's recv() loop; the handler thread owns
+        // the socket and does the only closesocket().
+        if (conn.shutdownWhenDrained) {
+            shutdown(conn.socket, SD_BOTH);
+        }
+    }
+
+    // All writes go through here so the per-connection counters stay exact.
+    bool writeBatch(Connection& conn, const std::string& batch, int frames) {
+        conn.sendsInFlight.fetch_add(1, std::memory_order_relaxed);
+        metrics.sendsInFlight.inc();
+        size_t offset = 0;
+        while (offset < batch.size()) {
+            int sent = sendToSocket(conn, batch.data() + offset, (int)(batch.size() - offset));
+            if (sent <= 0) {
+                break;
+            }
+            offset += (size_t)sent;
+        }
+        metrics.sendsInFlight.dec();
+        conn.sendsInFlight.fetch_sub(1, std::memory_order_relaxed);
+
+        conn.bytesOut.fetch_add((unsigned long long)offset, std::memory_order_relaxed);
+        metrics.bytesOut.inc((uint64_t)offset);
+        if (offset < batch.size()) {
+            flightRecord(FlightSendFailed, conn.id, (uint32_t)batch.size(), (uint32_t)WSAGetLastError());
+            return false;
+        }
+        conn.framesOut.fetch_add((unsigned long long)frames, std::memory_order_relaxed);
+        metrics.framesOut.inc((uint64_t)frames);
+        flightRecord(FlightFrameSent, conn.id, (uint32_t)batch.size(), (uint32_t)frames);
+        return true;
+    }
+
+protected:
+    // The one place bytes leave the process; benchmarks replace it with an
+    // in-memory sink to time routing without the kernel.
+    virtual int sendToSocket(Connection& conn, const char* data, int length) {
+        return send(conn.socket, data, length, 0);
+    }
+
+    // `trace` is null unless the message was sampled by the tracer.
+    void processMessage(const Message& msg, MessageTrace* trace = nullptr) {
         if (msg.Getter == "ALL") {
-            broadcastMessage(msg, msg.Sender);
+            broadcastMessage(msg, msg.Sender, trace);
+        } else if (isChannelName(msg.Getter)) {
+            channelMessage(msg, trace);
         } else {
+            // Every session of the recipient gets the same encoded frame.
+            int recipients = 0;
+            std::vector<std::shared_ptr<Connection>> claimed;
+            {
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                auto online = sessionsByUser.find(msg.Getter);
+                if (trace) trace->mark(MessageTrace::Routed);
+                if (online != sessionsByUser.end()) {
+                    SharedFrame frame = std::make_shared<const std::string>("MESSAGE:" + msg.getData() + "\n");
+                    DeliveryPriority level = priorityOfTag(msg.Tag);
+                    for (const auto& session : online->second) {
+                        auto queueStarted = std::chrono::steady_clock::now();
+                        queueFrame(session, frame, level, claimed);
+                        ++recipients;
+                        if (trace) traceEnqueue(*trace, queueStarted, recipients);
+                    }
+                }
+            }
+            flushClaimed(claimed);
+            metrics.fanout.record(recipients);
+            metrics.messagesOut.inc(recipients);
+        }
+    }
+
+    void broadcastMessage(const Message& msg, const std::string& excludeUser, MessageTrace* trace = nullptr) {
+        SharedFrame messageData = std::make_shared<const std::string>("MESSAGE:" + msg.getData() + "\n");
+        DeliveryPriority level = priorityOfTag(msg.Tag);
+
+        int recipients = 0;
+        std::vector<std::shared_ptr<Connection>> claimed;
+        {
             std::lock_guard<std::mutex> lock(clientsMutex);
-            for (const auto& user : onlineUsers) {
-                if (user.username == msg.Getter) {
-                    std::string messageData = "MESSAGE:" + msg.getData();
-                    send(user.socket, messageData.c_str(), messageData.length(), 0);
-                    break;
+            if (trace) trace->mark(MessageTrace::Routed);
+
+            for (const auto& online : sessionsBySocket) {
+                const OnlineUser& user = online.second;
+                if (user.username == excludeUser) {
+                    continue;
+                }
+
+                if (!trace) {
+                    if (!isUserBanned(user.username)) {
+                        queueFrame(user.connection, messageData, level, claimed);
+                        ++recipients;
+                    }
+                    continue;
+                }
+
+                auto checkStarted = std::chrono::steady_clock::now();
+                bool banned = isUserBanned(user.username);
+                auto queueStarted = std::chrono::steady_clock::now();
+                trace->recipientBanCheckMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                    queueStarted - checkStarted).count();
+
+                if (!banned) {
+                    queueFrame(user.connection, messageData, level, claimed);
+                    ++recipients;
+                    traceEnqueue(*trace, queueStarted, recipients);
                 }
             }
         }
+        flushClaimed(claimed);
+        metrics.fanout.record(recipients);
+        metrics.messagesOut.inc(recipients);
     }
 
-    void broadcastMessage(const Message& msg, const std::string& excludeUser) {
-        std::string messageData = "MESSAGE:" + msg.getData();
+    // Online members other than the sender get the message; membership was
+    // checked when it came in, and banned users are never online.
+    void channelMessage(const Message& msg, MessageTrace* trace = nullptr) {
+        std::shared_ptr<const ChannelDirectory::Members> members = channels.members(msg.Getter);
+        SharedFrame messageData = std::make_shared<const std::string>("MESSAGE:" + msg.getData() + "\n");
+        DeliveryPriority level = priorityOfTag(msg.Tag);
 
-        std::lock_guard<std::mutex> lock(clientsMutex);
-        for (const auto& user : onlineUsers) {
-            if (user.username != excludeUser && !isUserBanned(user.username)) {
-                send(user.socket, messageData.c_str(), messageData.length(), 0);
+        int recipients = 0;
+        std::vector<std::shared_ptr<Connection>> claimed;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            if (trace) trace->mark(MessageTrace::Routed);
+
+            if (members) {
+                for (const auto& member : *members) {
+                    if (member == msg.Sender) {
+                        continue;
+                    }
+                    auto online = sessionsByUser.find(member);
+                    if (online == sessionsByUser.end()) {
+                        continue;
+                    }
+                    for (const auto& connection : online->second) {
+                        auto queueStarted = std::chrono::steady_clock::now();
+                        queueFrame(connection, messageData, level, claimed);
+                        ++recipients;
+                        if (trace) traceEnqueue(*trace, queueStarted, recipients);
+                    }
+                }
             }
         }
+        flushClaimed(claimed);
+        metrics.fanout.record(recipients);
+        metrics.messagesOut.inc(recipients);
+    }
+
+private:
+    // Called right after the frame for the `recipients`-th recipient was
+    // queued; time spent waiting for the socket is in chat_outbound_wait_seconds.
+    static void traceEnqueue(MessageTrace& trace, std::chrono::steady_clock::time_point queueStarted, int recipients) {
+        auto now = std::chrono::steady_clock::now();
+        trace.enqueueMicros += std::chrono::duration_cast<std::chrono::microseconds>(now - queueStarted).count();
+        long long at = trace.sinceReceived(now);
+        if (recipients == 1) {
+            trace.at[MessageTrace::FirstQueued] = at;
+        }
+        trace.at[MessageTrace::LastQueued] = at;
+        trace.recipients = recipients;
     }
 
-    void sendUserList(SOCKET clientSocket) {
+protected:
+    void sendUserList(Connection& conn) {
         std::lock_guard<std::mutex> lock(clientsMutex);
 
         std::string userList = "USERS_LIST:";
-        for (const auto& user : onlineUsers) {
-            userList += user.username + ",";
+        for (const auto& user : sessionsByUser) {
+            userList += user.first + ",";
         }
 
         if (!userList.empty() && userList.back() == ',') {
             userList.pop_back();
         }
 
-        send(clientSocket, userList.c_str(), userList.length(), 0);
+        sendFrame(conn, userList);
     }
 
+private:
     bool initializeDatabase() {
         db = QSqlDatabase::addDatabase("QSQLITE", "chat_server_connection");
         db.setDatabaseName("chat_server.db");
@@ -307,7 +1233,7 @@ private:
             return false;
         }
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "create_schema", db);
 
         bool success = query.exec(
             "CREATE TABLE IF NOT EXISTS users ("
@@ -334,13 +1260,84 @@ private:
             "timestamp DATETIME DEFAULT CURRENT_TIMESTAMP)"
             );
 
-        return success;
+        if (!success) {
+            return false;
+        }
+
+        // History paging and resync filter by recipient or sender and walk ids.
+        success = query.exec("CREATE INDEX IF NOT EXISTS idx_messages_getter ON messages (getter, id)") &&
+                  query.exec("CREATE INDEX IF NOT EXISTS idx_messages_sender ON messages (sender, id)");
+
+        // The admin panel pages users sorted by name or ban status.
+        success = success &&
+                  query.exec("CREATE INDEX IF NOT EXISTS idx_users_name ON users (name, username)") &&
+                  query.exec("CREATE INDEX IF NOT EXISTS idx_users_banned ON users (is_banned, username)");
+
+        // Channel messages are stored with the channel name as getter.
+        success = success && query.exec(
+            "CREATE TABLE IF NOT EXISTS channel_members ("
+            "channel TEXT NOT NULL,"
+            "username TEXT NOT NULL,"
+            "joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+            "PRIMARY KEY (channel, username))"
+            ) &&
+            query.exec("CREATE INDEX IF NOT EXISTS idx_channel_members_user ON channel_members (username, channel)");
+
+        return success && loadChannelMembers();
+    }
+
+    bool loadChannelMembers() {
+        TimedQuery query(&sqlStats, "load_channel_members", db);
+        if (!query.exec("SELECT channel, username FROM channel_members ORDER BY channel, username")) {
+            return false;
+        }
+        // Rows arrive grouped by channel with members sorted, so each list
+        // is built in one pass and published once.
+        std::string channel;
+        ChannelDirectory::Members members;
+        while (query.next()) {
+            std::string rowChannel = query.value(0).toString().toStdString();
+            if (rowChannel != channel) {
+                if (!members.empty()) {
+                    channels.load(channel, std::move(members));
+                    members.clear();
+                }
+                channel = rowChannel;
+            }
+            members.push_back(query.value(1).toString().toStdString());
+        }
+        if (!members.empty()) {
+            channels.load(channel, std::move(members));
+        }
+        return true;
+    }
+
+    bool saveChannelMember(const std::string& channel, const std::string& username) {
+        if (!db.isOpen()) return false;
+
+        TimedQuery query(&sqlStats, "join_channel", db);
+        query.prepare("INSERT OR IGNORE INTO channel_members (channel, username) VALUES (?, ?)");
+        query.addBindValue(QString::fromStdString(channel));
+        query.addBindValue(QString::fromStdString(username));
+
+        return query.exec();
+    }
+
+    bool deleteChannelMember(const std::string& channel, const std::string& username) {
+        if (!db.isOpen()) return false;
+
+        TimedQuery query(&sqlStats, "leave_channel", db);
+        query.prepare("DELETE FROM channel_members WHERE channel = ? AND username = ?");
+        query.addBindValue(QString::fromStdString(channel));
+        query.addBindValue(QString::fromStdString(username));
+
+        return query.exec();
     }
 
     bool registerUser(const std::string& username, const std::string& password, const std::string& name) {
         if (!db.isOpen()) return false;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "register_user", db);
         query.prepare("INSERT INTO users (username, password, name) VALUES (?, ?, ?)");
         query.addBindValue(QString::fromStdString(username));
         query.addBindValue(QString::fromStdString(password));
@@ -352,7 +1349,7 @@ private:
     bool authenticateUser(const std::string& username, const std::string& password) {
         if (!db.isOpen()) return false;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "authenticate_user", db);
         query.prepare("SELECT username FROM users WHERE username = ? AND password = ?");
         query.addBindValue(QString::fromStdString(username));
         query.addBindValue(QString::fromStdString(password));
@@ -367,7 +1364,7 @@ private:
     bool banUser(const std::string& username) {
         if (!db.isOpen()) return false;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "ban_user", db);
         query.prepare("UPDATE users SET is_banned = 1 WHERE username = ?");
         query.addBindValue(QString::fromStdString(username));
 
@@ -377,7 +1374,7 @@ private:
     bool unbanUser(const std::string& username) {
         if (!db.isOpen()) return false;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "unban_user", db);
         query.prepare("UPDATE users SET is_banned = 0 WHERE username = ?");
         query.addBindValue(QString::fromStdString(username));
 
@@ -387,7 +1384,7 @@ private:
     bool isUserBanned(const std::string& username) {
         if (!db.isOpen()) return false;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "is_user_banned", db);
         query.prepare("SELECT is_banned FROM users WHERE username = ?");
         query.addBindValue(QString::fromStdString(username));
 
@@ -398,16 +1395,118 @@ private:
         return false;
     }
 
-    void logMessage(const Message& msg) {
-        if (!db.isOpen()) return;
+    long long logMessage(const Message& msg) {
+        if (!db.isOpen()) return 0;
 
-        QSqlQuery query(db);
+        TimedQuery query(&sqlStats, "log_message", db);
         query.prepare("INSERT INTO messages (sender, getter, text, tag) VALUES (?, ?, ?, ?)");
         query.addBindValue(QString::fromStdString(msg.Sender));
         query.addBindValue(QString::fromStdString(msg.Getter));
         query.addBindValue(QString::fromStdString(msg.Text));
         query.addBindValue(QString::fromStdString(msg.Tag));
-        query.exec();
+
+        bool ok = query.exec();
+        metrics.dbCommitMicros.record(query.elapsedMicros());
+
+        if (!ok) {
+            return 0;
+        }
+        return query.lastInsertId().toLongLong();
+    }
+
+    long long latestMessageId() {
+        if (!db.isOpen()) return 0;
+
+        TimedQuery query(&sqlStats, "latest_message_id", db);
+        if (query.exec("SELECT MAX(id) FROM messages") && query.next()) {
+            return query.value(0).toLongLong();
+        }
+        return 0;
+    }
+
+    std::vector<Message> loadHistoryBefore(const std::string& username, long long beforeId, int limit) {
+        std::vector<Message> messages;
+        if (!db.isOpen()) return messages;
+
+        TimedQuery query(&sqlStats, "load_history", db);
+        // Same visibility as loadMessagesSince: channel traffic only for
+        // channels the user is a member of, plus everything they sent.
+        query.prepare("SELECT id, sender, getter, text, tag FROM messages "
+                      "WHERE id < ? AND (getter = ? OR getter = 'ALL' OR "
+                      "getter IN (SELECT channel FROM channel_members WHERE username = ?) OR sender = ?) "
+                      "ORDER BY id DESC LIMIT ?");
+        query.addBindValue(beforeId > 0 ? beforeId : std::numeric_limits<long long>::max());
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(limit);
+
+        if (query.exec()) {
+            while (query.next()) {
+                Message msg(query.value(2).toString().toStdString(),
+                            query.value(1).toString().toStdString(),
+                            query.value(3).toString().toStdString(),
+                            query.value(4).toString().toStdString());
+                msg.Id = query.value(0).toLongLong();
+                messages.push_back(msg);
+            }
+        }
+
+        return messages;
+    }
+
+    std::vector<Message> loadChannelHistoryBefore(const std::string& channel, long long beforeId, int limit) {
+        std::vector<Message> messages;
+        if (!db.isOpen()) return messages;
+
+        TimedQuery query(&sqlStats, "load_channel_history", db);
+        query.prepare("SELECT id, sender, getter, text, tag FROM messages "
+                      "WHERE getter = ? AND id < ? ORDER BY id DESC LIMIT ?");
+        query.addBindValue(QString::fromStdString(channel));
+        query.addBindValue(beforeId > 0 ? beforeId : std::numeric_limits<long long>::max());
+        query.addBindValue(limit);
+
+        if (query.exec()) {
+            while (query.next()) {
+                Message msg(query.value(2).toString().toStdString(),
+                            query.value(1).toString().toStdString(),
+                            query.value(3).toString().toStdString(),
+                            query.value(4).toString().toStdString());
+                msg.Id = query.value(0).toLongLong();
+                messages.push_back(msg);
+            }
+        }
+
+        return messages;
+    }
+
+    std::vector<Message> loadMessagesSince(const std::string& username, long long sinceId, int limit) {
+        std::vector<Message> messages;
+        if (!db.isOpen()) return messages;
+
+        TimedQuery query(&sqlStats, "load_since", db);
+        query.prepare("SELECT id, sender, getter, text, tag FROM messages "
+                      "WHERE id > ? AND (getter = ? OR getter = 'ALL' OR "
+                      "getter IN (SELECT channel FROM channel_members WHERE username = ?)) AND sender != ? "
+                      "ORDER BY id LIMIT ?");
+        query.addBindValue(sinceId);
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(QString::fromStdString(username));
+        query.addBindValue(limit);
+
+        if (query.exec()) {
+            while (query.next()) {
+                Message msg(query.value(2).toString().toStdString(),
+                            query.value(1).toString().toStdString(),
+                            query.value(3).toString().toStdString(),
+                            query.value(4).toString().toStdString());
+                msg.Id = query.value(0).toLongLong();
+                messages.push_back(msg);
+            }
+        }
+
+        return messages;
     }
 };
 
@@ -0,0 +1,36 @@
+#ifndef SERVEREVENTS_HPP
+#define SERVEREVENTS_HPP
+
+#include "mpscqueue.hpp"
+
+#include <string>
+#include <chrono>
+
+// What ChatServer publishes for live consumers such as the admin panel.
+// Fields not relevant to a type are left empty.
+struct ServerEvent {
+    enum Type {
+        MessageRouted,
+        UserRegistered,
+        UserLoggedIn,
+        UserLoggedOut,
+        UserBanned,
+        UserUnbanned
+    };
+
+    Type type = MessageRouted;
+    std::string username;
+    std::string name;
+    std::string ip;
+    long long messageId = 0;
+    std::string getter;
+    std::string text;
+    std::string tag;
+    std::chrono::system_clock::time_point time;
+};
+
+using ServerEventQueue = BoundedMpscQueue<ServerEvent>;
+
+static const size_t kServerEventQueueCapacity = 16384;
+
+#endif
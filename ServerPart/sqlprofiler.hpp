@@ -0,0 +1,237 @@
+#ifndef SQLPROFILER_HPP
+#define SQLPROFILER_HPP
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <atomic>
+#include <algorithm>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QString>
+#include <QDateTime>
+
+#include "metrics.hpp"
+
+// Per-statement SQL metrics plus a slow query log. Each call site names
+// its statement ("authenticate_user", "admin_users_page"...); time from
+// exec() through the last next() is recorded under that name, and a
+// statement slower than the threshold is written to the log together with
+// SQLite's EXPLAIN QUERY PLAN for it. Safe to share between threads.
+class SqlProfiler {
+public:
+    struct Statement {
+        Histogram* latencyMicros;
+        Counter* rows;
+        Counter* errors;
+        Counter* slow;
+    };
+
+    explicit SqlProfiler(MetricsRegistry& registry)
+        : registry(registry), slowThresholdMicros(50 * 1000), slowLogPath("chat_server_slow.log") {}
+
+    SqlProfiler(const SqlProfiler&) = delete;
+    SqlProfiler& operator=(const SqlProfiler&) = delete;
+
+    // thresholdMs <= 0 disables the slow log.
+    void configureSlowLog(const std::string& path, int thresholdMs) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        slowLogPath = path;
+        slowThresholdMicros = thresholdMs > 0 ? (long long)thresholdMs * 1000 : 0;
+        slowLog.reset();
+    }
+
+    Statement& statement(const std::string& kind) {
+        std::lock_guard<std::mutex> lock(statementsMutex);
+        auto it = statements.find(kind);
+        if (it != statements.end()) {
+            return it->second;
+        }
+
+        std::string label = "statement=\"" + kind + "\"";
+        Statement created;
+        created.latencyMicros = &registry.histogram("chat_sql_seconds",
+            "Execution plus fetch time per SQL statement.", latencyBoundsSeconds(), 1e-6, label);
+        created.rows = &registry.counter("chat_sql_rows_total", "Rows returned or changed per SQL statement.", label);
+        created.errors = &registry.counter("chat_sql_errors_total", "Failed executions per SQL statement.", label);
+        created.slow = &registry.counter("chat_sql_slow_total", "Executions over the slow query threshold.", label);
+        return statements.emplace(kind, created).first->second;
+    }
+
+    void finished(Statement& stats, const std::string& kind, const QSqlDatabase& db, const QString& sql,
+                  const QVariantList& binds, long long micros, long long rows, bool failed) {
+        stats.latencyMicros->record((uint64_t)micros);
+        stats.rows->inc((uint64_t)rows);
+        if (failed) {
+            stats.errors->inc();
+        }
+
+        long long threshold = slowThresholdMicros;
+        if (threshold > 0 && micros >= threshold) {
+            stats.slow->inc();
+            logSlow(kind, db, sql, binds, micros, rows);
+        }
+    }
+
+private:
+    void logSlow(const std::string& kind, const QSqlDatabase& db, const QString& sql, const QVariantList& binds,
+                 long long micros, long long rows) {
+        QString plan = queryPlan(db, sql, binds);
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        if (!slowLog) {
+            slowLog.reset(new std::ofstream(slowLogPath, std::ios::app));
+        }
+        *slowLog << QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs).toStdString()
+                 << " slow query " << kind << ' ' << micros / 1000.0 << " ms rows=" << rows << '\n'
+                 << "  SQL: " << sql.simplified().toStdString() << '\n';
+        if (!plan.isEmpty()) {
+            *slowLog << plan.toStdString();
+        }
+        slowLog->flush();
+    }
+
+    // Plans are looked up once per SQL text; the bound values of the
+    // first slow execution are used, which is what SQLite plans against.
+    QString queryPlan(const QSqlDatabase& db, const QString& sql, const QVariantList& binds) {
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            auto it = plans.find(sql.toStdString());
+            if (it != plans.end()) {
+                return it->second;
+            }
+        }
+
+        QString plan;
+        QSqlQuery explain(db);
+        explain.setForwardOnly(true);
+        if (explain.prepare("EXPLAIN QUERY PLAN " + sql)) {
+            for (const QVariant& value : binds) {
+                explain.addBindValue(value);
+            }
+            if (explain.exec()) {
+                while (explain.next()) {
+                    plan += "  PLAN: " + explain.value(3).toString() + "\n";
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        plans[sql.toStdString()] = plan;
+        return plan;
+    }
+
+    MetricsRegistry& registry;
+    std::mutex statementsMutex;
+    std::map<std::string, Statement> statements;
+
+    std::mutex logMutex;
+    std::atomic<long long> slowThresholdMicros;
+    std::string slowLogPath;
+    std::unique_ptr<std::ofstream> slowLog;
+    std::map<std::string, QString> plans;
+};
+
+// QSqlQuery with the calls this code base uses, timed into a SqlProfiler
+// under a statement name. The profiler may be null, in which case it is a
+// plain query.
+class TimedQuery {
+public:
+    TimedQuery(SqlProfiler* profiler, const char* kind, const QSqlDatabase& db)
+        : query(db), database(db), profiler(profiler), kind(kind), micros(0), rows(0), failed(false), executed(false) {}
+
+    ~TimedQuery() {
+        if (profiler && executed) {
+            profiler->finished(profiler->statement(kind), kind, database, query.lastQuery(), binds,
+                               micros, rows, failed);
+        }
+    }
+
+    TimedQuery(const TimedQuery&) = delete;
+    TimedQuery& operator=(const TimedQuery&) = delete;
+
+    void setForwardOnly(bool forward) {
+        query.setForwardOnly(forward);
+    }
+
+    bool prepare(const QString& sql) {
+        return query.prepare(sql);
+    }
+
+    void addBindValue(const QVariant& value) {
+        query.addBindValue(value);
+        binds.append(value);
+    }
+
+    bool exec() {
+        return timed([this] { return query.exec(); });
+    }
+
+    bool exec(const QString& sql) {
+        return timed([this, &sql] { return query.exec(sql); });
+    }
+
+    bool next() {
+        auto started = std::chrono::steady_clock::now();
+        bool more = query.next();
+        micros += elapsedSince(started);
+        if (more) {
+            ++rows;
+        }
+        return more;
+    }
+
+    QVariant value(int index) const {
+        return query.value(index);
+    }
+
+    QVariant lastInsertId() const {
+        return query.lastInsertId();
+    }
+
+    QSqlError lastError() const {
+        return query.lastError();
+    }
+
+    // Time spent so far in exec() and next().
+    long long elapsedMicros() const {
+        return micros;
+    }
+
+private:
+    template <typename Exec>
+    bool timed(Exec run) {
+        auto started = std::chrono::steady_clock::now();
+        bool ok = run();
+        micros += elapsedSince(started);
+        executed = true;
+        failed = failed || !ok;
+        if (ok && !query.isSelect()) {
+            rows += std::max(0, query.numRowsAffected());
+        }
+        return ok;
+    }
+
+    static long long elapsedSince(std::chrono::steady_clock::time_point started) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count();
+    }
+
+    QSqlQuery query;
+    QSqlDatabase database;
+    SqlProfiler* profiler;
+    const char* kind;
+    QVariantList binds;
+    long long micros;
+    long long rows;
+    bool failed;
+    bool executed;
+};
+
+#endif
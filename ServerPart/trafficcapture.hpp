@@ -0,0 +1,318 @@
+#ifndef TRAFFICCAPTURE_HPP
+#define TRAFFICCAPTURE_HPP
+
+#include "mpscqueue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// Capture file: CaptureHeader, then records of
+//   type (1 byte), microseconds since the previous record (varint),
+//   connection id (varint), and for CaptureCommand the length (varint)
+//   and bytes of the command line without its '\n'.
+// CaptureDropped carries the number of records lost to a full queue in
+// place of a connection id.
+enum CaptureRecordType : uint8_t {
+    CaptureOpened = 1,
+    CaptureCommand,
+    CaptureClosed,
+    CaptureDropped
+};
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t wallNs;
+};
+
+static const char kCaptureMagic[8] = {'C', 'H', 'A', 'T', 'C', 'A', 'P', '1'};
+
+// Set in CaptureHeader::flags when message texts were replaced by filler.
+static const uint32_t kCaptureTextRedacted = 1;
+
+struct CaptureRecord {
+    uint64_t timestampUs = 0;
+    uint32_t connectionId = 0;
+    uint8_t type = 0;
+    std::string command;
+};
+
+// Records what clients send, for Tools/Replay. Server threads only push
+// onto a lock-free queue; a writer thread encodes and appends to the file.
+// Passwords never reach the file, and unless told otherwise message texts
+// are replaced with filler of the same length.
+class TrafficCapture {
+public:
+    static const size_t kQueueCapacity = 65536;
+
+    TrafficCapture() : queue(kQueueCapacity), file(nullptr), keepText(false), running(false),
+                       maxBytes(0), bytesWritten(0), recordsWritten(0), lastUs(0), droppedReported(0) {}
+
+    ~TrafficCapture() {
+        stop();
+    }
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    // maxBytes 0 means no limit; past it further records are discarded.
+    bool start(const std::string& path, bool keepMessageText, unsigned long long maxBytes) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+        keepText = keepMessageText;
+        this->maxBytes = maxBytes;
+
+        CaptureHeader header;
+        std::memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+        header.version = 1;
+        header.flags = keepText ? 0 : kCaptureTextRedacted;
+        header.wallNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::fwrite(&header, sizeof(header), 1, file);
+        bytesWritten = sizeof(header);
+        lastUs = nowUs(std::chrono::steady_clock::now());
+
+        running = true;
+        writer = std::thread(&TrafficCapture::writeLoop, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        writer.join();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+    bool active() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    void connectionOpened(uint32_t connectionId) {
+        push(CaptureOpened, connectionId, std::chrono::steady_clock::now(), std::string());
+    }
+
+    void connectionClosed(uint32_t connectionId) {
+        push(CaptureClosed, connectionId, std::chrono::steady_clock::now(), std::string());
+    }
+
+    void command(uint32_t connectionId, const std::string& line, std::chrono::steady_clock::time_point receivedAt) {
+        push(CaptureCommand, connectionId, receivedAt, redact(line));
+    }
+
+    unsigned long long records() const {
+        return recordsWritten.load(std::memory_order_relaxed);
+    }
+
+    unsigned long long dropped() const {
+        return queue.dropped();
+    }
+
+private:
+    static uint64_t nowUs(std::chrono::steady_clock::time_point at) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(at.time_since_epoch()).count();
+    }
+
+    void push(uint8_t type, uint32_t connectionId, std::chrono::steady_clock::time_point at, std::string command) {
+        if (!running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        CaptureRecord record;
+        record.timestampUs = nowUs(at);
+        record.connectionId = connectionId;
+        record.type = type;
+        record.command = std::move(command);
+        queue.tryPush(std::move(record));
+    }
+
+    // LOGIN:user:password -> LOGIN:user:*, REGISTER:user:password:name ->
+    // REGISTER:user:*:name, and MESSAGE text -> 'x' * length.
+    std::string redact(const std::string& line) const {
+        if (line.compare(0, 6, "LOGIN:") == 0) {
+            size_t colon = line.find(':', 6);
+            return colon == std::string::npos ? line : line.substr(0, colon + 1) + "*";
+        }
+        if (line.compare(0, 9, "REGISTER:") == 0) {
+            size_t first = line.find(':', 9);
+            size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+            if (second == std::string::npos) {
+                return line;
+            }
+            return line.substr(0, first + 1) + "*" + line.substr(second);
+        }
+        if (!keepText && line.compare(0, 8, "MESSAGE:") == 0) {
+            size_t first = line.find(';', 8);
+            size_t second = first == std::string::npos ? first : line.find(';', first + 1);
+            size_t third = second == std::string::npos ? second : line.find(';', second + 1);
+            if (third == std::string::npos) {
+                return line;
+            }
+            std::string redacted = line;
+            std::fill(redacted.begin() + (second + 1), redacted.begin() + third, 'x');
+            return redacted;
+        }
+        return line;
+    }
+
+    void writeLoop() {
+        CaptureRecord record;
+        std::string encoded;
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            bool wrote = false;
+            while (queue.tryPop(record)) {
+                encode(record, encoded);
+                wrote = true;
+            }
+
+            unsigned long long lost = queue.dropped();
+            if (lost != droppedReported) {
+                CaptureRecord gap;
+                gap.type = CaptureDropped;
+                gap.timestampUs = lastUs;
+                gap.connectionId = (uint32_t)(lost - droppedReported);
+                encode(gap, encoded);
+                droppedReported = lost;
+                wrote = true;
+            }
+
+            if (!encoded.empty() && (maxBytes == 0 || bytesWritten + encoded.size() <= maxBytes)) {
+                std::fwrite(encoded.data(), 1, encoded.size(), file);
+                bytesWritten += encoded.size();
+            }
+            encoded.clear();
+
+            if (stopping) {
+                std::fflush(file);
+                return;
+            }
+            if (!wrote) {
+                std::fflush(file);
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+    // Producers stamp before they push, so records from different threads
+    // can arrive slightly out of order; those are written with a zero gap.
+    void encode(const CaptureRecord& record, std::string& out) {
+        uint64_t delta = record.timestampUs > lastUs ? record.timestampUs - lastUs : 0;
+        lastUs += delta;
+        out.push_back((char)record.type);
+        putVarint(out, delta);
+        putVarint(out, record.connectionId);
+        if (record.type == CaptureCommand) {
+            putVarint(out, record.command.size());
+            out += record.command;
+        }
+        recordsWritten.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void putVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    BoundedMpscQueue<CaptureRecord> queue;
+    std::thread writer;
+    std::FILE* file;
+    bool keepText;
+    std::atomic<bool> running;
+    unsigned long long maxBytes;
+    unsigned long long bytesWritten;
+    std::atomic<unsigned long long> recordsWritten;
+    uint64_t lastUs;
+    unsigned long long droppedReported;
+};
+
+// Reads a capture back; timestampUs is relative to the start of the capture.
+class CaptureReader {
+public:
+    CaptureReader() : file(nullptr), clockUs(0) {}
+
+    ~CaptureReader() {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    bool open(const std::string& path) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        return std::fread(&header, sizeof(header), 1, file) == 1 &&
+               std::memcmp(header.magic, kCaptureMagic, sizeof(header.magic)) == 0 &&
+               header.version == 1;
+    }
+
+    const CaptureHeader& info() const {
+        return header;
+    }
+
+    // False at the end of the file or on a truncated record.
+    bool next(CaptureRecord& record) {
+        int type = std::fgetc(file);
+        uint64_t delta, connection;
+        if (type == EOF || !getVarint(delta) || !getVarint(connection)) {
+            return false;
+        }
+        clockUs += delta;
+        record.type = (uint8_t)type;
+        record.timestampUs = clockUs;
+        record.connectionId = (uint32_t)connection;
+        record.command.clear();
+        if (record.type == CaptureCommand) {
+            uint64_t length;
+            if (!getVarint(length) || length > (64u << 20)) {
+                return false;
+            }
+            record.command.resize((size_t)length);
+            if (length && std::fread(&record.command[0], 1, (size_t)length, file) != length) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = std::fgetc(file);
+            if (byte == EOF) {
+                return false;
+            }
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::FILE* file;
+    CaptureHeader header;
+    uint64_t clockUs;
+};
+
+#endif
@@ -0,0 +1,14 @@
+TEMPLATE = app
+
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += ../../ServerPart
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ../../ServerPart/flightrecorder.hpp
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
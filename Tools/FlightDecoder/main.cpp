@@ -0,0 +1,176 @@
+// Turns a flight recorder dump (see ServerPart/flightrecorder.hpp) into a
+// readable timeline.
+//
+//   FlightDecoder <dump> [--conn ID] [--thread N] [--last SECONDS] [--by-connection]
+
+#include "flightrecorder.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    const char* path = nullptr;
+    long long connection = -1;
+    long long thread = -1;
+    double lastSeconds = 0;
+    bool byConnection = false;
+};
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--conn" && hasValue) {
+            options.connection = std::atoll(argv[++i]);
+        } else if (arg == "--thread" && hasValue) {
+            options.thread = std::atoll(argv[++i]);
+        } else if (arg == "--last" && hasValue) {
+            options.lastSeconds = std::atof(argv[++i]);
+        } else if (arg == "--by-connection") {
+            options.byConnection = true;
+        } else if (arg[0] != '-' && !options.path) {
+            options.path = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return options.path != nullptr;
+}
+
+std::string formatWallTime(uint64_t wallNs) {
+    std::time_t seconds = (std::time_t)(wallNs / 1000000000ull);
+    std::tm local = *std::localtime(&seconds);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+    char result[48];
+    std::snprintf(result, sizeof(result), "%s.%06u", date, (unsigned)(wallNs % 1000000000ull / 1000));
+    return result;
+}
+
+std::string describe(const FlightRecord& record) {
+    char text[128];
+    switch (record.type) {
+    case FlightCommand:
+        std::snprintf(text, sizeof(text), "%s bytes=%u", flightCommandName(record.aux), record.size);
+        break;
+    case FlightBytesReceived:
+        std::snprintf(text, sizeof(text), "bytes=%u", record.size);
+        break;
+    case FlightFrameSent:
+        std::snprintf(text, sizeof(text), "bytes=%u frames=%u", record.size, record.aux);
+        break;
+    case FlightSendFailed:
+        std::snprintf(text, sizeof(text), "bytes=%u error=%u", record.size, record.aux);
+        break;
+    case FlightLoggedIn:
+        std::snprintf(text, sizeof(text), "%s", record.aux ? "resumed" : "login");
+        break;
+    case FlightLoginRejected:
+        std::snprintf(text, sizeof(text), "%s",
+                      record.aux == 2 ? "session limit" : record.aux ? "banned" : "invalid credentials");
+        break;
+    case FlightLoggedOut:
+        std::snprintf(text, sizeof(text), "%s", record.aux ? "banned" : "disconnected");
+        break;
+    case FlightMessageLogged:
+        std::snprintf(text, sizeof(text), "id=%u text_bytes=%u", record.aux, record.size);
+        break;
+    case FlightConnectionClosed:
+        std::snprintf(text, sizeof(text), "unparsed_bytes=%u", record.size);
+        break;
+    case FlightRateLimited: {
+        static const char* const priorities[] = {"low", "medium", "high"};
+        std::snprintf(text, sizeof(text), "scope=%s priority=%s bytes=%u", record.aux >> 8 ? "user" : "ip",
+                      (record.aux & 0xFF) < 3 ? priorities[record.aux & 0xFF] : "?", record.size);
+        break;
+    }
+    default:
+        text[0] = '\0';
+        break;
+    }
+    return text;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s <dump> [--conn ID] [--thread N] [--last SECONDS] [--by-connection]\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(options.path, std::ios::binary);
+    FlightDumpHeader header;
+    if (!in.read((char*)&header, sizeof(header)) ||
+        std::memcmp(header.magic, kFlightMagic, sizeof(header.magic)) != 0 ||
+        header.version != 1 || header.recordSize != sizeof(FlightRecord)) {
+        std::fprintf(stderr, "%s: not a flight recorder dump\n", options.path);
+        return 1;
+    }
+
+    std::vector<FlightRecord> records;
+    for (uint32_t i = 0; i < header.ringCount; ++i) {
+        FlightDumpRing ring;
+        if (!in.read((char*)&ring, sizeof(ring))) {
+            std::fprintf(stderr, "%s: truncated after %u of %u rings\n", options.path, i, header.ringCount);
+            break;
+        }
+        size_t base = records.size();
+        records.resize(base + ring.recordCount);
+        if (!in.read((char*)&records[base], ring.recordCount * sizeof(FlightRecord))) {
+            records.resize(base + (size_t)in.gcount() / sizeof(FlightRecord));
+            std::fprintf(stderr, "%s: truncated in ring %u\n", options.path, ring.ring);
+            break;
+        }
+    }
+
+    uint64_t since = 0;
+    if (options.lastSeconds > 0) {
+        since = header.steadyNs - std::min<uint64_t>(header.steadyNs, (uint64_t)(options.lastSeconds * 1e9));
+    }
+    records.erase(std::remove_if(records.begin(), records.end(), [&](const FlightRecord& record) {
+        return record.type == 0 ||
+               record.timestampNs < since ||
+               (options.connection >= 0 && record.connectionId != (uint64_t)options.connection) ||
+               (options.thread >= 0 && record.thread != (uint64_t)options.thread);
+    }), records.end());
+
+    std::stable_sort(records.begin(), records.end(), [&](const FlightRecord& a, const FlightRecord& b) {
+        if (options.byConnection && a.connectionId != b.connectionId) {
+            return a.connectionId < b.connectionId;
+        }
+        return a.timestampNs < b.timestampNs;
+    });
+
+    std::printf("# dump taken %s, %zu events\n", formatWallTime(header.wallNs).c_str(), records.size());
+
+    uint32_t currentConnection = 0;
+    uint64_t previous = records.empty() ? 0 : records.front().timestampNs;
+    for (const auto& record : records) {
+        if (options.byConnection && record.connectionId != currentConnection) {
+            currentConnection = record.connectionId;
+            previous = record.timestampNs;
+            std::printf("\n## connection %u\n", currentConnection);
+        }
+
+        uint64_t wallNs = header.wallNs - (header.steadyNs - std::min(header.steadyNs, record.timestampNs));
+        std::printf("%s %+10.3fms t%-5u conn=%-6u %-16s %s\n",
+                    formatWallTime(wallNs).c_str(),
+                    (double)((long long)record.timestampNs - (long long)previous) / 1e6,
+                    record.thread, record.connectionId,
+                    flightEventName(record.type), describe(record).c_str());
+        previous = record.timestampNs;
+    }
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+TEMPLATE = app
+
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+include(../../ClientCore/ClientCore.pri)
+
+INCLUDEPATH += ../../ServerPart
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ../../ServerPart/metrics.hpp
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
@@ -0,0 +1,605 @@
+// Load generator for ChatServer. Opens N connections driven by a few
+// ClientPool threads, registers and logs in synthetic users, then issues
+// a weighted mix of direct messages, broadcasts, GET_USERS and login churn
+// at a fixed open-loop rate. Prints a JSON report on stdout.
+//
+//   LoadGen --clients 2000 --rate 5000 --duration 60 --mix dm=70,broadcast=5,users=20,churn=5
+//
+// Delivery latency is measured from the moment a message was scheduled to
+// go out (not when the driver got round to it), so a stalled server shows
+// up as latency instead of as a lower send rate.
+//
+// With --restart-command the command is run --restart-at seconds into the
+// run while the load keeps going. It is expected to restart the server
+// (e.g. a script that kills and relaunches it). The report then says how
+// long it took until every client that was online before had reconnected
+// and logged in again.
+//
+//   LoadGen --clients 1000 --duration 90 --restart-at 30 --restart-command "./restart-server.sh"
+
+#include "clientpool.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+long long nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    unsigned short port = 8888;
+    int clients = 1000;
+    int pools = 4;
+    double rate = 1000;
+    double duration = 30;
+    double drain = 5;
+    int textSize = 64;
+    std::string prefix = "lg";
+    std::string password = "loadgen";
+    unsigned seed = 1;
+    // Relative weights of the operations.
+    double dm = 70;
+    double broadcast = 5;
+    double users = 20;
+    double churn = 5;
+    std::string restartCommand;
+    double restartAt = 10;
+    double recoveryTimeout = 60;
+};
+
+bool parseMix(const std::string& mix, Options& options) {
+    std::istringstream ss(mix);
+    std::string item;
+    options.dm = options.broadcast = options.users = options.churn = 0;
+    while (std::getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string name = item.substr(0, eq);
+        double weight = std::atof(item.c_str() + eq + 1);
+        if (name == "dm") options.dm = weight;
+        else if (name == "broadcast") options.broadcast = weight;
+        else if (name == "users") options.users = weight;
+        else if (name == "churn") options.churn = weight;
+        else return false;
+    }
+    return options.dm + options.broadcast + options.users + options.churn > 0;
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = (unsigned short)std::atoi(value);
+        else if (arg == "--clients") options.clients = std::max(2, std::atoi(value));
+        else if (arg == "--pools") options.pools = std::max(1, std::atoi(value));
+        else if (arg == "--rate") options.rate = std::atof(value);
+        else if (arg == "--duration") options.duration = std::atof(value);
+        else if (arg == "--drain") options.drain = std::atof(value);
+        else if (arg == "--size") options.textSize = std::max(24, std::atoi(value));
+        else if (arg == "--prefix") options.prefix = value;
+        else if (arg == "--password") options.password = value;
+        else if (arg == "--seed") options.seed = (unsigned)std::strtoul(value, nullptr, 10);
+        else if (arg == "--restart-command") options.restartCommand = value;
+        else if (arg == "--restart-at") options.restartAt = std::atof(value);
+        else if (arg == "--recovery-timeout") options.recoveryTimeout = std::atof(value);
+        else if (arg == "--mix") {
+            if (!parseMix(value, options)) return false;
+        }
+        else return false;
+    }
+    if (!options.restartCommand.empty() && (options.restartAt <= 0 || options.restartAt >= options.duration)) {
+        return false;
+    }
+    return options.rate > 0 && options.duration > 0;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+struct Stats {
+    std::atomic<long long> connectErrors{0};
+    std::atomic<long long> loginErrors{0};
+    std::atomic<long long> queueFull{0};
+    std::atomic<long long> disconnects{0};
+    std::atomic<long long> banned{0};
+    std::atomic<long long> skipped{0};
+
+    std::atomic<long long> dmSent{0};
+    std::atomic<long long> broadcastSent{0};
+    std::atomic<long long> usersSent{0};
+    std::atomic<long long> churnDone{0};
+
+    std::atomic<long long> expectedDeliveries{0};
+    std::atomic<long long> dmDelivered{0};
+    std::atomic<long long> broadcastDelivered{0};
+    std::atomic<long long> usersAnswered{0};
+    std::atomic<long long> logins{0};
+
+    // Microseconds.
+    Histogram deliveryLatency;
+    Histogram usersLatency;
+    Histogram loginLatency;
+    // From a user's drop during the restart to its next login.
+    Histogram recoveryLatency;
+};
+
+struct SimUser {
+    std::unique_ptr<ChatClient> client;
+    std::string username;
+    ClientPool* pool = nullptr;
+    std::atomic<bool> loggedIn{false};
+    std::atomic<long long> loginRequestedNs{0};
+    std::atomic<long long> usersRequestedNs{0};
+    // For the restart scenario: when the session last dropped and came back.
+    std::atomic<long long> lastDropNs{0};
+    std::atomic<long long> lastLoginNs{0};
+};
+
+// Text is "lg <scheduled ns> xxxx..." padded to the requested size.
+std::string makeText(long long scheduledNs, int size) {
+    std::string text = "lg " + std::to_string(scheduledNs) + " ";
+    if ((int)text.size() < size) {
+        text.append(size - text.size(), 'x');
+    }
+    return text;
+}
+
+long long scheduledFromText(const std::string& text) {
+    if (text.compare(0, 3, "lg ") != 0) {
+        return 0;
+    }
+    return std::strtoll(text.c_str() + 3, nullptr, 10);
+}
+
+void recordSince(Histogram& histogram, long long startNs) {
+    long long elapsed = nowNs() - startNs;
+    histogram.record((uint64_t)std::max(0LL, elapsed / 1000));
+}
+
+void wireHandlers(SimUser& user, Stats& stats, const Options& options) {
+    ChatClient& client = *user.client;
+
+    client.setRegisterHandler([&user, &options](bool, const std::string&) {
+        // "Username exists" from an earlier run is fine: log in either way.
+        user.client->login(user.username, options.password);
+    });
+
+    client.setLoginHandler([&user, &stats](bool success, const std::string&) {
+        if (!success) {
+            stats.loginErrors++;
+            return;
+        }
+        long long requested = user.loginRequestedNs.exchange(0);
+        if (requested) {
+            recordSince(stats.loginLatency, requested);
+        }
+        stats.logins++;
+        user.lastLoginNs = nowNs();
+        user.loggedIn = true;
+    });
+
+    client.setMessageHandler([&stats](const Message& msg) {
+        long long scheduled = scheduledFromText(msg.Text);
+        if (!scheduled) {
+            return;
+        }
+        recordSince(stats.deliveryLatency, scheduled);
+        (msg.Getter == "ALL" ? stats.broadcastDelivered : stats.dmDelivered)++;
+    });
+
+    client.setUsersHandler([&user, &stats](const std::vector<std::string>&) {
+        long long requested = user.usersRequestedNs.exchange(0);
+        if (requested) {
+            recordSince(stats.usersLatency, requested);
+            stats.usersAnswered++;
+        }
+    });
+
+    client.setDisconnectedHandler([&user, &stats]() {
+        user.loggedIn = false;
+        user.lastDropNs = nowNs();
+        stats.disconnects++;
+    });
+
+    client.setReconnectedHandler([&user]() {
+        user.lastLoginNs = nowNs();
+        user.loggedIn = true;
+    });
+
+    client.setBannedHandler([&user, &stats](const std::string&) {
+        user.loggedIn = false;
+        stats.banned++;
+    });
+}
+
+bool connectUser(SimUser& user, Stats& stats, const Options& options, bool registerFirst, long long requestedNs) {
+    if (!user.client->connectDetached(options.host, options.port)) {
+        stats.connectErrors++;
+        return false;
+    }
+    user.pool->add(user.client.get());
+    user.loginRequestedNs = requestedNs;
+    if (registerFirst) {
+        user.client->registerUser(user.username, options.password, user.username);
+    } else {
+        user.client->login(user.username, options.password);
+    }
+    return true;
+}
+
+class Runner {
+public:
+    explicit Runner(const Options& options)
+        : options(options), pools(options.pools), rng(options.seed) {
+        users.reserve(options.clients);
+        for (int i = 0; i < options.clients; ++i) {
+            auto user = std::unique_ptr<SimUser>(new SimUser);
+            user->client.reset(new ChatClient);
+            user->username = options.prefix + std::to_string(i);
+            user->pool = &pools[i % options.pools];
+            wireHandlers(*user, stats, options);
+            users.push_back(std::move(user));
+        }
+    }
+
+    ~Runner() {
+        for (auto& pool : pools) {
+            pool.stop();
+        }
+    }
+
+    void run() {
+        for (auto& pool : pools) {
+            pool.start();
+        }
+
+        auto setupStarted = Clock::now();
+        for (auto& user : users) {
+            connectUser(*user, stats, options, true, nowNs());
+        }
+        waitForLogins(std::chrono::seconds(60));
+        setupSeconds = secondsSince(setupStarted);
+
+        long long loggedIn = countLoggedIn();
+        std::fprintf(stderr, "setup: %lld/%d logged in after %.1f s\n", loggedIn, options.clients, setupSeconds);
+
+        std::thread restarter;
+        if (!options.restartCommand.empty()) {
+            restarter = std::thread(&Runner::restartAndRecover, this, Clock::now());
+        }
+        drive();
+        drainDeliveries();
+        if (restarter.joinable()) {
+            restarter.join();
+        }
+    }
+
+    void report() const {
+        auto latency = [](const Histogram& histogram) {
+            HistogramSnapshot snap = histogram.snapshot();
+            char text[256];
+            std::snprintf(text, sizeof(text),
+                          "{\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+                          (unsigned long long)snap.count,
+                          (unsigned long long)snap.percentile(0.50), (unsigned long long)snap.percentile(0.90),
+                          (unsigned long long)snap.percentile(0.99), (unsigned long long)snap.percentile(0.999),
+                          (unsigned long long)snap.max());
+            return std::string(text);
+        };
+
+        long long deliveries = stats.dmDelivered + stats.broadcastDelivered;
+        long long ops = stats.dmSent + stats.broadcastSent + stats.usersSent + stats.churnDone;
+
+        std::printf("{\n");
+        std::printf("  \"config\": {\"host\": \"%s\", \"port\": %u, \"clients\": %d, \"pools\": %d, "
+                    "\"target_rate\": %g, \"duration_s\": %g, \"text_bytes\": %d, "
+                    "\"mix\": {\"dm\": %g, \"broadcast\": %g, \"users\": %g, \"churn\": %g}},\n",
+                    options.host.c_str(), options.port, options.clients, options.pools,
+                    options.rate, options.duration, options.textSize,
+                    options.dm, options.broadcast, options.users, options.churn);
+        std::printf("  \"setup_s\": %.3f,\n", setupSeconds);
+        std::printf("  \"elapsed_s\": %.3f,\n", driveSeconds);
+        std::printf("  \"ops\": {\"total\": %lld, \"dm\": %lld, \"broadcast\": %lld, \"users\": %lld, \"churn\": %lld},\n",
+                    ops, stats.dmSent.load(), stats.broadcastSent.load(), stats.usersSent.load(), stats.churnDone.load());
+        std::printf("  \"achieved_ops_per_s\": %.1f,\n", driveSeconds > 0 ? ops / driveSeconds : 0.0);
+        std::printf("  \"deliveries\": {\"expected\": %lld, \"received\": %lld, \"dm\": %lld, \"broadcast\": %lld},\n",
+                    stats.expectedDeliveries.load(), deliveries,
+                    stats.dmDelivered.load(), stats.broadcastDelivered.load());
+        std::printf("  \"deliveries_per_s\": %.1f,\n", driveSeconds > 0 ? deliveries / driveSeconds : 0.0);
+        std::printf("  \"latency_us\": {\n");
+        std::printf("    \"delivery\": %s,\n", latency(stats.deliveryLatency).c_str());
+        std::printf("    \"get_users\": %s,\n", latency(stats.usersLatency).c_str());
+        std::printf("    \"login\": %s\n", latency(stats.loginLatency).c_str());
+        std::printf("  },\n");
+        if (!options.restartCommand.empty()) {
+            std::printf("  \"restart\": {\"command\": \"%s\", \"at_s\": %g, \"command_status\": %d, \"command_s\": %.3f, "
+                        "\"online_before\": %lld, \"dropped\": %lld, \"recovered\": %lld, \"first_drop_s\": %.3f, "
+                        "\"full_recovery_s\": %.3f, \"per_client_us\": %s},\n",
+                        jsonEscape(options.restartCommand).c_str(), options.restartAt, restart.commandStatus,
+                        restart.commandSeconds, restart.onlineBefore, restart.dropped, restart.recovered,
+                        restart.firstDropSeconds, restart.fullRecoverySeconds, latency(stats.recoveryLatency).c_str());
+        }
+        std::printf("  \"errors\": {\"connect\": %lld, \"login\": %lld, \"send_queue_full\": %lld, "
+                    "\"disconnects\": %lld, \"banned\": %lld, \"skipped_no_user\": %lld}\n",
+                    stats.connectErrors.load(), stats.loginErrors.load(), stats.queueFull.load(),
+                    stats.disconnects.load(), stats.banned.load(), stats.skipped.load());
+        std::printf("}\n");
+    }
+
+private:
+    enum Op { OpDm, OpBroadcast, OpUsers, OpChurn };
+
+    // Times are seconds from the start of the restart command; -1 when it
+    // never happened within the recovery timeout.
+    struct RestartResult {
+        int commandStatus = 0;
+        double commandSeconds = 0;
+        long long onlineBefore = 0;
+        long long dropped = 0;
+        long long recovered = 0;
+        double firstDropSeconds = -1;
+        double fullRecoverySeconds = -1;
+    };
+
+    static double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    long long countLoggedIn() const {
+        long long count = 0;
+        for (const auto& user : users) {
+            count += user->loggedIn ? 1 : 0;
+        }
+        return count;
+    }
+
+    void waitForLogins(std::chrono::seconds limit) {
+        auto deadline = Clock::now() + limit;
+        while (Clock::now() < deadline) {
+            long long settled = countLoggedIn() + stats.loginErrors + stats.connectErrors;
+            if (settled >= (long long)users.size()) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    // Runs on its own thread so the load keeps its schedule while the
+    // server is down. A client counts as recovered once it has dropped
+    // after the restart began and logged in again; full recovery is when
+    // the last client that was online before has done so.
+    void restartAndRecover(Clock::time_point driveStarted) {
+        std::this_thread::sleep_until(driveStarted + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.restartAt)));
+
+        std::vector<SimUser*> online;
+        for (const auto& user : users) {
+            if (user->loggedIn) {
+                online.push_back(user.get());
+            }
+        }
+        restart.onlineBefore = (long long)online.size();
+        std::fprintf(stderr, "restart: running \"%s\" with %lld online\n",
+                     options.restartCommand.c_str(), restart.onlineBefore);
+
+        auto started = Clock::now();
+        long long startedNs = nowNs();
+        restart.commandStatus = std::system(options.restartCommand.c_str());
+        restart.commandSeconds = secondsSince(started);
+
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.recoveryTimeout));
+        std::vector<SimUser*> waiting = online;
+        long long firstDropNs = 0;
+        long long lastRecoveryNs = 0;
+        while (!waiting.empty() && Clock::now() < deadline) {
+            for (size_t i = 0; i < waiting.size(); ) {
+                SimUser& user = *waiting[i];
+                long long dropNs = user.lastDropNs;
+                long long loginNs = user.lastLoginNs;
+                bool recovered = dropNs > startedNs && loginNs > dropNs && user.loggedIn;
+                if (!recovered) {
+                    ++i;
+                    continue;
+                }
+                stats.recoveryLatency.record((uint64_t)((loginNs - dropNs) / 1000));
+                firstDropNs = firstDropNs ? std::min(firstDropNs, dropNs) : dropNs;
+                lastRecoveryNs = std::max(lastRecoveryNs, loginNs);
+                waiting[i] = waiting.back();
+                waiting.pop_back();
+                restart.recovered++;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        for (SimUser* user : online) {
+            long long dropNs = user->lastDropNs;
+            if (dropNs > startedNs) {
+                restart.dropped++;
+                firstDropNs = firstDropNs ? std::min(firstDropNs, dropNs) : dropNs;
+            }
+        }
+        if (firstDropNs) {
+            restart.firstDropSeconds = (firstDropNs - startedNs) / 1e9;
+        }
+        if (waiting.empty() && restart.onlineBefore > 0) {
+            restart.fullRecoverySeconds = (lastRecoveryNs - startedNs) / 1e9;
+        }
+        std::fprintf(stderr, "restart: %lld/%lld recovered, full recovery %s%.3f s after the command started\n",
+                     restart.recovered, restart.onlineBefore, waiting.empty() ? "" : "not reached, gave up at ",
+                     waiting.empty() ? restart.fullRecoverySeconds : secondsSince(started));
+    }
+
+    Op pickOp() {
+        double total = options.dm + options.broadcast + options.users + options.churn;
+        double roll = std::uniform_real_distribution<double>(0, total)(rng);
+        if ((roll -= options.dm) < 0) return OpDm;
+        if ((roll -= options.broadcast) < 0) return OpBroadcast;
+        if ((roll -= options.users) < 0) return OpUsers;
+        return OpChurn;
+    }
+
+    // A random logged-in user other than `except`, or null.
+    SimUser* pickUser(const SimUser* except = nullptr) {
+        std::uniform_int_distribution<size_t> index(0, users.size() - 1);
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            SimUser* user = users[index(rng)].get();
+            if (user != except && user->loggedIn) {
+                return user;
+            }
+        }
+        return nullptr;
+    }
+
+    void drive() {
+        auto started = Clock::now();
+        auto interval = std::chrono::duration<double>(1.0 / options.rate);
+        auto end = started + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+        auto nextReport = started + std::chrono::seconds(1);
+        long long issued = 0;
+
+        while (true) {
+            auto scheduled = started + std::chrono::duration_cast<Clock::duration>(interval * (double)issued);
+            if (scheduled >= end) {
+                break;
+            }
+            auto now = Clock::now();
+            if (scheduled > now) {
+                std::this_thread::sleep_until(scheduled);
+            }
+            issue(pickOp(), std::chrono::duration_cast<std::chrono::nanoseconds>(scheduled.time_since_epoch()).count());
+            ++issued;
+
+            if (Clock::now() >= nextReport) {
+                nextReport += std::chrono::seconds(1);
+                HistogramSnapshot snap = stats.deliveryLatency.snapshot();
+                std::fprintf(stderr, "%5.0fs ops=%lld online=%lld delivered=%lld p99=%lluus\n",
+                             secondsSince(started), issued, countLoggedIn(),
+                             stats.dmDelivered + stats.broadcastDelivered,
+                             (unsigned long long)snap.percentile(0.99));
+            }
+        }
+        driveSeconds = secondsSince(started);
+    }
+
+    void issue(Op op, long long scheduledNs) {
+        SimUser* sender = pickUser();
+        if (!sender) {
+            stats.skipped++;
+            return;
+        }
+
+        switch (op) {
+        case OpDm: {
+            SimUser* recipient = pickUser(sender);
+            if (!recipient) {
+                stats.skipped++;
+                return;
+            }
+            Message msg(recipient->username, sender->username, makeText(scheduledNs, options.textSize), "Low");
+            if (sender->client->sendMessage(msg)) {
+                stats.dmSent++;
+                stats.expectedDeliveries++;
+            } else {
+                stats.queueFull++;
+            }
+            break;
+        }
+        case OpBroadcast: {
+            Message msg("ALL", sender->username, makeText(scheduledNs, options.textSize), "Medium");
+            long long online = countLoggedIn();
+            if (sender->client->sendMessage(msg)) {
+                stats.broadcastSent++;
+                stats.expectedDeliveries += std::max(0LL, online - 1);
+            } else {
+                stats.queueFull++;
+            }
+            break;
+        }
+        case OpUsers:
+            sender->usersRequestedNs = scheduledNs;
+            sender->client->requestUserList();
+            stats.usersSent++;
+            break;
+        case OpChurn:
+            // Log the user out by dropping the connection, then back in.
+            sender->loggedIn = false;
+            sender->pool->remove(sender->client.get());
+            sender->client->disconnect();
+            connectUser(*sender, stats, options, false, scheduledNs);
+            stats.churnDone++;
+            break;
+        }
+    }
+
+    // Waits until deliveries stop arriving, or options.drain seconds.
+    void drainDeliveries() {
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.drain));
+        long long last = -1;
+        while (Clock::now() < deadline) {
+            long long delivered = stats.dmDelivered + stats.broadcastDelivered;
+            if (delivered == last || delivered >= stats.expectedDeliveries) {
+                break;
+            }
+            last = delivered;
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+    }
+
+    Options options;
+    std::vector<ClientPool> pools;
+    std::vector<std::unique_ptr<SimUser>> users;
+    Stats stats;
+    std::mt19937 rng;
+    double setupSeconds = 0;
+    double driveSeconds = 0;
+    RestartResult restart;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr,
+                     "usage: %s [--host H] [--port P] [--clients N] [--pools N] [--rate OPS] [--duration S]\n"
+                     "          [--drain S] [--size BYTES] [--mix dm=70,broadcast=5,users=20,churn=5]\n"
+                     "          [--prefix NAME] [--password PW] [--seed N]\n"
+                     "          [--restart-command CMD [--restart-at S] [--recovery-timeout S]]\n", argv[0]);
+        return 2;
+    }
+
+    auto runner = std::unique_ptr<Runner>(new Runner(options));
+    runner->run();
+    runner->report();
+    return 0;
+}
@@ -0,0 +1,18 @@
+TEMPLATE = app
+
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+include(../../ClientCore/ClientCore.pri)
+
+INCLUDEPATH += ../../ServerPart
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ../../ServerPart/metrics.hpp \
+    ../../ServerPart/mpscqueue.hpp \
+    ../../ServerPart/trafficcapture.hpp
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
@@ -0,0 +1,417 @@
+// Re-drives a traffic capture (CHAT_CAPTURE, see ServerPart/trafficcapture.hpp)
+// against a server, opening one connection per captured connection and
+// sending each command at its captured offset.
+//
+//   Replay <capture> [--host H] [--port P] [--speed X] [--password PW] [--drain S] [--no-register]
+//
+// --speed 1 keeps the captured timing, 2 plays twice as fast and 0 sends as
+// fast as the server accepts. Captured passwords are blanked, so every user
+// seen in the capture is registered first with --password, LOGIN is sent
+// with it, and RESUME (whose token means nothing to a fresh server) becomes
+// a LOGIN. Prints a JSON report on stdout.
+
+#include "connector.hpp"
+#include "metrics.hpp"
+#include "trafficcapture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    const char* path = nullptr;
+    std::string host = "127.0.0.1";
+    unsigned short port = 8888;
+    double speed = 1;
+    std::string password = "replay";
+    double drain = 3;
+    bool registerUsers = true;
+};
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = (unsigned short)std::atoi(argv[++i]);
+        } else if (arg == "--speed" && hasValue) {
+            options.speed = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "--password" && hasValue) {
+            options.password = argv[++i];
+        } else if (arg == "--drain" && hasValue) {
+            options.drain = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "--no-register") {
+            options.registerUsers = false;
+        } else if (arg[0] != '-' && !options.path) {
+            options.path = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return options.path != nullptr;
+}
+
+std::string commandKind(const std::string& line) {
+    size_t colon = line.find(':');
+    return colon == std::string::npos ? line : line.substr(0, colon);
+}
+
+// The user a LOGIN, RESUME or REGISTER line is for, if any.
+std::string commandUser(const std::string& line) {
+    std::string kind = commandKind(line);
+    if (kind != "LOGIN" && kind != "RESUME" && kind != "REGISTER") {
+        return std::string();
+    }
+    size_t start = kind.size() + 1;
+    size_t end = line.find(':', start);
+    return end == std::string::npos ? std::string() : line.substr(start, end - start);
+}
+
+class Replayer {
+public:
+    explicit Replayer(const Options& options)
+        : options(options), lag(new Histogram), records(0), connectErrors(0), sendErrors(0),
+          droppedInCapture(0), bytesReceived(0), spanUs(0) {}
+
+    ~Replayer() {
+        for (auto& entry : connections) {
+            closesocket(entry.second.socket);
+        }
+    }
+
+    int run() {
+        CaptureReader scan;
+        if (!scan.open(options.path)) {
+            std::fprintf(stderr, "%s: not a traffic capture\n", options.path);
+            return 1;
+        }
+        textRedacted = (scan.info().flags & kCaptureTextRedacted) != 0;
+
+        std::set<std::string> users;
+        std::set<uint32_t> connectionIds;
+        CaptureRecord record;
+        while (scan.next(record)) {
+            std::string user = commandUser(record.command);
+            if (!user.empty()) {
+                users.insert(user);
+            }
+            if (record.type == CaptureOpened) {
+                connectionIds.insert(record.connectionId);
+            }
+            spanUs = record.timestampUs;
+        }
+        capturedConnections = connectionIds.size();
+
+        if (options.registerUsers && !registerAll(users)) {
+            return 1;
+        }
+
+        CaptureReader reader;
+        reader.open(options.path);
+        started = Clock::now();
+        while (reader.next(record)) {
+            ++records;
+            if (options.speed > 0) {
+                auto due = started + std::chrono::microseconds((long long)(record.timestampUs / options.speed));
+                while (Clock::now() < due) {
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now());
+                    pump((int)std::min<long long>(50, std::max<long long>(0, wait.count())));
+                }
+                lag->record((uint64_t)std::max<long long>(0, std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - due).count()));
+            } else if (records % 256 == 0) {
+                pump(0);
+            }
+            apply(record);
+        }
+        replaySeconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+        auto drainUntil = Clock::now() + std::chrono::milliseconds((long long)(options.drain * 1000));
+        while (Clock::now() < drainUntil && !connections.empty()) {
+            pump(50);
+        }
+
+        report();
+        return 0;
+    }
+
+private:
+    struct Connection {
+        SOCKET socket = INVALID_SOCKET;
+        uint32_t id = 0;
+        std::string outbound;
+        std::string inbound;
+        // The capture saw it close: half-close once outbound is written and
+        // read replies until the server closes its side.
+        bool closing = false;
+    };
+
+    // Pipelines a REGISTER per user over one connection and waits for the
+    // answers; "Username exists" is as good as success.
+    bool registerAll(const std::set<std::string>& users) {
+        if (users.empty()) {
+            return true;
+        }
+        Connection setup;
+        setup.socket = connectFirstAvailable({Endpoint{options.host, options.port}},
+                                             std::chrono::seconds(5), std::chrono::milliseconds(250));
+        if (setup.socket == INVALID_SOCKET) {
+            std::fprintf(stderr, "cannot connect to %s:%u\n", options.host.c_str(), options.port);
+            return false;
+        }
+        socketSetNonBlocking(setup.socket, true);
+        for (const auto& user : users) {
+            setup.outbound += "REGISTER:" + user + ":" + options.password + ":" + user + "\n";
+        }
+
+        size_t answers = 0;
+        size_t offset = 0;
+        auto deadline = Clock::now() + std::chrono::seconds(60);
+        char buffer[8192];
+        while (answers < users.size() && Clock::now() < deadline) {
+            if (offset < setup.outbound.size()) {
+                int sent = send(setup.socket, setup.outbound.data() + offset,
+                                (int)(setup.outbound.size() - offset), NET_SEND_FLAGS);
+                if (sent == SOCKET_ERROR && !socketWouldBlock(socketLastError())) {
+                    break;
+                }
+                offset += sent > 0 ? (size_t)sent : 0;
+            }
+            pollfd fd = {};
+            fd.fd = setup.socket;
+            fd.events = POLLIN | (offset < setup.outbound.size() ? POLLOUT : 0);
+            if (socketPoll(&fd, 1, 100) > 0 && (fd.revents & (POLLIN | POLLERR | POLLHUP))) {
+                int received = recv(setup.socket, buffer, sizeof(buffer), 0);
+                if (received == SOCKET_ERROR && socketWouldBlock(socketLastError())) {
+                    continue;
+                }
+                if (received <= 0) {
+                    break;
+                }
+                setup.inbound.append(buffer, (size_t)received);
+                size_t pos;
+                while ((pos = setup.inbound.find('\n')) != std::string::npos) {
+                    if (setup.inbound.compare(0, 9, "REGISTER_") == 0) {
+                        ++answers;
+                    }
+                    setup.inbound.erase(0, pos + 1);
+                }
+            }
+        }
+        closesocket(setup.socket);
+        std::fprintf(stderr, "registered %zu of %zu users\n", answers, users.size());
+        return true;
+    }
+
+    std::string rewrite(const std::string& line) const {
+        std::string kind = commandKind(line);
+        if (kind == "LOGIN" || kind == "RESUME") {
+            return "LOGIN:" + commandUser(line) + ":" + options.password;
+        }
+        if (kind == "REGISTER") {
+            size_t first = line.find(':', 9);
+            size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+            if (second != std::string::npos) {
+                return line.substr(0, first + 1) + options.password + line.substr(second);
+            }
+        }
+        return line;
+    }
+
+    void apply(const CaptureRecord& record) {
+        switch (record.type) {
+        case CaptureOpened: {
+            SOCKET s = connectFirstAvailable({Endpoint{options.host, options.port}},
+                                             std::chrono::seconds(5), std::chrono::milliseconds(250));
+            if (s == INVALID_SOCKET) {
+                ++connectErrors;
+                return;
+            }
+            socketSetNoDelay(s);
+            socketSetNonBlocking(s, true);
+            Connection& conn = connections[record.connectionId];
+            conn.socket = s;
+            conn.id = record.connectionId;
+            break;
+        }
+        case CaptureCommand: {
+            auto it = connections.find(record.connectionId);
+            if (it == connections.end() || it->second.closing) {
+                // Opened before the capture started, or its connect failed.
+                ++commandsWithoutConnection;
+                return;
+            }
+            std::string line = rewrite(record.command);
+            ++sent[commandKind(line)];
+            it->second.outbound += line + "\n";
+            flush(it->second);
+            break;
+        }
+        case CaptureClosed: {
+            auto it = connections.find(record.connectionId);
+            if (it != connections.end()) {
+                it->second.closing = true;
+                flush(it->second);
+            }
+            break;
+        }
+        case CaptureDropped:
+            droppedInCapture += record.connectionId;
+            break;
+        }
+    }
+
+    void flush(Connection& conn) {
+        while (!conn.outbound.empty()) {
+            int n = send(conn.socket, conn.outbound.data(), (int)conn.outbound.size(), NET_SEND_FLAGS);
+            if (n == SOCKET_ERROR) {
+                if (!socketWouldBlock(socketLastError())) {
+                    ++sendErrors;
+                    conn.outbound.clear();
+                }
+                return;
+            }
+            conn.outbound.erase(0, (size_t)n);
+        }
+        if (conn.closing) {
+            shutdown(conn.socket, 1);  // SD_SEND / SHUT_WR
+        }
+    }
+
+    // Reads (and counts) whatever the server sent and finishes pending writes.
+    void pump(int timeoutMs) {
+        if (connections.empty()) {
+            if (timeoutMs > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            }
+            return;
+        }
+
+        fds.clear();
+        owners.clear();
+        for (auto& entry : connections) {
+            pollfd fd = {};
+            fd.fd = entry.second.socket;
+            fd.events = POLLIN | (entry.second.outbound.empty() ? 0 : POLLOUT);
+            fds.push_back(fd);
+            owners.push_back(&entry.second);
+        }
+        if (socketPoll(fds.data(), (unsigned long)fds.size(), timeoutMs) <= 0) {
+            return;
+        }
+
+        char buffer[16384];
+        for (size_t i = 0; i < fds.size(); ++i) {
+            Connection& conn = *owners[i];
+            if (fds[i].revents & POLLOUT) {
+                flush(conn);
+            }
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+                continue;
+            }
+            int received = recv(conn.socket, buffer, sizeof(buffer), 0);
+            if (received == SOCKET_ERROR && socketWouldBlock(socketLastError())) {
+                continue;
+            }
+            if (received <= 0) {
+                finished.push_back(conn.id);
+                continue;
+            }
+            bytesReceived += (unsigned long long)received;
+            conn.inbound.append(buffer, (size_t)received);
+            size_t start = 0;
+            size_t pos;
+            while ((pos = conn.inbound.find('\n', start)) != std::string::npos) {
+                ++receivedFrames[commandKind(conn.inbound.substr(start, std::min<size_t>(pos - start, 32)))];
+                start = pos + 1;
+            }
+            conn.inbound.erase(0, start);
+        }
+
+        for (uint32_t id : finished) {
+            closesocket(connections[id].socket);
+            connections.erase(id);
+        }
+        finished.clear();
+    }
+
+    static void printCounts(const char* name, const std::map<std::string, unsigned long long>& counts) {
+        std::printf("  \"%s\": {", name);
+        bool first = true;
+        for (const auto& entry : counts) {
+            std::printf("%s\"%s\": %llu", first ? "" : ", ", entry.first.c_str(), entry.second);
+            first = false;
+        }
+        std::printf("},\n");
+    }
+
+    void report() {
+        HistogramSnapshot snap = lag->snapshot();
+        std::printf("{\n");
+        std::printf("  \"capture\": {\"path\": \"%s\", \"records\": %llu, \"connections\": %zu, "
+                    "\"span_s\": %.3f, \"text_redacted\": %s, \"dropped_records\": %llu},\n",
+                    options.path, records, capturedConnections, spanUs / 1e6,
+                    textRedacted ? "true" : "false", droppedInCapture);
+        std::printf("  \"speed\": %g,\n", options.speed);
+        std::printf("  \"replay_s\": %.3f,\n", replaySeconds);
+        printCounts("commands_sent", sent);
+        printCounts("frames_received", receivedFrames);
+        std::printf("  \"bytes_received\": %llu,\n", bytesReceived);
+        std::printf("  \"schedule_lag_us\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu},\n",
+                    (unsigned long long)snap.percentile(0.50), (unsigned long long)snap.percentile(0.99),
+                    (unsigned long long)snap.max());
+        std::printf("  \"errors\": {\"connect\": %llu, \"send\": %llu, \"no_connection\": %llu}\n",
+                    connectErrors, sendErrors, commandsWithoutConnection);
+        std::printf("}\n");
+    }
+
+    const Options& options;
+    std::unique_ptr<Histogram> lag;
+    std::unordered_map<uint32_t, Connection> connections;
+    std::vector<pollfd> fds;
+    std::vector<Connection*> owners;
+    std::vector<uint32_t> finished;
+    Clock::time_point started;
+
+    unsigned long long records;
+    unsigned long long connectErrors;
+    unsigned long long sendErrors;
+    unsigned long long commandsWithoutConnection = 0;
+    unsigned long long droppedInCapture;
+    unsigned long long bytesReceived;
+    std::map<std::string, unsigned long long> sent;
+    std::map<std::string, unsigned long long> receivedFrames;
+    uint64_t spanUs;
+    size_t capturedConnections = 0;
+    bool textRedacted = false;
+    double replaySeconds = 0;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s <capture> [--host H] [--port P] [--speed X] [--password PW] "
+                     "[--drain SECONDS] [--no-register]\n", argv[0]);
+        return 2;
+    }
+
+    SocketRuntime runtime;
+    Replayer replayer(options);
+    return replayer.run();
+}
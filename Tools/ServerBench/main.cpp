@@ -0,0 +1,242 @@
+// Microbenchmarks for the server's per-message hot paths: protocol
+// encode/decode, command dispatch, recipient lookup, the user list,
+// broadcast and channel fanout. Sockets are replaced by an in-memory sink and the
+// database is never opened, so the numbers are routing cost only.
+//
+//   ServerBench [--benchmark_filter=REGEX] [--benchmark_min_time=SECONDS] [--benchmark_format=json]
+
+#include "server.hpp"
+#include "microbench.hpp"
+
+#include <map>
+
+namespace {
+
+// ChatServer whose sends land in memory. Users "user0".."userN-1" are
+// logged in on fake sockets that never reach the OS.
+class BenchServer : public ChatServer {
+public:
+    explicit BenchServer(int users) : ChatServer(0), bytesSent(0), framesSent(0) {
+        for (int i = 0; i < users; ++i) {
+            auto conn = std::make_shared<Connection>();
+            conn->socket = (SOCKET)(100000 + i);
+            conn->id = (uint32_t)(i + 1);
+            conn->ip = "127.0.0.1";
+            conn->connectedAt = std::chrono::system_clock::now();
+            addOnlineUser(conn, username(i));
+            connections.push_back(conn);
+        }
+        observer = std::make_shared<Connection>();
+        observer->socket = (SOCKET)99999;
+    }
+
+    static std::string username(int index) {
+        return "user" + std::to_string(index);
+    }
+
+    // A connection that is not logged in, for replies that go nowhere.
+    const std::shared_ptr<Connection>& spectator() const {
+        return observer;
+    }
+
+    const std::shared_ptr<Connection>& connection(int index) const {
+        return connections[index];
+    }
+
+    // "#cN" with user0..userN-1 as members; only the in-memory index is
+    // filled, since the database is never opened.
+    std::string channelWithMembers(int members) {
+        std::string name = "#c" + std::to_string(members);
+        for (int i = 0; i < members; ++i) {
+            channels.join(name, username(i));
+        }
+        return name;
+    }
+
+    using ChatServer::dispatchCommands;
+    using ChatServer::handleCommand;
+    using ChatServer::processMessage;
+    using ChatServer::broadcastMessage;
+    using ChatServer::sendUserList;
+
+    unsigned long long bytesSent;
+    unsigned long long framesSent;
+
+protected:
+    int sendToSocket(Connection&, const char* data, int length) override {
+        bytesSent += (unsigned long long)length;
+        ++framesSent;
+        microbench::DoNotOptimize(data[length - 1]);
+        return length;
+    }
+
+private:
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::shared_ptr<Connection> observer;
+};
+
+// Logging in N users publishes N snapshots, so servers are built once per
+// size and shared; none of the benchmarks change who is online.
+BenchServer& serverWithUsers(int users) {
+    static std::map<int, std::unique_ptr<BenchServer>> servers;
+    auto& server = servers[users];
+    if (!server) {
+        server.reset(new BenchServer(users));
+    }
+    return *server;
+}
+
+std::string textOfSize(int64_t bytes) {
+    std::string text;
+    text.reserve((size_t)bytes);
+    for (int64_t i = 0; i < bytes; ++i) {
+        text.push_back((char)('a' + i % 26));
+    }
+    return text;
+}
+
+Message directMessage(int users, int64_t textBytes) {
+    Message msg(BenchServer::username(users - 1), BenchServer::username(0), textOfSize(textBytes), "text");
+    msg.Id = 123456;
+    return msg;
+}
+
+void BM_MessageGetMessage(microbench::State& state) {
+    std::string data = directMessage(2, state.range(0)).getData();
+    for (auto _ : state) {
+        Message msg = Message::getMessage(data);
+        microbench::DoNotOptimize(msg);
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+    state.SetBytesProcessed((int64_t)(state.iterations() * data.size()));
+}
+BENCHMARK(BM_MessageGetMessage)->ArgName("bytes")->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_MessageGetData(microbench::State& state) {
+    Message msg = directMessage(2, state.range(0));
+    size_t size = msg.getData().size();
+    for (auto _ : state) {
+        std::string data = msg.getData();
+        microbench::DoNotOptimize(data);
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+    state.SetBytesProcessed((int64_t)(state.iterations() * size));
+}
+BENCHMARK(BM_MessageGetData)->ArgName("bytes")->Arg(16)->Arg(256)->Arg(4096);
+
+// One command of each kind that needs neither the database nor a change of
+// who is online, sent by a logged-in user.
+const char* const kCommands[] = {
+    "MESSAGE:user0;user1;hello there;text",
+    "GET_USERS",
+    "SYNC:0",
+    "HISTORY:0:50",
+    "UNBAN:nobody",
+    "PING"
+};
+
+void BM_HandleCommand(microbench::State& state) {
+    BenchServer& server = serverWithUsers(100);
+    std::string command = kCommands[state.range(0)];
+    auto receivedAt = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        server.handleCommand(server.connection(0), command, receivedAt);
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+    state.SetLabel(command.substr(0, command.find(':')));
+}
+BENCHMARK(BM_HandleCommand)->ArgName("command")->Arg(0)->Arg(1)->Arg(2)->Arg(3)->Arg(4)->Arg(5);
+
+// A recv()-sized chunk of direct messages split into frames and handled.
+void BM_DispatchCommands(microbench::State& state) {
+    int users = (int)state.range(0);
+    BenchServer& server = serverWithUsers(users);
+    std::string frame = "MESSAGE:" + directMessage(users, state.range(1)).getData() + "\n";
+
+    std::string chunk;
+    int frames = 0;
+    do {
+        chunk += frame;
+        ++frames;
+    } while (chunk.size() + frame.size() <= 4096);
+
+    auto receivedAt = std::chrono::steady_clock::now();
+    std::string pending;
+    for (auto _ : state) {
+        pending = chunk;
+        server.dispatchCommands(server.connection(0), pending, receivedAt);
+    }
+    state.SetItemsProcessed((int64_t)(state.iterations() * frames));
+    state.SetBytesProcessed((int64_t)(state.iterations() * chunk.size()));
+}
+BENCHMARK(BM_DispatchCommands)->ArgNames({"users", "bytes"})->ArgsProduct({{10, 1000, 10000}, {16, 256}});
+
+// Recipients are looked up by name, so this should not grow with users.
+void BM_ProcessMessageDirect(microbench::State& state) {
+    int users = (int)state.range(0);
+    BenchServer& server = serverWithUsers(users);
+    Message msg = directMessage(users, state.range(1));
+    for (auto _ : state) {
+        server.processMessage(msg);
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_ProcessMessageDirect)->ArgNames({"users", "bytes"})->ArgsProduct({{10, 100, 1000, 10000}, {16, 4096}});
+
+void BM_ProcessMessageOffline(microbench::State& state) {
+    int users = (int)state.range(0);
+    BenchServer& server = serverWithUsers(users);
+    Message msg = directMessage(users, 16);
+    msg.Getter = "offline";
+    for (auto _ : state) {
+        server.processMessage(msg);
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_ProcessMessageOffline)->ArgName("users")->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+
+void BM_SendUserList(microbench::State& state) {
+    BenchServer& server = serverWithUsers((int)state.range(0));
+    unsigned long long before = server.bytesSent;
+    for (auto _ : state) {
+        server.sendUserList(*server.spectator());
+    }
+    state.SetItemsProcessed((int64_t)state.iterations());
+    state.SetBytesProcessed((int64_t)(server.bytesSent - before));
+}
+BENCHMARK(BM_SendUserList)->ArgName("users")->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Items are delivered frames, so items/s is the fanout rate.
+void BM_BroadcastMessage(microbench::State& state) {
+    int users = (int)state.range(0);
+    BenchServer& server = serverWithUsers(users);
+    Message msg = directMessage(users, state.range(1));
+    msg.Getter = "ALL";
+    unsigned long long framesBefore = server.framesSent;
+    unsigned long long bytesBefore = server.bytesSent;
+    for (auto _ : state) {
+        server.broadcastMessage(msg, msg.Sender);
+    }
+    state.SetItemsProcessed((int64_t)(server.framesSent - framesBefore));
+    state.SetBytesProcessed((int64_t)(server.bytesSent - bytesBefore));
+}
+BENCHMARK(BM_BroadcastMessage)->ArgNames({"users", "bytes"})->ArgsProduct({{10, 100, 1000, 10000}, {16, 256, 4096}});
+
+// Cost should follow the channel size, not the number of users online.
+void BM_ChannelMessage(microbench::State& state) {
+    int users = (int)state.range(0);
+    BenchServer& server = serverWithUsers(users);
+    Message msg = directMessage(users, 256);
+    msg.Sender = BenchServer::username(0);
+    msg.Getter = server.channelWithMembers((int)std::min<int64_t>(state.range(1), users));
+    unsigned long long framesBefore = server.framesSent;
+    for (auto _ : state) {
+        server.processMessage(msg);
+    }
+    state.SetItemsProcessed((int64_t)(server.framesSent - framesBefore));
+}
+BENCHMARK(BM_ChannelMessage)->ArgNames({"users", "members"})->ArgsProduct({{100, 10000}, {10, 100}});
+
+} // namespace
+
+BENCHMARK_MAIN();
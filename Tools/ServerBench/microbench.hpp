@@ -0,0 +1,370 @@
+#ifndef MICROBENCH_HPP
+#define MICROBENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+// The subset of Google Benchmark's interface these benchmarks use, so they
+// build with nothing but the standard library:
+//
+//   static void BM_Thing(microbench::State& state) {
+//       Setup setup(state.range(0));
+//       for (auto _ : state) {
+//           microbench::DoNotOptimize(work(setup));
+//       }
+//       state.SetItemsProcessed(state.iterations());
+//   }
+//   BENCHMARK(BM_Thing)->ArgName("users")->Arg(10)->Arg(1000);
+//
+// Each benchmark is re-run with more iterations until one run takes
+// --benchmark_min_time seconds; that run is reported.
+namespace microbench {
+
+template <typename T>
+inline void DoNotOptimize(T&& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+inline void ClobberMemory() {
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#endif
+}
+
+class State {
+public:
+    State(const std::vector<int64_t>& args, uint64_t iterations)
+        : args(args), maxIterations(iterations), items(0), bytes(0), wallSeconds(0), cpuSeconds(0) {}
+
+    int64_t range(size_t index = 0) const {
+        return index < args.size() ? args[index] : 0;
+    }
+
+    uint64_t iterations() const {
+        return maxIterations;
+    }
+
+    void SetItemsProcessed(int64_t count) {
+        items = count;
+    }
+
+    void SetBytesProcessed(int64_t count) {
+        bytes = count;
+    }
+
+    void SetLabel(const std::string& text) {
+        label = text;
+    }
+
+    struct
+#if defined(__GNUC__)
+    __attribute__((unused))
+#endif
+    Value {};
+
+    class Iterator {
+    public:
+        Iterator(State* state, uint64_t remaining) : state(state), remaining(remaining) {}
+
+        Value operator*() const {
+            return Value();
+        }
+
+        Iterator& operator++() {
+            --remaining;
+            return *this;
+        }
+
+        bool operator!=(const Iterator&) {
+            if (remaining > 0) {
+                return true;
+            }
+            state->stopTimer();
+            return false;
+        }
+
+    private:
+        State* state;
+        uint64_t remaining;
+    };
+
+    Iterator begin() {
+        startTimer();
+        return Iterator(this, maxIterations);
+    }
+
+    Iterator end() {
+        return Iterator(this, 0);
+    }
+
+private:
+    friend class Runner;
+
+    void startTimer() {
+        wallStarted = std::chrono::steady_clock::now();
+        cpuStarted = std::clock();
+    }
+
+    void stopTimer() {
+        wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStarted).count();
+        cpuSeconds = (double)(std::clock() - cpuStarted) / CLOCKS_PER_SEC;
+    }
+
+    std::vector<int64_t> args;
+    uint64_t maxIterations;
+    int64_t items;
+    int64_t bytes;
+    std::string label;
+    std::chrono::steady_clock::time_point wallStarted;
+    std::clock_t cpuStarted;
+    double wallSeconds;
+    double cpuSeconds;
+};
+
+class Benchmark {
+public:
+    typedef void (*Function)(State&);
+
+    Benchmark(const char* name, Function function) : name(name), function(function) {}
+
+    Benchmark* Arg(int64_t value) {
+        argSets.push_back({value});
+        return this;
+    }
+
+    Benchmark* Args(std::initializer_list<int64_t> values) {
+        argSets.push_back(values);
+        return this;
+    }
+
+    Benchmark* ArgName(const std::string& argName) {
+        argNames = {argName};
+        return this;
+    }
+
+    Benchmark* ArgNames(std::initializer_list<std::string> names) {
+        argNames = names;
+        return this;
+    }
+
+    // Every combination, first list varying slowest.
+    Benchmark* ArgsProduct(const std::vector<std::vector<int64_t>>& lists) {
+        std::vector<std::vector<int64_t>> product(1);
+        for (const auto& list : lists) {
+            std::vector<std::vector<int64_t>> next;
+            for (const auto& prefix : product) {
+                for (int64_t value : list) {
+                    next.push_back(prefix);
+                    next.back().push_back(value);
+                }
+            }
+            product.swap(next);
+        }
+        argSets.insert(argSets.end(), product.begin(), product.end());
+        return this;
+    }
+
+private:
+    friend class Runner;
+
+    std::string name;
+    Function function;
+    std::vector<std::string> argNames;
+    std::vector<std::vector<int64_t>> argSets;
+};
+
+inline std::vector<std::unique_ptr<Benchmark>>& registry() {
+    static std::vector<std::unique_ptr<Benchmark>> benchmarks;
+    return benchmarks;
+}
+
+inline Benchmark* RegisterBenchmark(const char* name, Benchmark::Function function) {
+    registry().emplace_back(new Benchmark(name, function));
+    return registry().back().get();
+}
+
+class Runner {
+public:
+    int run(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 19, "--benchmark_filter=") == 0) {
+                filter = arg.substr(19);
+            } else if (arg.compare(0, 21, "--benchmark_min_time=") == 0) {
+                minTime = std::max(0.001, std::atof(arg.c_str() + 21));
+            } else if (arg.compare(0, 19, "--benchmark_format=") == 0) {
+                json = arg.substr(19) == "json";
+            } else if (arg == "--benchmark_list_tests") {
+                listOnly = true;
+            } else {
+                std::fprintf(stderr, "usage: %s [--benchmark_filter=REGEX] [--benchmark_min_time=SECONDS] "
+                             "[--benchmark_format=console|json] [--benchmark_list_tests]\n", argv[0]);
+                return 2;
+            }
+        }
+
+        std::regex pattern(filter.empty() ? "." : filter);
+        bool first = true;
+        if (json && !listOnly) {
+            std::printf("{\n  \"benchmarks\": [");
+        } else if (!listOnly) {
+            std::printf("%-48s %14s %14s %12s %s\n", "Benchmark", "Time", "CPU", "Iterations", "Counters");
+            std::printf("%s\n", std::string(110, '-').c_str());
+        }
+
+        for (const auto& benchmark : registry()) {
+            std::vector<std::vector<int64_t>> argSets = benchmark->argSets;
+            if (argSets.empty()) {
+                argSets.push_back({});
+            }
+            for (const auto& args : argSets) {
+                std::string name = runName(*benchmark, args);
+                if (!std::regex_search(name, pattern)) {
+                    continue;
+                }
+                if (listOnly) {
+                    std::printf("%s\n", name.c_str());
+                    continue;
+                }
+                State state = measure(*benchmark, args);
+                if (json) {
+                    printJson(name, state, first);
+                } else {
+                    printConsole(name, state);
+                }
+                first = false;
+                std::fflush(stdout);
+            }
+        }
+
+        if (json && !listOnly) {
+            std::printf("\n  ]\n}\n");
+        }
+        return 0;
+    }
+
+private:
+    static std::string runName(const Benchmark& benchmark, const std::vector<int64_t>& args) {
+        std::string name = benchmark.name;
+        for (size_t i = 0; i < args.size(); ++i) {
+            name += "/";
+            if (i < benchmark.argNames.size()) {
+                name += benchmark.argNames[i] + ":";
+            }
+            name += std::to_string(args[i]);
+        }
+        return name;
+    }
+
+    State measure(const Benchmark& benchmark, const std::vector<int64_t>& args) const {
+        uint64_t iterations = 1;
+        for (;;) {
+            State state(args, iterations);
+            benchmark.function(state);
+            if (state.wallSeconds >= minTime || iterations >= 1000000000ull) {
+                return state;
+            }
+            // Aim past the target so the next run usually is the last one.
+            double scale = state.wallSeconds > 0 ? minTime * 1.4 / state.wallSeconds : 10.0;
+            scale = std::min(10.0, std::max(2.0, scale));
+            iterations = (uint64_t)((double)iterations * scale);
+        }
+    }
+
+    static std::string formatTime(double seconds) {
+        char text[32];
+        if (seconds < 1e-6) {
+            std::snprintf(text, sizeof(text), "%.1f ns", seconds * 1e9);
+        } else if (seconds < 1e-3) {
+            std::snprintf(text, sizeof(text), "%.2f us", seconds * 1e6);
+        } else {
+            std::snprintf(text, sizeof(text), "%.2f ms", seconds * 1e3);
+        }
+        return text;
+    }
+
+    static std::string formatRate(double perSecond, const char* unit) {
+        static const char* const prefixes[] = {"", "k", "M", "G", "T"};
+        int prefix = 0;
+        while (perSecond >= 1000 && prefix < 4) {
+            perSecond /= 1000;
+            ++prefix;
+        }
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.3g%s%s/s", perSecond, prefixes[prefix], unit);
+        return text;
+    }
+
+    static void printConsole(const std::string& name, const State& state) {
+        double perIteration = 1.0 / (double)state.maxIterations;
+        std::string counters;
+        if (state.items > 0 && state.wallSeconds > 0) {
+            counters += "items_per_second=" + formatRate(state.items / state.wallSeconds, "") + " ";
+        }
+        if (state.bytes > 0 && state.wallSeconds > 0) {
+            counters += "bytes_per_second=" + formatRate(state.bytes / state.wallSeconds, "B") + " ";
+        }
+        counters += state.label;
+        std::printf("%-48s %14s %14s %12llu %s\n", name.c_str(),
+                    formatTime(state.wallSeconds * perIteration).c_str(),
+                    formatTime(state.cpuSeconds * perIteration).c_str(),
+                    (unsigned long long)state.maxIterations, counters.c_str());
+    }
+
+    static void printJson(const std::string& name, const State& state, bool first) {
+        double perIteration = 1.0 / (double)state.maxIterations;
+        std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"real_time_ns\": %.3f, \"cpu_time_ns\": %.3f",
+                    first ? "" : ",", name.c_str(), (unsigned long long)state.maxIterations,
+                    state.wallSeconds * perIteration * 1e9, state.cpuSeconds * perIteration * 1e9);
+        if (state.items > 0 && state.wallSeconds > 0) {
+            std::printf(", \"items_per_second\": %.1f", state.items / state.wallSeconds);
+        }
+        if (state.bytes > 0 && state.wallSeconds > 0) {
+            std::printf(", \"bytes_per_second\": %.1f", state.bytes / state.wallSeconds);
+        }
+        if (!state.label.empty()) {
+            std::printf(", \"label\": \"%s\"", state.label.c_str());
+        }
+        std::printf("}");
+    }
+
+    std::string filter;
+    double minTime = 0.5;
+    bool json = false;
+    bool listOnly = false;
+};
+
+inline int RunSpecifiedBenchmarks(int argc, char* argv[]) {
+    return Runner().run(argc, argv);
+}
+
+} // namespace microbench
+
+#define MICROBENCH_CONCAT_(a, b) a##b
+#define MICROBENCH_CONCAT(a, b) MICROBENCH_CONCAT_(a, b)
+
+#define BENCHMARK(function) \
+    static microbench::Benchmark* MICROBENCH_CONCAT(benchmark_registration_, __LINE__) = \
+        microbench::RegisterBenchmark(#function, function)
+
+#define BENCHMARK_MAIN() \
+    int main(int argc, char* argv[]) { \
+        return microbench::RunSpecifiedBenchmarks(argc, argv); \
+    }
+
+#endif
@@ -0,0 +1,23 @@
+TEMPLATE = app
+
+QT += core sql
+QT -= gui
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../ServerPart
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ../../ServerPart/server.hpp
+
+win32 {
+    LIBS += -lws2_32 -lpsapi
+    DEFINES += _WINSOCK_DEPRECATED_NO_WARNINGS WIN32_LEAN_AND_MEAN NOMINMAX
+}
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
+QMAKE_CXXFLAGS += -Wno-unused-parameter
@@ -0,0 +1,185 @@
+// Behavioural checks for ChatServer's command handling, run without
+// sockets or a database like ServerBench. Prints one line per check and
+// exits non-zero if any failed.
+//
+//   ServerChecks
+
+#include "server.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <map>
+
+namespace {
+
+// Connections are fake sockets; every frame written to one is kept so
+// checks can look at what each connection was sent.
+class CheckServer : public ChatServer {
+public:
+    CheckServer() : ChatServer(0), nextSocket(1000) {}
+
+    std::shared_ptr<Connection> connect(const std::string& ip = "10.0.0.1") {
+        auto conn = std::make_shared<Connection>();
+        conn->socket = (SOCKET)nextSocket++;
+        conn->id = (uint32_t)conn->socket;
+        conn->ip = ip;
+        conn->connectedAt = std::chrono::system_clock::now();
+        conn->ipBucket = rateLimiter().ipBucket(ip);
+        return conn;
+    }
+
+    std::shared_ptr<Connection> login(const std::string& username) {
+        auto conn = connect();
+        addOnlineUser(conn, username);
+        return conn;
+    }
+
+    void command(const std::shared_ptr<Connection>& conn, const std::string& line) {
+        handleCommand(conn, line, std::chrono::steady_clock::now());
+    }
+
+    // Frames sent to `conn` that start with `prefix`.
+    int framesTo(const std::shared_ptr<Connection>& conn, const std::string& prefix) {
+        int count = 0;
+        for (const auto& frame : sent[conn->socket]) {
+            if (frame.compare(0, prefix.size(), prefix) == 0) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    void joinChannel(const std::string& channel, const std::string& username) {
+        channels.join(channel, username);
+    }
+
+    double metric(const std::string& series) {
+        std::string text = metricsRegistry().renderPrometheus();
+        size_t at = text.find("\n" + series + " ");
+        return at == std::string::npos ? -1 : std::atof(text.c_str() + at + series.size() + 2);
+    }
+
+protected:
+    int sendToSocket(Connection& conn, const char* data, int length) override {
+        std::string& pending = partial[conn.socket];
+        pending.append(data, (size_t)length);
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            sent[conn.socket].push_back(pending.substr(start, end - start));
+            start = end + 1;
+        }
+        pending.erase(0, start);
+        return length;
+    }
+
+private:
+    int nextSocket;
+    std::map<SOCKET, std::string> partial;
+    std::map<SOCKET, std::vector<std::string>> sent;
+};
+
+int failures = 0;
+
+void expect(const char* check, bool ok, const std::string& detail) {
+    std::printf("%s %s%s%s\n", ok ? "PASS" : "FAIL", check, ok ? "" : ": ", ok ? "" : detail.c_str());
+    if (!ok) {
+        ++failures;
+    }
+}
+
+std::string counts(int got, int want) {
+    return "got " + std::to_string(got) + ", want " + std::to_string(want);
+}
+
+void configureLimits(CheckServer& server) {
+    const double costs[3] = {1, 1, 3};
+    RateLimit perUser;
+    perUser.perSecond = 20;
+    perUser.burst = 60;
+    server.rateLimiter().configure(perUser, RateLimit(), costs);
+}
+
+// No session means nothing is logged or routed, however many are sent,
+// and the flood gets a single reply.
+void checkUnauthenticatedFlood() {
+    CheckServer server;
+    configureLimits(server);
+    auto bob = server.login("bob");
+    auto stranger = server.connect();
+
+    for (int i = 0; i < 1000; ++i) {
+        server.command(stranger, "MESSAGE:alice;bob;spam;Low");
+        server.command(stranger, "MESSAGE:alice;ALL;spam;High");
+    }
+    expect("unauthenticated flood is not delivered", server.framesTo(bob, "MESSAGE:") == 0,
+           counts(server.framesTo(bob, "MESSAGE:"), 0));
+    expect("unauthenticated flood gets one reply", server.framesTo(stranger, "MESSAGE_FAILED:") == 1,
+           counts(server.framesTo(stranger, "MESSAGE_FAILED:"), 1));
+    double refused = server.metric("chat_messages_refused_total{reason=\"no_session\"}");
+    expect("unauthenticated flood is counted", refused == 2000, "got " + std::to_string(refused));
+}
+
+// A logged-in sender gets the burst through and no more.
+void checkUserBucket() {
+    CheckServer server;
+    configureLimits(server);
+    auto alice = server.login("alice");
+    auto bob = server.login("bob");
+
+    for (int i = 0; i < 100; ++i) {
+        server.command(alice, "MESSAGE:alice;bob;hello;Low");
+    }
+    expect("user burst is delivered", server.framesTo(bob, "MESSAGE:") == 60,
+           counts(server.framesTo(bob, "MESSAGE:"), 60));
+    expect("user flood gets one RATE_LIMITED", server.framesTo(alice, "RATE_LIMITED:user") == 1,
+           counts(server.framesTo(alice, "RATE_LIMITED:user"), 1));
+
+    // Shared by the user's sessions: a second device has no fresh bucket.
+    auto aliceAgain = server.login("alice");
+    server.command(aliceAgain, "MESSAGE:alice;bob;hello;Low");
+    expect("user bucket is shared by sessions", server.framesTo(bob, "MESSAGE:") == 60,
+           counts(server.framesTo(bob, "MESSAGE:"), 60));
+}
+
+// The Sender in the payload has to be the session's user.
+void checkSpoofedSender() {
+    CheckServer server;
+    auto mallory = server.login("mallory");
+    auto bob = server.login("bob");
+
+    server.command(mallory, "MESSAGE:alice;bob;it is me;Low");
+    expect("spoofed sender is not delivered", server.framesTo(bob, "MESSAGE:") == 0,
+           counts(server.framesTo(bob, "MESSAGE:"), 0));
+    expect("spoofed sender is refused", server.framesTo(mallory, "MESSAGE_FAILED:") == 1,
+           counts(server.framesTo(mallory, "MESSAGE_FAILED:"), 1));
+}
+
+// Channel membership is checked for the session's user, so naming a
+// member as Sender does not get an outsider into the channel.
+void checkChannelOutsider() {
+    CheckServer server;
+    server.joinChannel("#ops", "alice");
+    server.joinChannel("#ops", "bob");
+    auto bob = server.login("bob");
+    auto mallory = server.login("mallory");
+
+    server.command(mallory, "MESSAGE:alice;#ops;it is me;Low");
+    server.command(mallory, "MESSAGE:mallory;#ops;let me in;Low");
+    expect("outsider is not delivered to a channel", server.framesTo(bob, "MESSAGE:") == 0,
+           counts(server.framesTo(bob, "MESSAGE:"), 0));
+    expect("outsider is told they are not a member", server.framesTo(mallory, "CHANNEL_FAILED:#ops:") == 1,
+           counts(server.framesTo(mallory, "CHANNEL_FAILED:#ops:"), 1));
+}
+
+} // namespace
+
+int main() {
+    checkUnauthenticatedFlood();
+    checkUserBucket();
+    checkSpoofedSender();
+    checkChannelOutsider();
+
+    std::printf("%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
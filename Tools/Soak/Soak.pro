@@ -0,0 +1,11 @@
+TEMPLATE = app
+
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+include(../../ClientCore/ClientCore.pri)
+
+SOURCES += \
+    main.cpp
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
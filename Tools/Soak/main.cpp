@@ -0,0 +1,479 @@
+// Connection-scaling soak test for ChatServer. Worker threads cycle
+// connect / login / disconnect as fast as the server lets them; every
+// sample interval the workers pause, the server is left to settle, and its
+// /metrics page (CHAT_METRICS_PORT) is scraped for resident memory,
+// threads, open fds and unjoined handler threads. A batch of connections is
+// then held open to measure memory per connection.
+//
+//   Soak --port 8888 --metrics-port 9464 --workers 32 --cycles 300000 --duration 14400
+//
+// Exits 1 if, after warm-up, the idle samples keep growing: the median of
+// the last third is compared with the median of the first third.
+
+#include "clientpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    unsigned short port = 8888;
+    unsigned short metricsPort = 9464;
+    int workers = 32;
+    long long cycles = 300000;
+    double duration = 4 * 3600;
+    double interval = 60;
+    int hold = 500;
+    double warmup = 0.2;
+    double maxRssGrowthMb = 64;
+    double slack = 16;
+    std::string prefix = "soak";
+    std::string password = "soak";
+};
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = (unsigned short)std::atoi(argv[++i]);
+        } else if (arg == "--metrics-port" && hasValue) {
+            options.metricsPort = (unsigned short)std::atoi(argv[++i]);
+        } else if (arg == "--workers" && hasValue) {
+            options.workers = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--cycles" && hasValue) {
+            options.cycles = std::max(1LL, std::atoll(argv[++i]));
+        } else if (arg == "--duration" && hasValue) {
+            options.duration = std::atof(argv[++i]);
+        } else if (arg == "--interval" && hasValue) {
+            options.interval = std::max(1.0, std::atof(argv[++i]));
+        } else if (arg == "--hold" && hasValue) {
+            options.hold = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--warmup" && hasValue) {
+            options.warmup = std::min(0.9, std::max(0.0, std::atof(argv[++i])));
+        } else if (arg == "--max-rss-growth-mb" && hasValue) {
+            options.maxRssGrowthMb = std::atof(argv[++i]);
+        } else if (arg == "--slack" && hasValue) {
+            options.slack = std::atof(argv[++i]);
+        } else if (arg == "--prefix" && hasValue) {
+            options.prefix = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return options.port != 0 && options.metricsPort != 0;
+}
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// GET /metrics and keep the unlabelled samples by name.
+bool scrapeMetrics(const Options& options, std::map<std::string, double>& values) {
+    SOCKET s = connectFirstAvailable({Endpoint{options.host, options.metricsPort}},
+                                     std::chrono::seconds(5), std::chrono::milliseconds(250));
+    if (s == INVALID_SOCKET) {
+        return false;
+    }
+
+    std::string request = "GET /metrics HTTP/1.0\r\nHost: " + options.host + "\r\n\r\n";
+    send(s, request.c_str(), (int)request.size(), NET_SEND_FLAGS);
+
+    std::string response;
+    char buffer[4096];
+    int received;
+    while ((received = recv(s, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, (size_t)received);
+    }
+    closesocket(s);
+
+    size_t body = response.find("\r\n\r\n");
+    if (response.compare(0, 12, "HTTP/1.0 200") != 0 || body == std::string::npos) {
+        return false;
+    }
+
+    values.clear();
+    std::istringstream lines(response.substr(body + 4));
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t space = line.find(' ');
+        if (line.empty() || line[0] == '#' || space == std::string::npos ||
+            line.find('{') < space) {
+            continue;
+        }
+        values[line.substr(0, space)] = std::atof(line.c_str() + space + 1);
+    }
+    return true;
+}
+
+struct Sample {
+    double elapsed = 0;
+    long long cycles = 0;
+    double rss = 0;
+    double threads = 0;
+    double fds = 0;
+    double handlerThreads = 0;
+    double bytesPerConnection = 0;
+};
+
+// One simulated user logging in and out in a loop on its own thread.
+class Worker {
+public:
+    Worker(const Options& options, const std::string& username)
+        : options(options), username(username), result(-1) {
+        client.setAutoReconnect(false);
+        client.setRegisterHandler([this](bool success, const std::string&) { finish(success); });
+        client.setLoginHandler([this](bool success, const std::string&) { finish(success); });
+        client.setBannedHandler([this](const std::string&) { finish(false); });
+    }
+
+    // Registers the user; "already exists" from an earlier run is fine.
+    bool prepare() {
+        if (!client.connectToServer(options.host, options.port)) {
+            return false;
+        }
+        reset();
+        client.registerUser(username, options.password, username);
+        wait(std::chrono::seconds(10));
+        client.disconnect();
+        return true;
+    }
+
+    // connect, LOGIN, wait for the answer, disconnect.
+    bool cycle() {
+        if (!client.connectToServer(options.host, options.port)) {
+            return false;
+        }
+        reset();
+        client.login(username, options.password);
+        bool ok = wait(std::chrono::seconds(10)) == 1;
+        client.disconnect();
+        return ok;
+    }
+
+private:
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        result = -1;
+    }
+
+    void finish(bool success) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            result = success ? 1 : 0;
+        }
+        answered.notify_all();
+    }
+
+    int wait(std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        answered.wait_for(lock, timeout, [this] { return result >= 0; });
+        return result;
+    }
+
+    const Options& options;
+    std::string username;
+    std::mutex mutex;
+    std::condition_variable answered;
+    int result;
+    // Last, so its receive thread is joined before the state it reports to goes.
+    ChatClient client;
+};
+
+class Soak {
+public:
+    explicit Soak(const Options& options)
+        : options(options), stopping(false), paused(false), parked(0), cycles(0), failures(0) {}
+
+    int run() {
+        std::map<std::string, double> metrics;
+        if (!scrapeMetrics(options, metrics)) {
+            std::fprintf(stderr, "cannot read http://%s:%u/metrics; start the server with CHAT_METRICS_PORT\n",
+                         options.host.c_str(), options.metricsPort);
+            return 2;
+        }
+        baselineConnections = metrics["chat_connections"];
+
+        for (int i = 0; i < options.workers; ++i) {
+            workers.emplace_back(new Worker(options, options.prefix + std::to_string(i)));
+            if (!workers.back()->prepare()) {
+                std::fprintf(stderr, "cannot connect to %s:%u\n", options.host.c_str(), options.port);
+                return 2;
+            }
+        }
+
+        started = Clock::now();
+        std::vector<std::thread> threads;
+        for (auto& worker : workers) {
+            threads.emplace_back(&Soak::drive, this, worker.get());
+        }
+
+        std::printf("%9s %10s %9s %8s %8s %9s %12s\n",
+                    "elapsed_s", "cycles", "rss_MB", "threads", "fds", "handlers", "KB_per_conn");
+        auto nextSample = started;
+        while (!finished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            if (Clock::now() >= nextSample) {
+                takeSample();
+                nextSample = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.interval));
+            }
+        }
+
+        stopping = true;
+        resumeWorkers();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        takeSample();
+
+        return verdict();
+    }
+
+private:
+    bool finished() const {
+        return cycles >= options.cycles || secondsSince(started) >= options.duration;
+    }
+
+    void drive(Worker* worker) {
+        while (!stopping && !finished()) {
+            {
+                std::unique_lock<std::mutex> lock(pauseMutex);
+                if (paused) {
+                    ++parked;
+                    pauseChanged.notify_all();
+                    pauseChanged.wait(lock, [this] { return !paused || stopping; });
+                    --parked;
+                    continue;
+                }
+            }
+            if (worker->cycle()) {
+                ++cycles;
+            } else {
+                ++failures;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    void pauseWorkers() {
+        std::unique_lock<std::mutex> lock(pauseMutex);
+        paused = true;
+        pauseChanged.wait_for(lock, std::chrono::seconds(30), [this] {
+            return parked == (int)workers.size() || stopping;
+        });
+    }
+
+    void resumeWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(pauseMutex);
+            paused = false;
+        }
+        pauseChanged.notify_all();
+    }
+
+    // Waits until the server has closed every connection we opened.
+    bool settle(std::map<std::string, double>& metrics) {
+        auto deadline = Clock::now() + std::chrono::seconds(30);
+        while (scrapeMetrics(options, metrics)) {
+            if (metrics["chat_connections"] <= baselineConnections || Clock::now() >= deadline) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        return false;
+    }
+
+    void takeSample() {
+        pauseWorkers();
+
+        std::map<std::string, double> metrics;
+        if (settle(metrics)) {
+            Sample sample;
+            sample.elapsed = secondsSince(started);
+            sample.cycles = cycles;
+            sample.rss = metrics["process_resident_memory_bytes"];
+            sample.threads = metrics["process_threads"];
+            sample.fds = metrics["process_open_fds"];
+            sample.handlerThreads = metrics["chat_handler_threads"];
+            sample.bytesPerConnection = measureHeld(sample.rss);
+            samples.push_back(sample);
+
+            std::printf("%9.0f %10lld %9.1f %8.0f %8.0f %9.0f %12.1f\n",
+                        sample.elapsed, sample.cycles, sample.rss / 1048576.0, sample.threads, sample.fds,
+                        sample.handlerThreads, sample.bytesPerConnection / 1024.0);
+            std::fflush(stdout);
+        } else {
+            std::fprintf(stderr, "sample skipped: metrics endpoint unreachable\n");
+        }
+
+        if (!stopping) {
+            resumeWorkers();
+        }
+    }
+
+    // Logs in `hold` extra users at once and returns the server's resident
+    // memory growth per connection over `idleRss`.
+    double measureHeld(double idleRss) {
+        if (options.hold == 0) {
+            return 0;
+        }
+
+        ClientPool pool;
+        pool.start();
+        std::atomic<int> loggedIn(0);
+        std::vector<std::unique_ptr<ChatClient>> clients;
+        for (int i = 0; i < options.hold; ++i) {
+            std::unique_ptr<ChatClient> client(new ChatClient);
+            ChatClient* raw = client.get();
+            std::string username = options.prefix + "hold" + std::to_string(i);
+            client->setAutoReconnect(false);
+            client->setRegisterHandler([this, raw, username](bool, const std::string&) {
+                raw->login(username, options.password);
+            });
+            client->setLoginHandler([&loggedIn](bool success, const std::string&) {
+                if (success) {
+                    ++loggedIn;
+                }
+            });
+            if (client->connectDetached(options.host, options.port)) {
+                pool.add(raw);
+                client->registerUser(username, options.password, username);
+            }
+            clients.push_back(std::move(client));
+        }
+
+        auto deadline = Clock::now() + std::chrono::seconds(30);
+        while (loggedIn < options.hold && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        std::map<std::string, double> metrics;
+        double perConnection = 0;
+        if (loggedIn > 0 && scrapeMetrics(options, metrics)) {
+            perConnection = (metrics["process_resident_memory_bytes"] - idleRss) / loggedIn;
+        }
+
+        for (auto& client : clients) {
+            pool.remove(client.get());
+            client->disconnect();
+        }
+        pool.stop();
+
+        settle(metrics);
+        return perConnection;
+    }
+
+    static double median(std::vector<double> values) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    // Compares the first and last third of the post-warm-up samples.
+    int verdict() {
+        size_t first = std::min(samples.size(), (size_t)(samples.size() * options.warmup + 0.5) + 1);
+        size_t steady = samples.size() - first;
+        double elapsed = secondsSince(started);
+
+        std::printf("\n{\"cycles\": %lld, \"failed_cycles\": %lld, \"elapsed_s\": %.0f, \"cycles_per_s\": %.1f, "
+                    "\"samples\": %zu", (long long)cycles, (long long)failures, elapsed,
+                    elapsed > 0 ? cycles / elapsed : 0.0, samples.size());
+
+        if (steady < 3) {
+            std::printf(", \"verdict\": \"inconclusive\"}\n");
+            std::fprintf(stderr, "not enough samples after warm-up; lower --interval or run longer\n");
+            return 0;
+        }
+
+        struct Check {
+            const char* name;
+            double Sample::*field;
+            double limit;
+        };
+        const Check checks[] = {
+            {"rss_bytes", &Sample::rss, options.maxRssGrowthMb * 1048576.0},
+            {"threads", &Sample::threads, options.slack},
+            {"open_fds", &Sample::fds, options.slack},
+            {"handler_threads", &Sample::handlerThreads, options.slack}
+        };
+
+        size_t third = std::max<size_t>(1, steady / 3);
+        std::vector<std::string> failed;
+        std::printf(", \"growth\": {");
+        for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c) {
+            std::vector<double> early, late;
+            for (size_t i = 0; i < third; ++i) {
+                early.push_back(samples[first + i].*checks[c].field);
+                late.push_back(samples[samples.size() - 1 - i].*checks[c].field);
+            }
+            double growth = median(late) - median(early);
+            if (growth > checks[c].limit) {
+                failed.push_back(checks[c].name);
+            }
+            std::printf("%s\"%s\": %.0f", c ? ", " : "", checks[c].name, growth);
+        }
+
+        std::vector<double> perConnection;
+        for (size_t i = first; i < samples.size(); ++i) {
+            perConnection.push_back(samples[i].bytesPerConnection);
+        }
+        std::printf("}, \"bytes_per_connection\": %.0f, \"verdict\": \"%s\"}\n",
+                    median(perConnection), failed.empty() ? "pass" : "fail");
+
+        for (const auto& name : failed) {
+            std::fprintf(stderr, "FAIL: %s keeps growing\n", name.c_str());
+        }
+        return failed.empty() ? 0 : 1;
+    }
+
+    const Options& options;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<Sample> samples;
+    double baselineConnections = 0;
+    Clock::time_point started;
+
+    std::atomic<bool> stopping;
+    std::mutex pauseMutex;
+    std::condition_variable pauseChanged;
+    bool paused;
+    int parked;
+
+    std::atomic<long long> cycles;
+    std::atomic<long long> failures;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s [--host H] [--port P] [--metrics-port P] [--workers N] [--cycles N] "
+                     "[--duration S] [--interval S] [--hold N] [--warmup FRACTION] [--max-rss-growth-mb MB] "
+                     "[--slack N] [--prefix NAME]\n", argv[0]);
+        return 2;
+    }
+
+    SocketRuntime runtime;
+    Soak soak(options);
+    return soak.run();
+}
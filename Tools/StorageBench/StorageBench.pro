@@ -0,0 +1,17 @@
+TEMPLATE = app
+
+QT += core sql
+QT -= gui
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../ServerPart
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ../../ServerPart/metrics.hpp
+
+QMAKE_CXXFLAGS += -Wno-unknown-pragmas
@@ -0,0 +1,420 @@
+// Ingest and read benchmark for the server's message store. Grows a
+// messages table (same schema and statements as ChatServer) to each size in
+// turn, and at every size measures each combination of journal mode,
+// synchronous level and insert batch size:
+//
+//   - inserts/s with logMessage()'s INSERT, committed every `batch` rows;
+//   - HISTORY and SYNC query latency (loadHistoryBefore/loadMessagesSince);
+//   - database and WAL file size.
+//
+//   StorageBench --sizes 1000000,10000000,100000000 --journal delete,wal --sync normal,full --batch 1,10,100,1000
+//
+// Rows inserted by a measurement are deleted again before the next one, so
+// every combination at a given size sees the same table.
+
+#include "metrics.hpp"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string path = "storage_bench.db";
+    std::vector<long long> sizes = {1000000, 10000000, 100000000};
+    std::vector<std::string> journals = {"delete", "truncate", "wal"};
+    std::vector<std::string> syncs = {"off", "normal", "full"};
+    std::vector<long long> batches = {1, 10, 100, 1000};
+    long long inserts = 20000;
+    double insertSeconds = 10;
+    int reads = 2000;
+    int users = 1000;
+    int textSize = 64;
+    int pageSize = 50;
+    bool json = false;
+    bool keep = false;
+    unsigned seed = 1;
+};
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<long long> splitNumbers(const std::string& list) {
+    std::vector<long long> numbers;
+    for (const auto& item : splitList(list)) {
+        numbers.push_back(std::atoll(item.c_str()));
+    }
+    return numbers;
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--db" && hasValue) {
+            options.path = argv[++i];
+        } else if (arg == "--sizes" && hasValue) {
+            options.sizes = splitNumbers(argv[++i]);
+        } else if (arg == "--journal" && hasValue) {
+            options.journals = splitList(argv[++i]);
+        } else if (arg == "--sync" && hasValue) {
+            options.syncs = splitList(argv[++i]);
+        } else if (arg == "--batch" && hasValue) {
+            options.batches = splitNumbers(argv[++i]);
+        } else if (arg == "--inserts" && hasValue) {
+            options.inserts = std::max(1LL, std::atoll(argv[++i]));
+        } else if (arg == "--insert-seconds" && hasValue) {
+            options.insertSeconds = std::atof(argv[++i]);
+        } else if (arg == "--reads" && hasValue) {
+            options.reads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--users" && hasValue) {
+            options.users = std::max(2, std::atoi(argv[++i]));
+        } else if (arg == "--text" && hasValue) {
+            options.textSize = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = (unsigned)std::atoi(argv[++i]);
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else {
+            return false;
+        }
+    }
+    return !options.sizes.empty() && !options.journals.empty() && !options.syncs.empty() &&
+           !options.batches.empty();
+}
+
+struct Result {
+    long long rows = 0;
+    std::string journal;
+    std::string sync;
+    long long batch = 0;
+    long long inserted = 0;
+    double insertsPerSecond = 0;
+    HistogramSnapshot history;
+    HistogramSnapshot since;
+    long long dbBytes = 0;
+    long long walBytes = 0;
+};
+
+class StorageBench {
+public:
+    explicit StorageBench(const Options& options)
+        : options(options), rng(options.seed), history(new Histogram), since(new Histogram) {}
+
+    ~StorageBench() {
+        if (db.isOpen()) {
+            db.close();
+        }
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase("storage_bench");
+        if (!options.keep) {
+            removeFiles();
+        }
+    }
+
+    bool open() {
+        db = QSqlDatabase::addDatabase("QSQLITE", "storage_bench");
+        db.setDatabaseName(QString::fromStdString(options.path));
+        if (!db.open()) {
+            std::fprintf(stderr, "cannot open %s: %s\n", options.path.c_str(),
+                         db.lastError().text().toStdString().c_str());
+            return false;
+        }
+
+        // Same schema as ChatServer::initializeDatabase().
+        QSqlQuery query(db);
+        return exec(query, "CREATE TABLE IF NOT EXISTS messages ("
+                           "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                           "sender TEXT NOT NULL,"
+                           "getter TEXT NOT NULL,"
+                           "text TEXT NOT NULL,"
+                           "tag TEXT NOT NULL,"
+                           "timestamp DATETIME DEFAULT CURRENT_TIMESTAMP)") &&
+               exec(query, "CREATE INDEX IF NOT EXISTS idx_messages_getter ON messages (getter, id)") &&
+               exec(query, "CREATE INDEX IF NOT EXISTS idx_messages_sender ON messages (sender, id)");
+    }
+
+    int run() {
+        if (!options.json) {
+            std::printf("%11s %-8s %-6s %6s %10s %10s %10s %10s %10s %9s %9s\n",
+                        "rows", "journal", "sync", "batch", "inserts/s", "hist_p50", "hist_p99",
+                        "sync_p50", "sync_p99", "db_MB", "wal_MB");
+        }
+
+        for (long long size : options.sizes) {
+            if (!growTo(size)) {
+                return 1;
+            }
+            for (const auto& journal : options.journals) {
+                for (const auto& sync : options.syncs) {
+                    if (!setPragma("journal_mode", journal) || !setPragma("synchronous", sync)) {
+                        return 1;
+                    }
+                    for (long long batch : options.batches) {
+                        Result result;
+                        result.journal = journal;
+                        result.sync = sync;
+                        result.batch = batch;
+                        if (!measure(result)) {
+                            return 1;
+                        }
+                        print(result);
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+private:
+    bool exec(QSqlQuery& query, const QString& sql) {
+        if (!query.exec(sql)) {
+            std::fprintf(stderr, "%s: %s\n", sql.toStdString().c_str(),
+                         query.lastError().text().toStdString().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool setPragma(const std::string& name, const std::string& value) {
+        QSqlQuery query(db);
+        return exec(query, QString::fromStdString("PRAGMA " + name + " = " + value));
+    }
+
+    long long scalar(const QString& sql) {
+        QSqlQuery query(db);
+        if (exec(query, sql) && query.next()) {
+            return query.value(0).toLongLong();
+        }
+        return 0;
+    }
+
+    std::string randomUser() {
+        return "user" + std::to_string(std::uniform_int_distribution<int>(0, options.users - 1)(rng));
+    }
+
+    // Bulk fill inside SQLite itself; a row at a time through Qt would take
+    // hours at 100M. One transaction per million rows keeps the journal small.
+    bool growTo(long long target) {
+        long long rows = scalar("SELECT COUNT(*) FROM messages");
+        if (rows >= target) {
+            return true;
+        }
+        setPragma("synchronous", "off");
+
+        auto started = Clock::now();
+        QSqlQuery query(db);
+        while (rows < target) {
+            long long chunk = std::min(1000000LL, target - rows);
+            query.prepare("WITH RECURSIVE seq(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM seq LIMIT ?) "
+                          "INSERT INTO messages (sender, getter, text, tag) "
+                          "SELECT 'user' || (abs(random()) % ?), "
+                          "CASE WHEN abs(random()) % 20 = 0 THEN 'ALL' ELSE 'user' || (abs(random()) % ?) END, "
+                          "substr(hex(randomblob(?)), 1, ?), 'text' FROM seq");
+            query.addBindValue(chunk);
+            query.addBindValue(options.users);
+            query.addBindValue(options.users);
+            query.addBindValue((options.textSize + 1) / 2);
+            query.addBindValue(options.textSize);
+
+            db.transaction();
+            if (!query.exec()) {
+                std::fprintf(stderr, "prefill: %s\n", query.lastError().text().toStdString().c_str());
+                db.rollback();
+                return false;
+            }
+            db.commit();
+            rows += chunk;
+            std::fprintf(stderr, "prefill: %lld / %lld rows, %.0f s\n", rows, target,
+                         std::chrono::duration<double>(Clock::now() - started).count());
+        }
+        return true;
+    }
+
+    bool measure(Result& result) {
+        long long baseline = scalar("SELECT MAX(id) FROM messages");
+        result.rows = scalar("SELECT COUNT(*) FROM messages");
+
+        std::string text(options.textSize, 'x');
+        QSqlQuery insert(db);
+        insert.prepare("INSERT INTO messages (sender, getter, text, tag) VALUES (?, ?, ?, ?)");
+
+        auto started = Clock::now();
+        auto deadline = started + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.insertSeconds));
+        long long inserted = 0;
+        while (inserted < options.inserts && Clock::now() < deadline) {
+            long long batch = std::min(result.batch, options.inserts - inserted);
+            if (batch > 1) {
+                db.transaction();
+            }
+            for (long long i = 0; i < batch; ++i) {
+                insert.addBindValue(QString::fromStdString(randomUser()));
+                insert.addBindValue(QString::fromStdString(randomUser()));
+                insert.addBindValue(QString::fromStdString(text));
+                insert.addBindValue(QString("text"));
+                if (!insert.exec()) {
+                    std::fprintf(stderr, "insert: %s\n", insert.lastError().text().toStdString().c_str());
+                    db.rollback();
+                    return false;
+                }
+            }
+            if (batch > 1) {
+                db.commit();
+            }
+            inserted += batch;
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+        result.inserted = inserted;
+        result.insertsPerSecond = seconds > 0 ? inserted / seconds : 0;
+
+        measureReads(baseline + inserted);
+        result.history = history->snapshot();
+        result.since = since->snapshot();
+
+        result.dbBytes = QFileInfo(QString::fromStdString(options.path)).size();
+        result.walBytes = QFileInfo(QString::fromStdString(options.path + "-wal")).size();
+
+        // Back to the same table for the next combination.
+        QSqlQuery cleanup(db);
+        cleanup.prepare("DELETE FROM messages WHERE id > ?");
+        cleanup.addBindValue(baseline);
+        return cleanup.exec();
+    }
+
+    // The server's HISTORY and SYNC statements for random users, timed from
+    // exec() through the last row.
+    void measureReads(long long maxId) {
+        history.reset(new Histogram);
+        since.reset(new Histogram);
+
+        QSqlQuery page(db);
+        page.setForwardOnly(true);
+        page.prepare("SELECT id, sender, getter, text, tag FROM messages "
+                     "WHERE id < ? AND (getter = ? OR getter = 'ALL' OR sender = ?) "
+                     "ORDER BY id DESC LIMIT ?");
+        QSqlQuery missed(db);
+        missed.setForwardOnly(true);
+        missed.prepare("SELECT id, sender, getter, text, tag FROM messages "
+                       "WHERE id > ? AND (getter = ? OR getter = 'ALL') AND sender != ? "
+                       "ORDER BY id LIMIT ?");
+
+        std::uniform_int_distribution<long long> anyId(1, std::max(1LL, maxId));
+        for (int i = 0; i < options.reads; ++i) {
+            QString user = QString::fromStdString(randomUser());
+
+            page.addBindValue(anyId(rng));
+            page.addBindValue(user);
+            page.addBindValue(user);
+            page.addBindValue(options.pageSize);
+            history->record(timedRead(page));
+
+            // A client that was away for the last few thousand messages.
+            missed.addBindValue(std::max(0LL, maxId - 5000));
+            missed.addBindValue(user);
+            missed.addBindValue(user);
+            missed.addBindValue(500);
+            since->record(timedRead(missed));
+        }
+    }
+
+    static uint64_t timedRead(QSqlQuery& query) {
+        auto started = Clock::now();
+        if (query.exec()) {
+            while (query.next()) {
+                query.value(3);
+            }
+        }
+        query.finish();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+    }
+
+    void print(const Result& result) {
+        if (options.json) {
+            std::printf("{\"rows\": %lld, \"journal_mode\": \"%s\", \"synchronous\": \"%s\", \"batch\": %lld, "
+                        "\"inserted\": %lld, \"inserts_per_s\": %.1f, "
+                        "\"history_us\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu}, "
+                        "\"sync_us\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu}, "
+                        "\"db_bytes\": %lld, \"wal_bytes\": %lld}\n",
+                        result.rows, result.journal.c_str(), result.sync.c_str(), result.batch,
+                        result.inserted, result.insertsPerSecond,
+                        (unsigned long long)result.history.percentile(0.50),
+                        (unsigned long long)result.history.percentile(0.99),
+                        (unsigned long long)result.history.max(),
+                        (unsigned long long)result.since.percentile(0.50),
+                        (unsigned long long)result.since.percentile(0.99),
+                        (unsigned long long)result.since.max(),
+                        result.dbBytes, result.walBytes);
+        } else {
+            std::printf("%11lld %-8s %-6s %6lld %10.0f %10llu %10llu %10llu %10llu %9.1f %9.1f\n",
+                        result.rows, result.journal.c_str(), result.sync.c_str(), result.batch,
+                        result.insertsPerSecond,
+                        (unsigned long long)result.history.percentile(0.50),
+                        (unsigned long long)result.history.percentile(0.99),
+                        (unsigned long long)result.since.percentile(0.50),
+                        (unsigned long long)result.since.percentile(0.99),
+                        result.dbBytes / 1048576.0, result.walBytes / 1048576.0);
+        }
+        std::fflush(stdout);
+    }
+
+    void removeFiles() {
+        for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+            QFile::remove(QString::fromStdString(options.path + suffix));
+        }
+    }
+
+    Options options;
+    QSqlDatabase db;
+    std::mt19937 rng;
+    std::unique_ptr<Histogram> history;
+    std::unique_ptr<Histogram> since;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s [--db PATH] [--sizes N,...] [--journal delete,truncate,wal,...] "
+                     "[--sync off,normal,full,...] [--batch N,...] [--inserts N] [--insert-seconds S] "
+                     "[--reads N] [--users N] [--text BYTES] [--seed N] [--json] [--keep]\n", argv[0]);
+        return 2;
+    }
+
+    StorageBench bench(options);
+    if (!bench.open()) {
+        return 1;
+    }
+    return bench.run();
+}